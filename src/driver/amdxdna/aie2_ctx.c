@@ -3,6 +3,7 @@
  * Copyright (C) 2024, Advanced Micro Devices, Inc.
  */
 
+#include <linux/eventfd.h>
 #include <linux/timekeeping.h>
 
 #include "amdxdna_ctx.h"
@@ -26,7 +27,7 @@ aie2_hwctx_add_job(struct amdxdna_hwctx *hwctx, struct amdxdna_sched_job *job)
 	struct amdxdna_sched_job *other;
 	int idx;
 
-	idx = get_job_idx(hwctx->submitted);
+	idx = get_job_idx(hwctx, hwctx->submitted);
 	/* When pending list full, hwctx->submitted points to oldest fence */
 	other = hwctx->priv->pending[idx];
 	if (other && other->fence)
@@ -52,10 +53,10 @@ aie2_hwctx_get_job(struct amdxdna_hwctx *hwctx, u64 seq)
 	if (seq >= hwctx->submitted)
 		return ERR_PTR(-EINVAL);
 
-	if (seq + HWCTX_MAX_CMDS < hwctx->submitted)
+	if (seq + hwctx->max_cmds < hwctx->submitted)
 		return NULL;
 
-	idx = get_job_idx(seq);
+	idx = get_job_idx(hwctx, seq);
 	return hwctx->priv->pending[idx];
 }
 
@@ -66,9 +67,141 @@ static void aie2_hwctx_stop(struct amdxdna_dev *xdna, struct amdxdna_hwctx *hwct
 	aie2_destroy_context(xdna->dev_handle, hwctx);
 }
 
+/*
+ * Map dev heap segments from first on to firmware. On failure, *mapped is
+ * set to the first segment not mapped, firmware may access the ones before.
+ */
+static int aie2_hwctx_map_heaps(struct amdxdna_hwctx *hwctx, u32 first, u32 *mapped)
+{
+	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	struct amdxdna_gem_obj *heap;
+	u32 i;
+	int ret;
+
+	for (i = first; i < hwctx->priv->num_heaps; i++) {
+		heap = hwctx->priv->heaps[i];
+#ifdef AMDXDNA_DEVEL
+		if (iommu_mode == AMDXDNA_IOMMU_NO_PASID) {
+			ret = aie2_map_host_buf(xdna->dev_handle, hwctx->fw_ctx_id,
+						heap->mem.dma_addr, heap->mem.size);
+			goto skip;
+		}
+#endif
+		ret = aie2_map_host_buf(xdna->dev_handle, hwctx->fw_ctx_id,
+					heap->mem.userptr, heap->mem.size);
+#ifdef AMDXDNA_DEVEL
+skip:
+#endif
+		if (ret) {
+			XDNA_ERR(xdna, "Map dev heap segment %d failed, ret %d", i, ret);
+			*mapped = i;
+			return ret;
+		}
+	}
+
+	*mapped = i;
+	return 0;
+}
+
+/* Pin the dev heap segments created since last call. */
+static int aie2_hwctx_pin_heaps(struct amdxdna_hwctx *hwctx)
+{
+	struct amdxdna_hwctx_priv *priv = hwctx->priv;
+	struct amdxdna_client *client = hwctx->client;
+	struct amdxdna_gem_obj *heap;
+	int ret;
+
+	while (priv->num_heaps < AMDXDNA_MAX_DEV_HEAPS) {
+		heap = amdxdna_gem_get_dev_heap(client, priv->num_heaps);
+		if (!heap)
+			break;
+
+		/* Not mmap'ed by user yet, no BO can be allocated from it */
+		if (heap->mem.userptr == AMDXDNA_INVALID_ADDR) {
+			drm_gem_object_put(to_gobj(heap));
+			break;
+		}
+
+		ret = amdxdna_gem_pin(heap);
+		if (ret) {
+			XDNA_ERR(client->xdna, "Dev heap pin failed, ret %d", ret);
+			drm_gem_object_put(to_gobj(heap));
+			return ret;
+		}
+		priv->heaps[priv->num_heaps++] = heap;
+	}
+
+	return 0;
+}
+
+static void aie2_hwctx_unpin_heaps(struct amdxdna_hwctx *hwctx, u32 first)
+{
+	struct amdxdna_hwctx_priv *priv = hwctx->priv;
+
+	while (priv->num_heaps > first) {
+		priv->num_heaps--;
+		amdxdna_gem_unpin(priv->heaps[priv->num_heaps]);
+		drm_gem_object_put(to_gobj(priv->heaps[priv->num_heaps]));
+	}
+}
+
+/*
+ * User grows the dev heap when it runs out of space. Map the new segments
+ * before the first job, which may reference BOs inside of them, is pushed.
+ */
+static int aie2_hwctx_grow_heaps_locked(struct amdxdna_hwctx *hwctx)
+{
+	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	u32 first, mapped;
+	int ret;
+
+	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&xdna->dev_lock));
+	first = hwctx->priv->num_heaps;
+	ret = aie2_hwctx_pin_heaps(hwctx);
+	if (ret)
+		goto unpin;
+
+	/* Stopped context maps all segments on restart */
+	if (hwctx->status != HWCTX_STAT_STOP) {
+		ret = aie2_hwctx_map_heaps(hwctx, first, &mapped);
+		if (ret) {
+			/*
+			 * Firmware has no unmap, segments it has mapped stay
+			 * pinned. Next grow maps the rest again.
+			 */
+			first = mapped;
+			goto unpin;
+		}
+	}
+
+	if (hwctx->priv->num_heaps != first)
+		XDNA_DBG(xdna, "%s mapped %d dev heap segments", hwctx->name,
+			 hwctx->priv->num_heaps);
+	return 0;
+
+unpin:
+	aie2_hwctx_unpin_heaps(hwctx, first);
+	return ret;
+}
+
+static int aie2_hwctx_grow_heaps(struct amdxdna_hwctx *hwctx)
+{
+	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	int ret;
+
+	/* Segment not mmap'ed yet has no BO in it, no need to map it now */
+	if (READ_ONCE(hwctx->client->num_mapped_dev_heaps) <= READ_ONCE(hwctx->priv->num_heaps))
+		return 0;
+
+	mutex_lock(&xdna->dev_lock);
+	ret = aie2_hwctx_grow_heaps_locked(hwctx);
+	mutex_unlock(&xdna->dev_lock);
+	return ret;
+}
+
 static int aie2_hwctx_restart(struct amdxdna_dev *xdna, struct amdxdna_hwctx *hwctx)
 {
-	struct amdxdna_gem_obj *heap = hwctx->priv->heap;
+	u32 mapped;
 	int ret;
 
 	ret = aie2_create_context(xdna->dev_handle, hwctx);
@@ -77,12 +210,9 @@ static int aie2_hwctx_restart(struct amdxdna_dev *xdna, struct amdxdna_hwctx *hw
 		goto out;
 	}
 
-	ret = aie2_map_host_buf(xdna->dev_handle, hwctx->fw_ctx_id,
-				heap->mem.userptr, heap->mem.size);
-	if (ret) {
-		XDNA_ERR(xdna, "Map host buf failed, ret %d", ret);
+	ret = aie2_hwctx_map_heaps(hwctx, 0, &mapped);
+	if (ret)
 		goto out;
-	}
 
 	if (hwctx->old_status != HWCTX_STAT_READY) {
 		XDNA_DBG(xdna, "hwctx is not ready, status %d", hwctx->status);
@@ -222,6 +352,20 @@ void aie2_hwctx_resume(struct amdxdna_hwctx *hwctx)
 			  hwctx->name, hwctx->status, err);
 }
 
+static void aie2_hwctx_signal_eventfd(struct amdxdna_hwctx *hwctx)
+{
+	struct eventfd_ctx *efd = READ_ONCE(hwctx->priv->completion_efd);
+
+	if (!efd)
+		return;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+	eventfd_signal(efd, 1);
+#else
+	eventfd_signal(efd);
+#endif
+}
+
 static void
 aie2_sched_notify(struct amdxdna_sched_job *job)
 {
@@ -234,6 +378,7 @@ aie2_sched_notify(struct amdxdna_sched_job *job)
 	hwctx->completed++;
 	trace_xdna_job(&job->base, hwctx->name, "signaling fence", job->seq, job->opcode);
 	dma_fence_signal(fence);
+	aie2_hwctx_signal_eventfd(hwctx);
 	mmput(job->mm);
 	amdxdna_job_put(job);
 }
@@ -548,34 +693,40 @@ int aie2_hwctx_init(struct amdxdna_hwctx *hwctx)
 	struct amdxdna_dev *xdna = client->xdna;
 	struct drm_gpu_scheduler *sched;
 	struct amdxdna_hwctx_priv *priv;
-	struct amdxdna_gem_obj *heap;
 	unsigned int wq_flags;
+	u32 mapped;
 	int i, ret;
 
+	if (!hwctx->max_cmds)
+		hwctx->max_cmds = HWCTX_DEF_CMDS;
+	if (hwctx->max_cmds < HWCTX_MIN_CMDS || hwctx->max_cmds > HWCTX_MAX_CMDS) {
+		XDNA_ERR(xdna, "Invalid max cmds %d", hwctx->max_cmds);
+		return -EINVAL;
+	}
+	hwctx->max_cmds = roundup_pow_of_two(hwctx->max_cmds);
+
 	priv = kzalloc(sizeof(*hwctx->priv), GFP_KERNEL);
 	if (!priv)
 		return -ENOMEM;
 	hwctx->priv = priv;
 
-	mutex_lock(&client->mm_lock);
-	heap = client->dev_heap;
-	if (!heap) {
-		XDNA_ERR(xdna, "The client dev heap object not exist");
-		mutex_unlock(&client->mm_lock);
-		ret = -ENOENT;
+	priv->pending = kcalloc(hwctx->max_cmds, sizeof(*priv->pending), GFP_KERNEL);
+	priv->cmd_buf = kcalloc(hwctx->max_cmds, sizeof(*priv->cmd_buf), GFP_KERNEL);
+	if (!priv->pending || !priv->cmd_buf) {
+		ret = -ENOMEM;
 		goto free_priv;
 	}
-	drm_gem_object_get(to_gobj(heap));
-	mutex_unlock(&client->mm_lock);
-	priv->heap = heap;
 
-	ret = amdxdna_gem_pin(heap);
-	if (ret) {
-		XDNA_ERR(xdna, "Dev heap pin failed, ret %d", ret);
-		goto put_heap;
+	ret = aie2_hwctx_pin_heaps(hwctx);
+	if (ret)
+		goto unpin_heaps;
+	if (!priv->num_heaps) {
+		XDNA_ERR(xdna, "The client dev heap object not exist");
+		ret = -ENOENT;
+		goto free_priv;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(priv->cmd_buf); i++) {
+	for (i = 0; i < hwctx->max_cmds; i++) {
 		struct amdxdna_gem_obj *abo;
 		struct amdxdna_drm_create_bo args = {
 			.flags = 0,
@@ -607,7 +758,7 @@ int aie2_hwctx_init(struct amdxdna_hwctx *hwctx)
 		goto free_cmd_bufs;
 	}
 	ret = drm_sched_init(sched, &sched_ops, priv->submit_wq, DRM_SCHED_PRIORITY_COUNT,
-			     HWCTX_MAX_CMDS, 0, MAX_SCHEDULE_TIMEOUT,
+			     hwctx->max_cmds, 0, MAX_SCHEDULE_TIMEOUT,
 			     NULL, NULL, hwctx->name, xdna->ddev.dev);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to init DRM scheduler. ret %d", ret);
@@ -634,22 +785,14 @@ int aie2_hwctx_init(struct amdxdna_hwctx *hwctx)
 		goto free_col_list;
 	}
 
-#ifdef AMDXDNA_DEVEL
-	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID) {
-		ret = aie2_map_host_buf(xdna->dev_handle, hwctx->fw_ctx_id,
-					heap->mem.dma_addr, heap->mem.size);
-		goto skip;
-	}
-#endif
-	ret = aie2_map_host_buf(xdna->dev_handle, hwctx->fw_ctx_id,
-				heap->mem.userptr, heap->mem.size);
-#ifdef AMDXDNA_DEVEL
-skip:
-#endif
-	if (ret) {
-		XDNA_ERR(xdna, "Map host buffer failed, ret %d", ret);
+	/* Segments may have been added while the context was set up */
+	ret = aie2_hwctx_pin_heaps(hwctx);
+	if (ret)
+		goto release_resource;
+	/* Context is destroyed on failure before segments are unpinned */
+	ret = aie2_hwctx_map_heaps(hwctx, 0, &mapped);
+	if (ret)
 		goto release_resource;
-	}
 	hwctx->status = HWCTX_STAT_INIT;
 
 	XDNA_DBG(xdna, "hwctx %s init completed", hwctx->name);
@@ -667,16 +810,18 @@ free_sched:
 free_wq:
 	destroy_workqueue(priv->submit_wq);
 free_cmd_bufs:
-	for (i = 0; i < ARRAY_SIZE(priv->cmd_buf); i++) {
+	for (i = 0; i < hwctx->max_cmds; i++) {
 		if (!priv->cmd_buf[i])
 			continue;
 		drm_gem_object_put(to_gobj(priv->cmd_buf[i]));
 	}
-	amdxdna_gem_unpin(heap);
-put_heap:
-	drm_gem_object_put(to_gobj(heap));
+unpin_heaps:
+	aie2_hwctx_unpin_heaps(hwctx, 0);
 free_priv:
+	kfree(priv->cmd_buf);
+	kfree(priv->pending);
 	kfree(priv);
+	hwctx->priv = NULL;
 	return ret;
 }
 
@@ -704,7 +849,7 @@ void aie2_hwctx_fini(struct amdxdna_hwctx *hwctx)
 	drm_sched_fini(&hwctx->priv->sched);
 	destroy_workqueue(hwctx->priv->submit_wq);
 
-	for (idx = 0; idx < HWCTX_MAX_CMDS; idx++) {
+	for (idx = 0; idx < hwctx->max_cmds; idx++) {
 		job = hwctx->priv->pending[idx];
 		if (!job)
 			continue;
@@ -714,10 +859,11 @@ void aie2_hwctx_fini(struct amdxdna_hwctx *hwctx)
 	}
 	XDNA_DBG(xdna, "%s total completed jobs %lld", hwctx->name, hwctx->completed);
 
-	for (idx = 0; idx < ARRAY_SIZE(hwctx->priv->cmd_buf); idx++)
+	for (idx = 0; idx < hwctx->max_cmds; idx++)
 		drm_gem_object_put(to_gobj(hwctx->priv->cmd_buf[idx]));
-	amdxdna_gem_unpin(hwctx->priv->heap);
-	drm_gem_object_put(to_gobj(hwctx->priv->heap));
+	aie2_hwctx_unpin_heaps(hwctx, 0);
+	if (hwctx->priv->completion_efd)
+		eventfd_ctx_put(hwctx->priv->completion_efd);
 #ifdef AMDXDNA_DEVEL
 	if (priv_load)
 		aie2_unregister_pdis(hwctx);
@@ -725,6 +871,8 @@ void aie2_hwctx_fini(struct amdxdna_hwctx *hwctx)
 
 	mutex_destroy(&hwctx->priv->io_lock);
 	kfree(hwctx->col_list);
+	kfree(hwctx->priv->cmd_buf);
+	kfree(hwctx->priv->pending);
 	kfree(hwctx->priv);
 	kfree(hwctx->cus);
 }
@@ -816,6 +964,11 @@ static int aie2_hwctx_attach_debug_bo(struct amdxdna_hwctx *hwctx, u32 bo_hdl)
 		goto put_obj;
 	}
 
+	/* Called with dev_lock held, map new heap segments before submit does */
+	ret = aie2_hwctx_grow_heaps_locked(hwctx);
+	if (ret)
+		goto clear_ctx;
+
 	ret = amdxdna_cmd_submit(client, OP_REG_DEBUG_BO, AMDXDNA_INVALID_BO_HANDLE,
 				 &bo_hdl, 1, NULL, NULL, 0, hwctx->id, &seq);
 	if (ret) {
@@ -852,6 +1005,10 @@ static int aie2_hwctx_detach_debug_bo(struct amdxdna_hwctx *hwctx, u32 bo_hdl)
 
 	amdxdna_gem_clear_assigned_hwctx(client, bo_hdl);
 
+	ret = aie2_hwctx_grow_heaps_locked(hwctx);
+	if (ret)
+		return ret;
+
 	ret = amdxdna_cmd_submit(client, OP_UNREG_DEBUG_BO, AMDXDNA_INVALID_BO_HANDLE,
 				 &bo_hdl, 1, NULL, NULL, 0, hwctx->id, &seq);
 	if (unlikely(ret)) {
@@ -864,6 +1021,28 @@ static int aie2_hwctx_detach_debug_bo(struct amdxdna_hwctx *hwctx, u32 bo_hdl)
 	return ret;
 }
 
+static int aie2_hwctx_assign_eventfd(struct amdxdna_hwctx *hwctx, int fd)
+{
+	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	struct eventfd_ctx *efd;
+
+	if (hwctx->priv->completion_efd) {
+		XDNA_ERR(xdna, "%s already has an eventfd", hwctx->name);
+		return -EBUSY;
+	}
+
+	efd = eventfd_ctx_fdget(fd);
+	if (IS_ERR(efd)) {
+		XDNA_ERR(xdna, "Get eventfd %d failed, ret %ld", fd, PTR_ERR(efd));
+		return PTR_ERR(efd);
+	}
+
+	/* Completion of commands in flight may see it right away */
+	WRITE_ONCE(hwctx->priv->completion_efd, efd);
+	XDNA_DBG(xdna, "Assigned eventfd %d to %s", fd, hwctx->name);
+	return 0;
+}
+
 int aie2_hwctx_config(struct amdxdna_hwctx *hwctx, u32 type, u64 value, void *buf, u32 size)
 {
 	struct amdxdna_dev *xdna = hwctx->client->xdna;
@@ -876,26 +1055,34 @@ int aie2_hwctx_config(struct amdxdna_hwctx *hwctx, u32 type, u64 value, void *bu
 		return aie2_hwctx_attach_debug_bo(hwctx, (u32)value);
 	case DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF:
 		return aie2_hwctx_detach_debug_bo(hwctx, (u32)value);
+	case DRM_AMDXDNA_HWCTX_ASSIGN_EVENTFD:
+		return aie2_hwctx_assign_eventfd(hwctx, (int)value);
 	default:
 		XDNA_DBG(xdna, "Not supported type %d", type);
 		return -EOPNOTSUPP;
 	}
 }
 
-static int aie2_populate_range(struct amdxdna_gem_obj *abo)
+/*
+ * Fault in the invalidated chunks of a userptr BO. Each run of adjacent
+ * invalidated chunks is one hmm_range_fault(), the rest of the BO is left
+ * alone. Bytes faulted in are added to *refaulted.
+ */
+static int aie2_populate_range(struct amdxdna_gem_obj *abo, u64 *refaulted)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
-	struct mm_struct *mm = abo->mem.notifier.mm;
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+	struct amdxdna_mem *mem = &abo->mem;
+	struct mm_struct *mm = mem->notifier.mm;
 	struct hmm_range range = { 0 };
+	unsigned long first, last;
 	unsigned long timeout;
+	u64 faulted;
 	int ret;
 
 	XDNA_INFO_ONCE(xdna, "populate memory range %llx size %lx",
-		       abo->mem.userptr, abo->mem.size);
-	range.notifier = &abo->mem.notifier;
-	range.start = abo->mem.userptr;
-	range.end = abo->mem.userptr + abo->mem.size;
-	range.hmm_pfns = abo->mem.pfns;
+		       mem->userptr, mem->size);
+	range.notifier = &mem->notifier;
 	range.default_flags = HMM_PFN_REQ_FAULT;
 
 	if (!mmget_not_zero(mm))
@@ -903,9 +1090,33 @@ static int aie2_populate_range(struct amdxdna_gem_obj *abo)
 
 	timeout = jiffies + msecs_to_jiffies(HMM_RANGE_DEFAULT_TIMEOUT);
 again:
-	range.notifier_seq = mmu_interval_read_begin(&abo->mem.notifier);
+	ret = 0;
+	faulted = 0;
+	/*
+	 * Chunks invalidated before this are seen in the bitmap, the ones
+	 * invalidated after this make the read retry below.
+	 */
+	range.notifier_seq = mmu_interval_read_begin(&mem->notifier);
 	mmap_read_lock(mm);
-	ret = hmm_range_fault(&range);
+	for (first = find_first_bit(mem->invalid_chunks, mem->nr_chunks);
+	     first < mem->nr_chunks;
+	     first = find_next_bit(mem->invalid_chunks, mem->nr_chunks, last)) {
+		last = find_next_zero_bit(mem->invalid_chunks, mem->nr_chunks, first);
+
+		range.start = mem->userptr + ((u64)first << AMDXDNA_HMM_CHUNK_SHIFT);
+		range.end = min_t(u64, mem->userptr + ((u64)last << AMDXDNA_HMM_CHUNK_SHIFT),
+				  mem->userptr + mem->size);
+		if (range.start >= range.end)
+			break;
+		range.hmm_pfns = mem->pfns + ((range.start - mem->userptr) >> PAGE_SHIFT);
+		ret = hmm_range_fault(&range);
+		if (ret)
+			break;
+
+		trace_xdna_hmm_populate(mem->userptr, range.start - mem->userptr,
+					range.end - range.start);
+		faulted += range.end - range.start;
+	}
 	mmap_read_unlock(mm);
 	if (ret) {
 		if (time_after(jiffies, timeout)) {
@@ -920,13 +1131,18 @@ again:
 	}
 
 	dma_resv_lock(to_gobj(abo)->resv, NULL);
-	if (mmu_interval_read_retry(&abo->mem.notifier, range.notifier_seq)) {
+	if (mmu_interval_read_retry(&mem->notifier, range.notifier_seq)) {
 		dma_resv_unlock(to_gobj(abo)->resv);
 		goto again;
 	}
-	abo->mem.map_invalid = false;
+	bitmap_zero(mem->invalid_chunks, mem->nr_chunks);
+	mem->map_invalid = false;
 	dma_resv_unlock(to_gobj(abo)->resv);
 
+	atomic64_add(faulted, &ndev->hmm_refaulted_bytes);
+	atomic64_inc(&ndev->hmm_refault_cnt);
+	*refaulted += faulted;
+
 put_mm:
 	mmput(mm);
 	return ret;
@@ -944,7 +1160,7 @@ static int aie2_add_job_dependency(struct amdxdna_sched_job *job, u32 *syncobj_h
 	for (i = 0; ret == 0 && i < syncobj_cnt; i++) {
 		hdl = syncobj_hdls[i];
 		pt = syncobj_points[i];
-		ret = drm_sched_job_add_syncobj_dependency(&job->base, client->filp, hdl, pt);
+		ret = amdxdna_job_add_syncobj_dependency(job, hdl, pt);
 		if (ret) {
 			XDNA_ERR(client->xdna,
 				 "Failed to add syncobj (%d@%lld) as dependency, ret %d",
@@ -961,8 +1177,16 @@ int aie2_cmd_submit(struct amdxdna_hwctx *hwctx, struct amdxdna_sched_job *job,
 	struct ww_acquire_ctx acquire_ctx;
 	struct amdxdna_gem_obj *abo;
 	unsigned long timeout = 0;
+	u64 refaulted = 0;
 	int ret, i;
 
+	/* Debug BO jobs are submitted with dev_lock held and heaps already grown */
+	if (job->opcode == OP_USER) {
+		ret = aie2_hwctx_grow_heaps(hwctx);
+		if (ret)
+			return ret;
+	}
+
 	ret = drm_sched_job_init(&job->base, &hwctx->priv->entity, 1, hwctx);
 	if (ret) {
 		XDNA_ERR(xdna, "DRM job init failed, ret %d", ret);
@@ -997,7 +1221,7 @@ retry:
 				goto put_fence;
 			}
 
-			ret = aie2_populate_range(abo);
+			ret = aie2_populate_range(abo, &refaulted);
 			if (ret)
 				goto put_fence;
 			goto retry;
@@ -1023,7 +1247,7 @@ again:
 
 		if (ret == -EAGAIN) {
 			// Waiting for the first pending cmd to complete before trying again.
-			int res = aie2_cmd_wait(hwctx, hwctx->submitted - HWCTX_MAX_CMDS, 0);
+			int res = aie2_cmd_wait(hwctx, hwctx->submitted - hwctx->max_cmds, 0);
 			if (!res)
 				goto again;
 		}
@@ -1034,6 +1258,9 @@ again:
 	drm_sched_entity_push_job(&job->base);
 	mutex_unlock(&hwctx->priv->io_lock);
 
+	if (refaulted)
+		trace_xdna_hmm_refault(hwctx->name, *seq, refaulted);
+
 	return 0;
 
 signal_fence:
@@ -1099,14 +1326,28 @@ struct dma_fence *aie2_cmd_get_out_fence(struct amdxdna_hwctx *hwctx, u64 seq)
 }
 
 void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo,
-			 unsigned long cur_seq)
+			 const struct mmu_notifier_range *range, unsigned long cur_seq)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
 	struct drm_gem_object *gobj = to_gobj(abo);
+	struct amdxdna_mem *mem = &abo->mem;
+	unsigned long start, end;
 	long ret;
 
+	start = max_t(unsigned long, range->start, mem->userptr);
+	end = min_t(unsigned long, range->end, mem->userptr + mem->size);
+
 	dma_resv_lock(gobj->resv, NULL);
-	abo->mem.map_invalid = true;
+	if (start < end) {
+		unsigned long first = (start - mem->userptr) >> AMDXDNA_HMM_CHUNK_SHIFT;
+		unsigned long last = min_t(unsigned long, mem->nr_chunks,
+					   DIV_ROUND_UP(end - mem->userptr, AMDXDNA_HMM_CHUNK_SIZE));
+
+		bitmap_set(mem->invalid_chunks, first, last - first);
+		mem->map_invalid = true;
+		atomic64_add(end - start, &xdna->dev_handle->hmm_invalidated_bytes);
+		trace_xdna_hmm_invalidate(mem->userptr, start - mem->userptr, end - start);
+	}
 	mmu_interval_set_seq(&abo->mem.notifier, cur_seq);
 	ret = dma_resv_wait_timeout(gobj->resv, DMA_RESV_USAGE_BOOKKEEP,
 				    true, MAX_SCHEDULE_TIMEOUT);
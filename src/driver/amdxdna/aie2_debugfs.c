@@ -487,6 +487,18 @@ static int aie2_msg_queue_show(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(msg_queue, aie2_msg_queue_show, NULL);
 
+static int aie2_hmm_stats_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	seq_printf(m, "invalidated_bytes %lld\n", atomic64_read(&ndev->hmm_invalidated_bytes));
+	seq_printf(m, "refaulted_bytes %lld\n", atomic64_read(&ndev->hmm_refaulted_bytes));
+	seq_printf(m, "refault_count %lld\n", atomic64_read(&ndev->hmm_refault_cnt));
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(hmm_stats, aie2_hmm_stats_show, NULL);
+
 static int aie2_telemetry(struct seq_file *m, u32 type)
 {
 	struct amdxdna_dev_hdl *ndev = m->private;
@@ -565,6 +577,7 @@ const struct {
 	AIE2_DBGFS_FILE(ringbuf, 0400),
 	AIE2_DBGFS_FILE(msg_queue, 0400),
 	AIE2_DBGFS_FILE(ioctl_id, 0400),
+	AIE2_DBGFS_FILE(hmm_stats, 0400),
 	AIE2_DBGFS_FILE(telemetry_disabled, 0400),
 	AIE2_DBGFS_FILE(telemetry_health, 0400),
 	AIE2_DBGFS_FILE(telemetry_error_info, 0400),
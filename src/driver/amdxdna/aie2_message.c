@@ -690,7 +690,7 @@ done:
 static inline struct amdxdna_gem_obj *
 aie2_cmdlist_get_cmd_buf(struct amdxdna_sched_job *job)
 {
-	int idx = get_job_idx(job->seq);
+	int idx = get_job_idx(job->hwctx, job->seq);
 
 	return job->hwctx->priv->cmd_buf[idx];
 }
@@ -868,7 +868,7 @@ int aie2_config_debug_bo(struct amdxdna_hwctx *hwctx, struct amdxdna_sched_job *
 	int ret;
 
 	req.config = (job->opcode == OP_REG_DEBUG_BO) ? REGISTER : UNREGISTER;
-	req.offset = abo->mem.dev_addr - hwctx->client->dev_heap->mem.dev_addr;
+	req.offset = abo->mem.dev_addr - xdna->dev_info->dev_mem_base;
 	req.size = abo->mem.size;
 
 	XDNA_DBG(xdna, "offset 0x%llx size 0x%llx config %d",
@@ -979,6 +979,25 @@ free_buf:
 	return ret;
 }
 
+static int aie2_get_dev_heap(struct amdxdna_client *client,
+			     struct amdxdna_drm_get_info *args)
+{
+	struct amdxdna_drm_query_dev_heap info;
+	int ret;
+
+	if (args->buffer_size < sizeof(info))
+		return -EINVAL;
+
+	ret = amdxdna_gem_query_dev_heap(client, &info);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(u64_to_user_ptr(args->buffer), &info, sizeof(info)))
+		return -EFAULT;
+
+	return 0;
+}
+
 static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args)
 {
 	struct amdxdna_dev *xdna = client->xdna;
@@ -1023,6 +1042,9 @@ static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_i
 	case DRM_AMDXDNA_QUERY_TELEMETRY:
 		ret = aie2_get_telemetry(client, args);
 		break;
+	case DRM_AMDXDNA_QUERY_DEV_HEAP:
+		ret = aie2_get_dev_heap(client, args);
+		break;
 	default:
 		XDNA_ERR(xdna, "Not supported request parameter %u", args->param);
 		ret = -EOPNOTSUPP;
@@ -172,13 +172,17 @@ struct hwctx_pdi {
 };
 #endif
 /*
- * Define the maximum number of pending commands in a hardware context.
- * Must be power of 2!
+ * Define the range of pending commands in a hardware context. The actual
+ * depth is chosen by user at context creation time and is always power of 2.
  */
-#define HWCTX_MAX_CMDS		4
-#define get_job_idx(seq) ((seq) & (HWCTX_MAX_CMDS - 1))
+#define HWCTX_MIN_CMDS		4
+#define HWCTX_DEF_CMDS		HWCTX_MIN_CMDS
+#define HWCTX_MAX_CMDS		256
+#define get_job_idx(hwctx, seq) ((seq) & ((hwctx)->max_cmds - 1))
 struct amdxdna_hwctx_priv {
-	struct amdxdna_gem_obj		*heap;
+	/* Dev heap segments pinned and mapped to firmware context */
+	struct amdxdna_gem_obj		*heaps[AMDXDNA_MAX_DEV_HEAPS];
+	u32				num_heaps;
 	void				*mbox_chann;
 #ifdef AMDXDNA_DEVEL
 	struct hwctx_pdi		*pdi_infos;
@@ -189,11 +193,13 @@ struct amdxdna_hwctx_priv {
 
 	struct mutex			io_lock; /* protect seq and cmd order */
 	struct wait_queue_head		job_free_wq;
-	struct amdxdna_sched_job	*pending[HWCTX_MAX_CMDS];
+	struct amdxdna_sched_job	**pending;
 	u32				num_pending;
 
-	struct amdxdna_gem_obj		*cmd_buf[HWCTX_MAX_CMDS];
+	struct amdxdna_gem_obj		**cmd_buf;
 	struct workqueue_struct		*submit_wq;
+	/* Signaled on each command completion, set once by user */
+	struct eventfd_ctx		*completion_efd;
 };
 
 struct async_events;
@@ -224,6 +230,11 @@ struct amdxdna_dev_hdl {
 	struct mailbox			*mbox;
 	struct mailbox_channel		*mgmt_chann;
 	struct async_events		*async_events;
+
+	/* Userptr BO ranges invalidated by MMU and faulted in again */
+	atomic64_t			hmm_invalidated_bytes;
+	atomic64_t			hmm_refaulted_bytes;
+	atomic64_t			hmm_refault_cnt;
 };
 
 #define DEFINE_BAR_OFFSET(reg_name, bar, reg_addr) \
@@ -357,7 +368,8 @@ int aie2_cmd_submit(struct amdxdna_hwctx *hwctx, struct amdxdna_sched_job *job,
 		    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq);
 int aie2_cmd_wait(struct amdxdna_hwctx *hwctx, u64 seq, u32 timeout);
 struct dma_fence *aie2_cmd_get_out_fence(struct amdxdna_hwctx *hwctx, u64 seq);
-void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo, unsigned long cur_seq);
+void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo,
+			 const struct mmu_notifier_range *range, unsigned long cur_seq);
 void aie2_stop_ctx(struct amdxdna_client *client);
 void aie2_restart_ctx(struct amdxdna_client *client);
 void aie2_stop_ctx_by_col_map(struct amdxdna_client *client, u32 col_map);
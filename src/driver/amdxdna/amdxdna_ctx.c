@@ -4,7 +4,9 @@
  */
 
 #include <linux/version.h>
+#include <linux/dma-fence-chain.h>
 #include <linux/kref.h>
+#include <linux/workqueue.h>
 #include <drm/drm_file.h>
 #include <drm/drm_cache.h>
 #include <drm/drm_syncobj.h>
@@ -16,6 +18,7 @@
 
 #define MAX_HWCTX_ID		255
 #define MAX_ARG_COUNT		4095
+#define MAX_CMD_COUNT		256
 
 struct amdxdna_fence {
 	struct dma_fence	base;
@@ -56,6 +59,186 @@ static struct dma_fence *amdxdna_fence_create(struct amdxdna_hwctx *hwctx)
 	return &fence->base;
 }
 
+/*
+ * Stand-in fence for a syncobj timeline point which has not been submitted
+ * yet. It lets a dependency job be pushed to the scheduler right away,
+ * instead of blocking the submitter until the producer has submitted the
+ * point. The point is polled for by a delayed work, with the poll interval
+ * doubling up to DEFERRED_DEP_MAX_DELAY. Once the point shows up, the fence
+ * follows the fence of the point. Pending ones are canceled with the hwctx.
+ */
+#define DEFERRED_DEP_MAX_DELAY	8 /* jiffies */
+
+struct amdxdna_deferred_dep {
+	struct dma_fence	base;
+	spinlock_t		lock; /* for base */
+	struct amdxdna_hwctx	*hwctx;
+	struct drm_syncobj	*syncobj;
+	u64			point;
+	struct dma_fence_cb	cb;
+	struct delayed_work	work;
+	unsigned long		delay;
+	/* On hwctx->deferred_deps until the point is found or canceled */
+	struct list_head	node;
+};
+
+static const char *amdxdna_deferred_dep_get_timeline_name(struct dma_fence *fence)
+{
+	return "deferred_dependency";
+}
+
+static const struct dma_fence_ops deferred_dep_ops = {
+	.get_driver_name = amdxdna_fence_get_driver_name,
+	.get_timeline_name = amdxdna_deferred_dep_get_timeline_name,
+};
+
+static void amdxdna_deferred_dep_cb(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+	struct amdxdna_deferred_dep *dep;
+
+	dep = container_of(cb, struct amdxdna_deferred_dep, cb);
+	if (fence->error)
+		dma_fence_set_error(&dep->base, fence->error);
+	dma_fence_signal(&dep->base);
+	dma_fence_put(fence);
+	dma_fence_put(&dep->base);
+}
+
+static void amdxdna_deferred_dep_work(struct work_struct *work)
+{
+	struct amdxdna_deferred_dep *dep;
+	struct amdxdna_hwctx *hwctx;
+	struct dma_fence *fence;
+	int ret = -EINVAL;
+
+	dep = container_of(to_delayed_work(work), struct amdxdna_deferred_dep, work);
+	hwctx = dep->hwctx;
+
+	/* Same lookup as drm_syncobj_find_fence() */
+	fence = drm_syncobj_fence_get(dep->syncobj);
+	if (fence) {
+		ret = dma_fence_chain_find_seqno(&fence, dep->point);
+		if (ret)
+			dma_fence_put(fence);
+		else if (!fence)
+			fence = dma_fence_get_stub();
+	}
+	if (ret) {
+		dep->delay = min(dep->delay * 2, DEFERRED_DEP_MAX_DELAY);
+		schedule_delayed_work(&dep->work, dep->delay);
+		return;
+	}
+
+	spin_lock(&hwctx->deferred_lock);
+	if (list_empty(&dep->node)) {
+		/* Taken by amdxdna_hwctx_cancel_deferred_deps() */
+		spin_unlock(&hwctx->deferred_lock);
+		dma_fence_put(fence);
+		return;
+	}
+	/* Off the list, hwctx may be destroyed any time. Don't touch it after. */
+	XDNA_DBG(hwctx->client->xdna, "%s deferred dependency %lld submitted",
+		 hwctx->name, dep->point);
+	list_del_init(&dep->node);
+	spin_unlock(&hwctx->deferred_lock);
+
+	drm_syncobj_put(dep->syncobj);
+	dep->syncobj = NULL;
+	/* The reference of the list goes to the callback */
+	if (dma_fence_add_callback(fence, &dep->cb, amdxdna_deferred_dep_cb))
+		amdxdna_deferred_dep_cb(fence, &dep->cb);
+}
+
+static struct dma_fence *
+amdxdna_deferred_dep_create(struct amdxdna_hwctx *hwctx, struct drm_syncobj *syncobj, u64 point)
+{
+	struct amdxdna_deferred_dep *dep;
+
+	dep = kzalloc(sizeof(*dep), GFP_KERNEL);
+	if (!dep)
+		return NULL;
+
+	dep->hwctx = hwctx;
+	dep->syncobj = syncobj;
+	dep->point = point;
+	dep->delay = 1;
+	spin_lock_init(&dep->lock);
+	dma_fence_init(&dep->base, &deferred_dep_ops, &dep->lock, dma_fence_context_alloc(1), 0);
+	INIT_DELAYED_WORK(&dep->work, amdxdna_deferred_dep_work);
+
+	/* One reference for the list, one for the caller */
+	dma_fence_get(&dep->base);
+	spin_lock(&hwctx->deferred_lock);
+	list_add_tail(&dep->node, &hwctx->deferred_deps);
+	spin_unlock(&hwctx->deferred_lock);
+	schedule_delayed_work(&dep->work, dep->delay);
+	return &dep->base;
+}
+
+/* Signal dependencies with error, if their points are never submitted */
+static void amdxdna_hwctx_cancel_deferred_deps(struct amdxdna_hwctx *hwctx)
+{
+	struct amdxdna_deferred_dep *dep;
+
+	for (;;) {
+		spin_lock(&hwctx->deferred_lock);
+		dep = list_first_entry_or_null(&hwctx->deferred_deps,
+					       struct amdxdna_deferred_dep, node);
+		if (dep)
+			list_del_init(&dep->node);
+		spin_unlock(&hwctx->deferred_lock);
+		if (!dep)
+			break;
+
+		cancel_delayed_work_sync(&dep->work);
+		XDNA_DBG(hwctx->client->xdna, "%s cancel deferred dependency %lld",
+			 hwctx->name, dep->point);
+		drm_syncobj_put(dep->syncobj);
+		dep->syncobj = NULL;
+		dma_fence_set_error(&dep->base, -ECANCELED);
+		dma_fence_signal(&dep->base);
+		dma_fence_put(&dep->base);
+	}
+}
+
+/*
+ * Points already signaled without error are dropped instead of becoming
+ * scheduler dependencies, a failed point still goes to the scheduler so
+ * that its error is not lost. Points not submitted yet are deferred if the
+ * job allows it.
+ */
+int amdxdna_job_add_syncobj_dependency(struct amdxdna_sched_job *job, u32 hdl, u64 pt)
+{
+	struct amdxdna_client *client = job->hwctx->client;
+	struct drm_syncobj *syncobj;
+	struct dma_fence *fence;
+	int ret;
+
+	ret = drm_syncobj_find_fence(client->filp, hdl, pt, 0, &fence);
+	if (!ret) {
+		/* Nothing for the scheduler to wait on */
+		if (dma_fence_get_status(fence) == 1) {
+			dma_fence_put(fence);
+			return 0;
+		}
+		return drm_sched_job_add_dependency(&job->base, fence);
+	}
+	if (ret != -EINVAL || !job->deferred_deps)
+		return ret;
+
+	/* Point is not submitted yet */
+	syncobj = drm_syncobj_find(client->filp, hdl);
+	if (!syncobj)
+		return -ENOENT;
+
+	fence = amdxdna_deferred_dep_create(job->hwctx, syncobj, pt);
+	if (!fence) {
+		drm_syncobj_put(syncobj);
+		return -ENOMEM;
+	}
+	return drm_sched_job_add_dependency(&job->base, fence);
+}
+
 void amdxdna_hwctx_suspend(struct amdxdna_client *client)
 {
 	struct amdxdna_dev *xdna = client->xdna;
@@ -90,6 +273,7 @@ static void amdxdna_hwctx_destroy_rcu(struct amdxdna_hwctx *hwctx,
 	synchronize_srcu(ss);
 
 	/* At this point, user is not able to submit new commands */
+	amdxdna_hwctx_cancel_deferred_deps(hwctx);
 	mutex_lock(&xdna->dev_lock);
 	xdna->dev_info->ops->hwctx_fini(hwctx);
 	mutex_unlock(&xdna->dev_lock);
@@ -128,7 +312,7 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 	struct amdxdna_hwctx *hwctx;
 	int ret, idx;
 
-	if (args->ext_flags)
+	if (args->ext_flags & ~AMDXDNA_HWCTX_MAX_CMDS)
 		return -EINVAL;
 
 	if (!drm_dev_enter(dev, &idx))
@@ -154,6 +338,11 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 	hwctx->max_opc = args->max_opc;
 	hwctx->umq_bo = args->umq_bo;
 	hwctx->log_buf_bo = args->log_buf_bo;
+	/* Was tail padding, not zeroed by older user space */
+	if (args->ext_flags & AMDXDNA_HWCTX_MAX_CMDS)
+		hwctx->max_cmds = args->max_cmds;
+	spin_lock_init(&hwctx->deferred_lock);
+	INIT_LIST_HEAD(&hwctx->deferred_deps);
 	mutex_lock(&client->hwctx_lock);
 	ret = idr_alloc_cyclic(&client->hwctx_idr, hwctx, 0, MAX_HWCTX_ID, GFP_KERNEL);
 	if (ret < 0) {
@@ -179,6 +368,7 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 	}
 	args->handle = hwctx->id;
 	args->umq_doorbell = hwctx->doorbell_offset;
+	args->max_cmds = hwctx->max_cmds;
 	mutex_unlock(&xdna->dev_lock);
 
 	XDNA_DBG(xdna, "PID %d create HW context %d, ret %d", client->pid, args->handle, ret);
@@ -275,6 +465,7 @@ int amdxdna_drm_config_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 		break;
 	case DRM_AMDXDNA_HWCTX_ASSIGN_DBG_BUF:
 	case DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF:
+	case DRM_AMDXDNA_HWCTX_ASSIGN_EVENTFD:
 		/* For those types that param_val is a value */
 		buf = NULL;
 		buf_size = 0;
@@ -303,27 +494,26 @@ unlock_srcu:
 }
 
 static inline void
-amdxdna_arg_bos_put(struct amdxdna_sched_job *job)
+amdxdna_arg_bos_put(struct drm_gem_object **bos, u32 bo_cnt)
 {
 	int i;
 
-	for (i = 0; i < job->bo_cnt; i++) {
-		if (!job->bos[i])
+	for (i = 0; i < bo_cnt; i++) {
+		if (!bos[i])
 			break;
-		drm_gem_object_put(job->bos[i]);
+		drm_gem_object_put(bos[i]);
 	}
 }
 
 static inline int
 amdxdna_arg_bos_lookup(struct amdxdna_client *client,
-		       struct amdxdna_sched_job *job,
+		       struct drm_gem_object **bos,
 		       u32 *bo_hdls, u32 bo_cnt)
 {
 	struct drm_gem_object *gobj;
 	int i, ret;
 
-	job->bo_cnt = bo_cnt;
-	for (i = 0; i < job->bo_cnt; i++) {
+	for (i = 0; i < bo_cnt; i++) {
 		struct amdxdna_gem_obj *abo;
 
 		gobj = drm_gem_object_lookup(client->filp, bo_hdls[i]);
@@ -336,7 +526,7 @@ amdxdna_arg_bos_lookup(struct amdxdna_client *client,
 		mutex_lock(&abo->lock);
 		if (abo->flags & BO_SUBMIT_PINNED) {
 			mutex_unlock(&abo->lock);
-			job->bos[i] = gobj;
+			bos[i] = gobj;
 			continue;
 		}
 
@@ -349,16 +539,60 @@ amdxdna_arg_bos_lookup(struct amdxdna_client *client,
 		abo->flags |= BO_SUBMIT_PINNED;
 		mutex_unlock(&abo->lock);
 
-		job->bos[i] = gobj;
+		bos[i] = gobj;
 	}
 
 	return 0;
 
 put_arg_bos:
-	amdxdna_arg_bos_put(job);
+	amdxdna_arg_bos_put(bos, i);
 	return ret;
 }
 
+/*
+ * Command BO and argument BOs looked up and pinned once by
+ * DRM_IOCTL_AMDXDNA_CREATE_CMD_TMPL, then submitted many times with
+ * AMDXDNA_CMD_SUBMIT_TEMPLATE. Jobs of the template hold a reference of it
+ * instead of references of the BOs.
+ */
+struct amdxdna_cmd_tmpl {
+	struct kref		refcnt;
+	struct amdxdna_gem_obj	*cmd_bo;
+	u32			bo_cnt;
+	struct drm_gem_object	*bos[] __counted_by(bo_cnt);
+};
+
+static void amdxdna_cmd_tmpl_release(struct kref *ref)
+{
+	struct amdxdna_cmd_tmpl *tmpl;
+
+	tmpl = container_of(ref, struct amdxdna_cmd_tmpl, refcnt);
+
+	amdxdna_arg_bos_put(tmpl->bos, tmpl->bo_cnt);
+	amdxdna_gem_put_obj(tmpl->cmd_bo);
+	kfree(tmpl);
+}
+
+static void amdxdna_cmd_tmpl_put(struct amdxdna_cmd_tmpl *tmpl)
+{
+	kref_put(&tmpl->refcnt, amdxdna_cmd_tmpl_release);
+}
+
+static struct amdxdna_cmd_tmpl *
+amdxdna_cmd_tmpl_get(struct amdxdna_client *client, u32 hdl)
+{
+	struct amdxdna_cmd_tmpl *tmpl;
+
+	/* Destroy erases under the same lock, the last put can't race with get */
+	xa_lock(&client->cmd_tmpl_xa);
+	tmpl = xa_load(&client->cmd_tmpl_xa, hdl);
+	if (tmpl)
+		kref_get(&tmpl->refcnt);
+	xa_unlock(&client->cmd_tmpl_xa);
+
+	return tmpl;
+}
+
 static void amdxdna_sched_job_release(struct kref *ref)
 {
 	struct amdxdna_sched_job *job;
@@ -366,8 +600,12 @@ static void amdxdna_sched_job_release(struct kref *ref)
 	job = container_of(ref, struct amdxdna_sched_job, refcnt);
 
 	trace_amdxdna_debug_point(job->hwctx->name, job->seq, "job release");
-	amdxdna_arg_bos_put(job);
-	amdxdna_gem_put_obj(job->cmd_bo);
+	if (job->tmpl) {
+		amdxdna_cmd_tmpl_put(job->tmpl);
+	} else {
+		amdxdna_arg_bos_put(job->bos, job->bo_cnt);
+		amdxdna_gem_put_obj(job->cmd_bo);
+	}
 	kfree(job);
 }
 
@@ -447,41 +685,18 @@ void amdxdna_unlock_objects(struct amdxdna_sched_job *job, struct ww_acquire_ctx
 	ww_acquire_fini(ctx);
 }
 
-int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
-		       u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
-		       u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
-		       u32 hwctx_hdl, u64 *seq)
+/*
+ * Push a job, whose command BO and argument BOs are set already, to the hwctx.
+ * Caller still owns the BOs of the job if this fails.
+ */
+static int amdxdna_job_push(struct amdxdna_client *client, struct amdxdna_sched_job *job,
+			    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+			    u32 hwctx_hdl, u64 *seq)
 {
 	struct amdxdna_dev *xdna = client->xdna;
-	struct amdxdna_sched_job *job;
 	struct amdxdna_hwctx *hwctx;
 	int ret, idx;
 
-	XDNA_DBG(xdna, "Command BO hdl %d, Arg BO count %d", cmd_bo_hdl, arg_bo_cnt);
-	job = kzalloc(struct_size(job, bos, arg_bo_cnt), GFP_KERNEL);
-	if (!job)
-		return -ENOMEM;
-
-	if (cmd_bo_hdl != AMDXDNA_INVALID_BO_HANDLE) {
-		job->cmd_bo = amdxdna_gem_get_obj(client, cmd_bo_hdl, AMDXDNA_BO_CMD);
-		if (!job->cmd_bo) {
-			XDNA_ERR(xdna, "Failed to get cmd bo from %d", cmd_bo_hdl);
-			ret = -EINVAL;
-			goto free_job;
-		}
-	} else {
-		job->cmd_bo = NULL;
-		drm_WARN_ON(&xdna->ddev, opcode == OP_USER);
-	}
-
-	if (arg_bo_hdls) {
-		ret = amdxdna_arg_bos_lookup(client, job, arg_bo_hdls, arg_bo_cnt);
-		if (ret) {
-			XDNA_ERR(xdna, "Argument BOs lookup failed, ret %d", ret);
-			goto cmd_put;
-		}
-	}
-
 	idx = srcu_read_lock(&client->hwctx_srcu);
 	hwctx = idr_find(&client->hwctx_idr, hwctx_hdl);
 	if (!hwctx) {
@@ -499,7 +714,6 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 
 	job->hwctx = hwctx;
 	job->mm = current->mm;
-	job->opcode = opcode;
 
 	job->fence = amdxdna_fence_create(hwctx);
 	if (!job->fence) {
@@ -531,7 +745,55 @@ put_fence:
 	dma_fence_put(job->fence);
 unlock_srcu:
 	srcu_read_unlock(&client->hwctx_srcu, idx);
-	amdxdna_arg_bos_put(job);
+	return ret;
+}
+
+static int amdxdna_cmd_submit_job(struct amdxdna_client *client, u32 opcode,
+				  u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
+				  u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+				  bool deferred_deps, u32 hwctx_hdl, u64 *seq)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_sched_job *job;
+	int ret;
+
+	XDNA_DBG(xdna, "Command BO hdl %d, Arg BO count %d", cmd_bo_hdl, arg_bo_cnt);
+	job = kzalloc(struct_size(job, bos, arg_bo_cnt), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+
+	if (cmd_bo_hdl != AMDXDNA_INVALID_BO_HANDLE) {
+		job->cmd_bo = amdxdna_gem_get_obj(client, cmd_bo_hdl, AMDXDNA_BO_CMD);
+		if (!job->cmd_bo) {
+			XDNA_ERR(xdna, "Failed to get cmd bo from %d", cmd_bo_hdl);
+			ret = -EINVAL;
+			goto free_job;
+		}
+	} else {
+		job->cmd_bo = NULL;
+		drm_WARN_ON(&xdna->ddev, opcode == OP_USER);
+	}
+
+	if (arg_bo_hdls) {
+		job->bo_cnt = arg_bo_cnt;
+		ret = amdxdna_arg_bos_lookup(client, job->bos, arg_bo_hdls, arg_bo_cnt);
+		if (ret) {
+			XDNA_ERR(xdna, "Argument BOs lookup failed, ret %d", ret);
+			goto cmd_put;
+		}
+	}
+
+	job->opcode = opcode;
+	job->deferred_deps = deferred_deps;
+	ret = amdxdna_job_push(client, job, syncobj_hdls, syncobj_points, syncobj_cnt,
+			       hwctx_hdl, seq);
+	if (ret)
+		goto put_arg_bos;
+
+	return 0;
+
+put_arg_bos:
+	amdxdna_arg_bos_put(job->bos, job->bo_cnt);
 cmd_put:
 	amdxdna_gem_put_obj(job->cmd_bo);
 free_job:
@@ -539,6 +801,16 @@ free_job:
 	return ret;
 }
 
+int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
+		       u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
+		       u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+		       u32 hwctx_hdl, u64 *seq)
+{
+	return amdxdna_cmd_submit_job(client, opcode, cmd_bo_hdl, arg_bo_hdls, arg_bo_cnt,
+				      syncobj_hdls, syncobj_points, syncobj_cnt,
+				      false, hwctx_hdl, seq);
+}
+
 /*
  * The submit command ioctl submits a command to firmware. One firmware command
  * may contain multiple command BOs for processing as a whole.
@@ -557,7 +829,6 @@ static int amdxdna_drm_submit_execbuf(struct amdxdna_client *client,
 		return -EINVAL;
 	}
 
-	/* Only support single command for now. */
 	if (args->cmd_count != 1) {
 		XDNA_ERR(xdna, "Invalid cmd bo count %d", args->cmd_count);
 		return -EINVAL;
@@ -584,8 +855,146 @@ free_cmd_bo_hdls:
 	return ret;
 }
 
+/*
+ * Batched version of amdxdna_drm_submit_execbuf(). All command entries and
+ * their concatenated argument handles are copied in with one ioctl, then each
+ * command is pushed to the scheduler in order. Submission stops at the first
+ * failure; the commands pushed before it are not rolled back and their
+ * sequence numbers are still returned to user.
+ */
+static int amdxdna_drm_submit_execbuf_batch(struct amdxdna_client *client,
+					    struct amdxdna_drm_exec_cmd *args)
+{
+	struct amdxdna_drm_exec_cmd_entry *entries;
+	struct amdxdna_dev *xdna = client->xdna;
+	u32 *arg_bo_hdls;
+	u32 i, off = 0;
+	int ret;
+
+	if (args->cmd_count > MAX_CMD_COUNT) {
+		XDNA_ERR(xdna, "Invalid cmd bo count %d", args->cmd_count);
+		return -EINVAL;
+	}
+
+	if (!args->arg_count || args->arg_count > MAX_ARG_COUNT) {
+		XDNA_ERR(xdna, "Invalid arg bo count %d", args->arg_count);
+		return -EINVAL;
+	}
+
+	entries = kcalloc(args->cmd_count, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	if (copy_from_user(entries, u64_to_user_ptr(args->cmd_handles),
+			   args->cmd_count * sizeof(*entries))) {
+		ret = -EFAULT;
+		goto free_entries;
+	}
+
+	for (i = 0; i < args->cmd_count; i++) {
+		if (!entries[i].arg_count || entries[i].arg_count > args->arg_count - off) {
+			XDNA_ERR(xdna, "Invalid arg bo count %d for cmd %d",
+				 entries[i].arg_count, i);
+			ret = -EINVAL;
+			goto free_entries;
+		}
+		off += entries[i].arg_count;
+	}
+	if (off != args->arg_count) {
+		XDNA_ERR(xdna, "Total arg bo count %d mismatch %d", off, args->arg_count);
+		ret = -EINVAL;
+		goto free_entries;
+	}
+
+	arg_bo_hdls = kcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
+	if (!arg_bo_hdls) {
+		ret = -ENOMEM;
+		goto free_entries;
+	}
+
+	if (copy_from_user(arg_bo_hdls, u64_to_user_ptr(args->args),
+			   args->arg_count * sizeof(u32))) {
+		ret = -EFAULT;
+		goto free_arg_bo_hdls;
+	}
+
+	for (i = 0, off = 0; i < args->cmd_count; i++) {
+		ret = amdxdna_cmd_submit(client, OP_USER, entries[i].handle,
+					 &arg_bo_hdls[off], entries[i].arg_count,
+					 NULL, NULL, 0, args->hwctx, &entries[i].seq);
+		if (ret)
+			break;
+		off += entries[i].arg_count;
+		args->seq = entries[i].seq;
+	}
+
+	if (i && copy_to_user(u64_to_user_ptr(args->cmd_handles), entries,
+			      i * sizeof(*entries)))
+		ret = -EFAULT;
+	else if (i)
+		XDNA_DBG(xdna, "Pushed %d cmds to scheduler, last %lld", i, args->seq);
+
+free_arg_bo_hdls:
+	kfree(arg_bo_hdls);
+free_entries:
+	kfree(entries);
+	return ret;
+}
+
+/*
+ * Submit the command BO and argument BOs of a command template. Nothing is
+ * copied from user and no BO handle is looked up, the job takes a reference
+ * of the template instead.
+ */
+static int amdxdna_drm_submit_tmpl(struct amdxdna_client *client,
+				   struct amdxdna_drm_exec_cmd *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_sched_job *job;
+	struct amdxdna_cmd_tmpl *tmpl;
+	int ret;
+
+	if (args->cmd_count != 1 || args->arg_count) {
+		XDNA_ERR(xdna, "Invalid cmd count %d or arg count %d for template",
+			 args->cmd_count, args->arg_count);
+		return -EINVAL;
+	}
+
+	tmpl = amdxdna_cmd_tmpl_get(client, (u32)args->cmd_handles);
+	if (!tmpl) {
+		XDNA_ERR(xdna, "Failed to get cmd template %d", (u32)args->cmd_handles);
+		return -EINVAL;
+	}
+
+	job = kzalloc(struct_size(job, bos, tmpl->bo_cnt), GFP_KERNEL);
+	if (!job) {
+		ret = -ENOMEM;
+		goto put_tmpl;
+	}
+
+	job->tmpl = tmpl;
+	job->cmd_bo = tmpl->cmd_bo;
+	job->bo_cnt = tmpl->bo_cnt;
+	memcpy(job->bos, tmpl->bos, tmpl->bo_cnt * sizeof(*job->bos));
+	job->opcode = OP_USER;
+
+	ret = amdxdna_job_push(client, job, NULL, NULL, 0, args->hwctx, &args->seq);
+	if (ret)
+		goto free_job;
+
+	XDNA_DBG(xdna, "Pushed cmd %lld of template %d to scheduler",
+		 args->seq, (u32)args->cmd_handles);
+	return 0;
+
+free_job:
+	kfree(job);
+put_tmpl:
+	amdxdna_cmd_tmpl_put(tmpl);
+	return ret;
+}
+
 static int amdxdna_drm_submit_dependency(struct amdxdna_client *client,
-					 struct amdxdna_drm_exec_cmd *args)
+					 struct amdxdna_drm_exec_cmd *args, bool deferred)
 {
 	struct amdxdna_dev *xdna = client->xdna;
 	u32 *syncobj_hdls;
@@ -624,9 +1033,9 @@ static int amdxdna_drm_submit_dependency(struct amdxdna_client *client,
 		goto done;
 	}
 
-	ret = amdxdna_cmd_submit(client, OP_NOOP, AMDXDNA_INVALID_BO_HANDLE, NULL, 0,
-				 syncobj_hdls, syncobj_pts, syncobj_cnt,
-				 args->hwctx, &args->seq);
+	ret = amdxdna_cmd_submit_job(client, OP_NOOP, AMDXDNA_INVALID_BO_HANDLE, NULL, 0,
+				     syncobj_hdls, syncobj_pts, syncobj_cnt,
+				     deferred, args->hwctx, &args->seq);
 
 done:
 	kfree(argbuf);
@@ -715,17 +1124,127 @@ int amdxdna_drm_submit_cmd_ioctl(struct drm_device *dev, void *data, struct drm_
 
 	switch (args->type) {
 	case AMDXDNA_CMD_SUBMIT_EXEC_BUF:
+		if (args->cmd_count > 1)
+			return amdxdna_drm_submit_execbuf_batch(client, args);
 		return amdxdna_drm_submit_execbuf(client, args);
 	case AMDXDNA_CMD_SUBMIT_DEPENDENCY:
-		return amdxdna_drm_submit_dependency(client, args);
+		return amdxdna_drm_submit_dependency(client, args, false);
+	case AMDXDNA_CMD_SUBMIT_DEFERRED_DEPENDENCY:
+		return amdxdna_drm_submit_dependency(client, args, true);
 	case AMDXDNA_CMD_SUBMIT_SIGNAL:
 		return amdxdna_drm_submit_signal(client, args);
+	case AMDXDNA_CMD_SUBMIT_TEMPLATE:
+		return amdxdna_drm_submit_tmpl(client, args);
 	}
 
 	XDNA_ERR(client->xdna, "Invalid command type %d", args->type);
 	return -EINVAL;
 }
 
+int amdxdna_drm_create_cmd_tmpl_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_drm_create_cmd_tmpl *args = data;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_cmd_tmpl *tmpl;
+	u32 *arg_bo_hdls;
+	int ret;
+
+	if (args->ext || args->ext_flags || args->pad)
+		return -EINVAL;
+
+	if (!args->arg_count || args->arg_count > MAX_ARG_COUNT) {
+		XDNA_ERR(xdna, "Invalid arg bo count %d", args->arg_count);
+		return -EINVAL;
+	}
+
+	tmpl = kzalloc(struct_size(tmpl, bos, args->arg_count), GFP_KERNEL);
+	if (!tmpl)
+		return -ENOMEM;
+	tmpl->bo_cnt = args->arg_count;
+	kref_init(&tmpl->refcnt);
+
+	arg_bo_hdls = kcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
+	if (!arg_bo_hdls) {
+		ret = -ENOMEM;
+		goto free_tmpl;
+	}
+
+	if (copy_from_user(arg_bo_hdls, u64_to_user_ptr(args->args),
+			   args->arg_count * sizeof(u32))) {
+		ret = -EFAULT;
+		goto free_arg_bo_hdls;
+	}
+
+	tmpl->cmd_bo = amdxdna_gem_get_obj(client, args->cmd_handle, AMDXDNA_BO_CMD);
+	if (!tmpl->cmd_bo) {
+		XDNA_ERR(xdna, "Failed to get cmd bo from %d", args->cmd_handle);
+		ret = -EINVAL;
+		goto free_arg_bo_hdls;
+	}
+
+	ret = amdxdna_arg_bos_lookup(client, tmpl->bos, arg_bo_hdls, tmpl->bo_cnt);
+	if (ret) {
+		XDNA_ERR(xdna, "Argument BOs lookup failed, ret %d", ret);
+		goto put_cmd_bo;
+	}
+
+	ret = xa_alloc(&client->cmd_tmpl_xa, &args->handle, tmpl, xa_limit_32b, GFP_KERNEL);
+	if (ret) {
+		XDNA_ERR(xdna, "Allocate cmd template handle failed, ret %d", ret);
+		goto put_arg_bos;
+	}
+
+	kfree(arg_bo_hdls);
+	XDNA_DBG(xdna, "PID %d created cmd template %d with %d arg BOs",
+		 client->pid, args->handle, tmpl->bo_cnt);
+	return 0;
+
+put_arg_bos:
+	amdxdna_arg_bos_put(tmpl->bos, tmpl->bo_cnt);
+put_cmd_bo:
+	amdxdna_gem_put_obj(tmpl->cmd_bo);
+free_arg_bo_hdls:
+	kfree(arg_bo_hdls);
+free_tmpl:
+	kfree(tmpl);
+	return ret;
+}
+
+int amdxdna_drm_destroy_cmd_tmpl_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_drm_destroy_cmd_tmpl *args = data;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_cmd_tmpl *tmpl;
+
+	if (args->pad)
+		return -EINVAL;
+
+	tmpl = xa_erase(&client->cmd_tmpl_xa, args->handle);
+	if (!tmpl) {
+		XDNA_DBG(xdna, "PID %d cmd template %d not found", client->pid, args->handle);
+		return -EINVAL;
+	}
+
+	/* Submitted jobs may still hold the template */
+	amdxdna_cmd_tmpl_put(tmpl);
+	XDNA_DBG(xdna, "PID %d destroyed cmd template %d", client->pid, args->handle);
+	return 0;
+}
+
+void amdxdna_cmd_tmpl_remove_all(struct amdxdna_client *client)
+{
+	struct amdxdna_cmd_tmpl *tmpl;
+	unsigned long id;
+
+	xa_for_each(&client->cmd_tmpl_xa, id, tmpl) {
+		xa_erase(&client->cmd_tmpl_xa, id);
+		amdxdna_cmd_tmpl_put(tmpl);
+	}
+	xa_destroy(&client->cmd_tmpl_xa);
+}
+
 int amdxdna_cmd_wait(struct amdxdna_client *client, u32 hwctx_hdl,
 		     u64 seq, u32 timeout)
 {
@@ -770,3 +1289,110 @@ int amdxdna_drm_wait_cmd_ioctl(struct drm_device *dev, void *data, struct drm_fi
 
 	return ret;
 }
+
+static long amdxdna_wait_fences(struct dma_fence **fences, u32 count, bool wait_all,
+				long timeout, u32 *first)
+{
+	long ret = timeout;
+	u32 i;
+
+	if (!wait_all)
+		return dma_fence_wait_any_timeout(fences, count, true, timeout, first);
+
+	for (i = 0; i < count; i++) {
+		ret = dma_fence_wait_timeout(fences[i], true, ret);
+		if (ret <= 0)
+			return ret;
+	}
+	*first = 0;
+	return ret;
+}
+
+int amdxdna_drm_wait_cmds_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_drm_wait_cmds *args = data;
+	struct amdxdna_wait_cmd_entry *entries;
+	struct dma_fence **fences;
+	struct amdxdna_hwctx *hwctx;
+	long remaining;
+	u32 i, first = 0;
+	int ret, idx;
+
+	if (!xdna->dev_info->ops->cmd_get_out_fence)
+		return -EOPNOTSUPP;
+
+	if (!args->count || args->count > AMDXDNA_MAX_WAIT_CMDS ||
+	    args->flags & ~AMDXDNA_WAIT_CMDS_ALL) {
+		XDNA_DBG(xdna, "Invalid wait count %d flags 0x%x", args->count, args->flags);
+		return -EINVAL;
+	}
+
+	entries = kvmalloc_array(args->count, sizeof(*entries), GFP_KERNEL);
+	fences = kvcalloc(args->count, sizeof(*fences), GFP_KERNEL);
+	if (!entries || !fences) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	if (copy_from_user(entries, u64_to_user_ptr(args->entries),
+			   args->count * sizeof(*entries))) {
+		ret = -EFAULT;
+		goto free;
+	}
+
+	/* Fences are refcounted, hwctx can go away while waiting */
+	idx = srcu_read_lock(&client->hwctx_srcu);
+	for (i = 0; i < args->count; i++) {
+		hwctx = idr_find(&client->hwctx_idr, entries[i].hwctx);
+		if (!hwctx) {
+			XDNA_DBG(xdna, "PID %d failed to get hwctx %d",
+				 client->pid, entries[i].hwctx);
+			srcu_read_unlock(&client->hwctx_srcu, idx);
+			ret = -EINVAL;
+			goto put_fences;
+		}
+
+		fences[i] = xdna->dev_info->ops->cmd_get_out_fence(hwctx, entries[i].seq);
+		if (IS_ERR(fences[i])) {
+			ret = PTR_ERR(fences[i]);
+			fences[i] = NULL;
+			srcu_read_unlock(&client->hwctx_srcu, idx);
+			goto put_fences;
+		}
+		/* Job is retired already */
+		if (!fences[i])
+			fences[i] = dma_fence_get_stub();
+	}
+	srcu_read_unlock(&client->hwctx_srcu, idx);
+
+	remaining = args->timeout ? msecs_to_jiffies(args->timeout) : MAX_SCHEDULE_TIMEOUT;
+	remaining = amdxdna_wait_fences(fences, args->count,
+					args->flags & AMDXDNA_WAIT_CMDS_ALL, remaining, &first);
+	if (!remaining)
+		ret = -ETIME;
+	else if (remaining < 0)
+		ret = remaining;
+	else
+		ret = 0;
+
+	for (i = 0; i < args->count; i++)
+		entries[i].signaled = dma_fence_is_signaled(fences[i]);
+	args->first_signaled = first;
+
+	if (copy_to_user(u64_to_user_ptr(args->entries), entries,
+			 args->count * sizeof(*entries)))
+		ret = -EFAULT;
+
+	XDNA_DBG(xdna, "PID %d waited %d cmds, flags 0x%x, ret %d",
+		 client->pid, args->count, args->flags, ret);
+
+put_fences:
+	for (i = 0; i < args->count; i++)
+		dma_fence_put(fences[i]);
+free:
+	kvfree(fences);
+	kvfree(entries);
+	return ret;
+}
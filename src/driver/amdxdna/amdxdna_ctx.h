@@ -20,6 +20,7 @@
 #endif
 
 struct amdxdna_hwctx_priv;
+struct amdxdna_cmd_tmpl;
 
 enum ert_cmd_opcode {
 	ERT_START_CU		= 0,
@@ -106,6 +107,7 @@ struct amdxdna_hwctx {
 	u32				umq_bo;
 	u32				log_buf_bo;
 	u32				doorbell_offset;
+	u32				max_cmds;
 #define HWCTX_STAT_INIT  0
 #define HWCTX_STAT_READY 1
 #define HWCTX_STAT_STOP  2
@@ -120,6 +122,10 @@ struct amdxdna_hwctx {
 	u64				completed ____cacheline_aligned_in_smp;
 	/* For TDR worker to keep last completed. low frequency update */
 	u64				tdr_last_completed;
+
+	/* Dependencies on syncobj points not submitted yet, see amdxdna_ctx.c */
+	spinlock_t			deferred_lock;
+	struct list_head		deferred_deps;
 };
 
 #define drm_job_to_xdna_job(j) \
@@ -141,6 +147,10 @@ struct amdxdna_sched_job {
 #define OP_UNREG_DEBUG_BO	3
 #define OP_NOOP			4
 	u32			opcode;
+	/* Syncobj points not submitted yet are waited on by the scheduler */
+	bool			deferred_deps;
+	/* Command and argument BOs are held by the template, if not NULL */
+	struct amdxdna_cmd_tmpl	*tmpl;
 	struct amdxdna_gem_obj	*cmd_bo;
 	size_t			bo_cnt;
 	struct drm_gem_object	*bos[] __counted_by(bo_cnt);
@@ -225,6 +235,8 @@ static inline u32 amdxdna_hwctx_col_map(struct amdxdna_hwctx *hwctx)
 
 void amdxdna_job_put(struct amdxdna_sched_job *job);
 
+void amdxdna_cmd_tmpl_remove_all(struct amdxdna_client *client);
+
 void amdxdna_hwctx_remove_all(struct amdxdna_client *client);
 void amdxdna_hwctx_suspend(struct amdxdna_client *client);
 void amdxdna_hwctx_resume(struct amdxdna_client *client);
@@ -236,6 +248,8 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 		       u32 *sync_obj_hdls, u64 *sync_obj_pts, u32 sync_obj_cnt,
 		       u32 hwctx_hdl, u64 *seq);
 
+int amdxdna_job_add_syncobj_dependency(struct amdxdna_sched_job *job, u32 hdl, u64 pt);
+
 int amdxdna_cmd_wait(struct amdxdna_client *client, u32 hwctx_hdl,
 		     u64 seq, u32 timeout);
 
@@ -244,6 +258,9 @@ int amdxdna_drm_config_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 int amdxdna_drm_destroy_hwctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_submit_cmd_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_wait_cmd_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+int amdxdna_drm_wait_cmds_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+int amdxdna_drm_create_cmd_tmpl_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+int amdxdna_drm_destroy_cmd_tmpl_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_create_hwctx_unsec_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 
 #endif /* _AMDXDNA_CTX_H_ */
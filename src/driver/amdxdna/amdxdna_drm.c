@@ -61,6 +61,7 @@ skip_sva_bind:
 	init_srcu_struct(&client->hwctx_srcu);
 	idr_init_base(&client->hwctx_idr, AMDXDNA_INVALID_CTX_HANDLE + 1);
 	mutex_init(&client->mm_lock);
+	xa_init_flags(&client->cmd_tmpl_xa, XA_FLAGS_ALLOC1);
 
 	mutex_lock(&xdna->dev_lock);
 	list_add_tail(&client->node, &xdna->client_list);
@@ -92,15 +93,17 @@ static void amdxdna_drm_close(struct drm_device *ddev, struct drm_file *filp)
 {
 	struct amdxdna_client *client = filp->driver_priv;
 	struct amdxdna_dev *xdna = to_xdna_dev(ddev);
+	u32 i;
 
 	XDNA_DBG(xdna, "Closing PID %d", client->pid);
 
+	amdxdna_cmd_tmpl_remove_all(client);
 	idr_destroy(&client->hwctx_idr);
 	cleanup_srcu_struct(&client->hwctx_srcu);
 	mutex_destroy(&client->hwctx_lock);
 	mutex_destroy(&client->mm_lock);
-	if (client->dev_heap)
-		drm_gem_object_put(to_gobj(client->dev_heap));
+	for (i = 0; i < client->num_dev_heaps; i++)
+		drm_gem_object_put(to_gobj(client->dev_heaps[i]));
 
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode != AMDXDNA_IOMMU_PASID)
@@ -208,6 +211,9 @@ static const struct drm_ioctl_desc amdxdna_drm_ioctls[] = {
 	/* Exectuion */
 	DRM_IOCTL_DEF_DRV(AMDXDNA_EXEC_CMD, amdxdna_drm_submit_cmd_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_WAIT_CMD, amdxdna_drm_wait_cmd_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_WAIT_CMDS, amdxdna_drm_wait_cmds_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_CREATE_CMD_TMPL, amdxdna_drm_create_cmd_tmpl_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_DESTROY_CMD_TMPL, amdxdna_drm_destroy_cmd_tmpl_ioctl, 0),
 	/* AIE hardware */
 	DRM_IOCTL_DEF_DRV(AMDXDNA_GET_INFO, amdxdna_drm_get_info_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_SET_STATE, amdxdna_drm_set_state_ioctl, DRM_ROOT_ONLY),
@@ -12,6 +12,7 @@
 #include <drm/drm_file.h>
 #include <linux/hmm.h>
 #include <linux/timekeeping.h>
+#include <linux/xarray.h>
 
 #include "amdxdna_ctx.h"
 #ifdef AMDXDNA_SHMEM
@@ -57,7 +58,8 @@ struct amdxdna_dev_ops {
 	int (*hwctx_init)(struct amdxdna_hwctx *hwctx);
 	void (*hwctx_fini)(struct amdxdna_hwctx *hwctx);
 	int (*hwctx_config)(struct amdxdna_hwctx *hwctx, u32 type, u64 value, void *buf, u32 size);
-	void (*hmm_invalidate)(struct amdxdna_gem_obj *abo, unsigned long cur_seq);
+	void (*hmm_invalidate)(struct amdxdna_gem_obj *abo,
+			       const struct mmu_notifier_range *range, unsigned long cur_seq);
 	void (*hwctx_suspend)(struct amdxdna_hwctx *hwctx);
 	void (*hwctx_resume)(struct amdxdna_hwctx *hwctx);
 	int (*cmd_submit)(struct amdxdna_hwctx *hwctx, struct amdxdna_sched_job *job,
@@ -143,9 +145,12 @@ struct amdxdna_stats {
  * @xdna: XDNA device pointer
  * @filp: DRM file pointer
  * @mm_lock: lock for client wide memory related
- * @dev_heap: Shared device heap memory
+ * @dev_heaps: Device heap segments, shared by all HW contexts of the client
+ * @num_dev_heaps: Number of device heap segments
+ * @num_mapped_dev_heaps: Number of leading device heap segments mmap'ed by user
  * @sva: iommu SVA handle
  * @pasid: PASID
+ * @cmd_tmpl_xa: Command templates of the client
  * @stats: record npu usage stats
  */
 struct amdxdna_client {
@@ -160,11 +165,15 @@ struct amdxdna_client {
 	struct drm_file			*filp;
 
 	struct mutex			mm_lock; /* protect memory related */
-	struct amdxdna_gem_obj		*dev_heap;
+	struct amdxdna_gem_obj		*dev_heaps[AMDXDNA_MAX_DEV_HEAPS];
+	u32				num_dev_heaps;
+	u32				num_mapped_dev_heaps;
 
 	struct iommu_sva		*sva;
 	int				pasid;
 
+	struct xarray			cmd_tmpl_xa;
+
 	struct amdxdna_stats		stats;
 };
 
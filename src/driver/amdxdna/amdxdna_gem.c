@@ -9,6 +9,7 @@
 #include <linux/iosys-map.h>
 #include <linux/pagemap.h>
 #include <linux/pfn.h>
+#include <linux/sizes.h>
 #include <linux/vmalloc.h>
 #include <drm/drm_cache.h>
 
@@ -21,6 +22,13 @@
 
 #define XDNA_MAX_CMD_BO_SIZE	0x8000
 
+/*
+ * Small dev BOs are packed from the low end of the heap and large ones from
+ * the high end, so that long lived small BOs do not end up between large BOs
+ * and split the space they leave behind once freed.
+ */
+#define XDNA_DEV_HEAP_SMALL_BO_SIZE	SZ_256K
+
 MODULE_IMPORT_NS(DMA_BUF);
 
 static int
@@ -29,16 +37,22 @@ amdxdna_gem_insert_node_locked(struct amdxdna_gem_obj *abo, bool use_vmap)
 	struct amdxdna_client *client = abo->client;
 	struct amdxdna_dev *xdna = client->xdna;
 	struct amdxdna_mem *mem = &abo->mem;
+	enum drm_mm_insert_mode mode;
 	u64 offset;
 	u32 align;
 	int ret;
 
 	align = 1 << max(PAGE_SHIFT, xdna->dev_info->dev_mem_buf_shift);
+	mode = mem->size < XDNA_DEV_HEAP_SMALL_BO_SIZE ? DRM_MM_INSERT_LOW : DRM_MM_INSERT_HIGH;
 	ret = drm_mm_insert_node_generic(&abo->dev_heap->mm, &abo->mm_node,
-					 mem->size, align,
-					 0, DRM_MM_INSERT_BEST);
+					 mem->size, align, 0, mode);
 	if (ret) {
-		XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
+		/* Caller moves on to the next heap segment */
+		if (ret == -ENOSPC)
+			XDNA_DBG(xdna, "No space in dev heap segment 0x%llx",
+				 abo->dev_heap->mem.dev_addr);
+		else
+			XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
 		return ret;
 	}
 
@@ -74,7 +88,7 @@ static bool amdxdna_hmm_invalidate(struct mmu_interval_notifier *mni,
 	if (!mmu_notifier_range_blockable(range))
 		return false;
 
-	xdna->dev_info->ops->hmm_invalidate(abo, cur_seq);
+	xdna->dev_info->ops->hmm_invalidate(abo, range, cur_seq);
 
 	if (range->event == MMU_NOTIFY_UNMAP)
 		schedule_work(&abo->hmm_unreg_work);
@@ -103,6 +117,8 @@ static void amdxdna_hmm_unregister(struct amdxdna_gem_obj *abo)
 	mmu_interval_notifier_remove(&abo->mem.notifier);
 	kvfree(abo->mem.pfns);
 	abo->mem.pfns = NULL;
+	bitmap_free(abo->mem.invalid_chunks);
+	abo->mem.invalid_chunks = NULL;
 
 	if (is_import_bo(abo) && vma->vm_file && vma->vm_file->f_mapping)
 		mapping_clear_unevictable(vma->vm_file->f_mapping);
@@ -136,6 +152,13 @@ static int amdxdna_hmm_register(struct amdxdna_gem_obj *abo,
 		goto out_unlock;
 	}
 
+	abo->mem.nr_chunks = DIV_ROUND_UP(len, AMDXDNA_HMM_CHUNK_SIZE);
+	abo->mem.invalid_chunks = bitmap_zalloc(abo->mem.nr_chunks, GFP_KERNEL);
+	if (!abo->mem.invalid_chunks) {
+		ret = -ENOMEM;
+		goto free_pfns;
+	}
+
 	ret = mmu_interval_notifier_insert_locked(&abo->mem.notifier,
 						  current->mm,
 						  addr,
@@ -143,7 +166,7 @@ static int amdxdna_hmm_register(struct amdxdna_gem_obj *abo,
 						  &amdxdna_hmm_ops);
 	if (ret) {
 		XDNA_ERR(xdna, "Insert mmu notifier failed, ret %d", ret);
-		goto free_pfns;
+		goto free_chunks;
 	}
 	abo->mem.userptr = addr;
 	abo->mem.vma = vma;
@@ -154,6 +177,9 @@ static int amdxdna_hmm_register(struct amdxdna_gem_obj *abo,
 
 	return 0;
 
+free_chunks:
+	bitmap_free(abo->mem.invalid_chunks);
+	abo->mem.invalid_chunks = NULL;
 free_pfns:
 	kvfree(abo->mem.pfns);
 	abo->mem.pfns = NULL;
@@ -261,6 +287,20 @@ static int amdxdna_insert_pages(struct amdxdna_gem_obj *abo,
 	return 0;
 }
 
+/* BOs can be allocated from a dev heap segment once it is mmap'ed */
+static void amdxdna_gem_dev_heap_mapped(struct amdxdna_client *client)
+{
+	u32 i;
+
+	mutex_lock(&client->mm_lock);
+	i = client->num_mapped_dev_heaps;
+	while (i < client->num_dev_heaps &&
+	       client->dev_heaps[i]->mem.userptr != AMDXDNA_INVALID_ADDR)
+		i++;
+	WRITE_ONCE(client->num_mapped_dev_heaps, i);
+	mutex_unlock(&client->mm_lock);
+}
+
 static int amdxdna_gem_obj_mmap(struct drm_gem_object *gobj,
 				struct vm_area_struct *vma)
 {
@@ -281,6 +321,9 @@ static int amdxdna_gem_obj_mmap(struct drm_gem_object *gobj,
 		goto hmm_unreg;
 	}
 
+	if (abo->type == AMDXDNA_BO_DEV_HEAP)
+		amdxdna_gem_dev_heap_mapped(abo->client);
+
 	XDNA_DBG(xdna, "BO map_offset 0x%llx type %d userptr 0x%llx size 0x%lx",
 		 drm_vma_node_offset_addr(&gobj->vma_node), abo->type,
 		 abo->mem.userptr, gobj->size);
@@ -503,8 +546,9 @@ amdxdna_drm_create_dev_heap(struct drm_device *dev,
 	}
 
 	mutex_lock(&client->mm_lock);
-	if (client->dev_heap) {
-		XDNA_DBG(client->xdna, "dev heap is already created");
+	if (client->num_dev_heaps == AMDXDNA_MAX_DEV_HEAPS) {
+		XDNA_DBG(client->xdna, "All %d dev heap segments are created",
+			 AMDXDNA_MAX_DEV_HEAPS);
 		ret = -EBUSY;
 		goto mm_unlock;
 	}
@@ -520,7 +564,8 @@ amdxdna_drm_create_dev_heap(struct drm_device *dev,
 
 	abo->type = AMDXDNA_BO_DEV_HEAP;
 	abo->client = client;
-	abo->mem.dev_addr = client->xdna->dev_info->dev_mem_base;
+	abo->mem.dev_addr = client->xdna->dev_info->dev_mem_base +
+		client->num_dev_heaps * client->xdna->dev_info->dev_mem_size;
 	drm_mm_init(&abo->mm, abo->mem.dev_addr, abo->mem.size);
 
 #ifdef AMDXDNA_DEVEL
@@ -532,10 +577,13 @@ amdxdna_drm_create_dev_heap(struct drm_device *dev,
 		}
 	}
 #endif
-	client->dev_heap = abo;
+	client->dev_heaps[client->num_dev_heaps++] = abo;
 	drm_gem_object_get(to_gobj(abo));
 	mutex_unlock(&client->mm_lock);
 
+	XDNA_DBG(xdna, "Created dev heap segment %d, xdna_addr 0x%llx",
+		 client->num_dev_heaps - 1, abo->mem.dev_addr);
+
 	return abo;
 
 mm_unlock:
@@ -553,43 +601,47 @@ amdxdna_drm_alloc_dev_bo(struct drm_device *dev,
 	size_t aligned_sz = PAGE_ALIGN(args->size);
 	struct amdxdna_gem_obj *abo, *heap;
 	int ret;
+	u32 i;
+
+	abo = amdxdna_gem_create_obj(&xdna->ddev, aligned_sz);
+	if (IS_ERR(abo))
+		return abo;
+	to_gobj(abo)->funcs = &amdxdna_gem_dev_obj_funcs;
+	abo->type = AMDXDNA_BO_DEV;
+	abo->client = client;
 
+	/* Segments are tried in creation order, user grows the heap on ENOSPC */
+	ret = -EINVAL;
 	mutex_lock(&client->mm_lock);
-	heap = client->dev_heap;
-	if (!heap) {
-		ret = -EINVAL;
-		goto mm_unlock;
-	}
+	for (i = 0; i < client->num_dev_heaps; i++) {
+		heap = client->dev_heaps[i];
+		if (heap->mem.userptr == AMDXDNA_INVALID_ADDR) {
+			XDNA_DBG(xdna, "Dev heap segment %d is not mapped", i);
+			continue;
+		}
 
-	if (heap->mem.userptr == AMDXDNA_INVALID_ADDR) {
-		XDNA_ERR(xdna, "Invalid dev heap userptr");
-		ret = -EINVAL;
-		goto mm_unlock;
-	}
+		if (args->size > heap->mem.size) {
+			XDNA_ERR(xdna, "Invalid dev bo size 0x%llx, limit 0x%lx",
+				 args->size, heap->mem.size);
+			ret = -EINVAL;
+			goto mm_unlock;
+		}
 
-	if (args->size > heap->mem.size) {
-		XDNA_ERR(xdna, "Invalid dev bo size 0x%llx, limit 0x%lx",
-			 args->size, heap->mem.size);
-		ret = -EINVAL;
-		goto mm_unlock;
-	}
+		/* Kernel mapped BO needs the pages, caller pinned the segments it uses */
+		if (use_vmap && !heap->base.pages)
+			continue;
 
-	abo = amdxdna_gem_create_obj(&xdna->ddev, aligned_sz);
-	if (IS_ERR(abo)) {
-		ret = PTR_ERR(abo);
-		goto mm_unlock;
+		abo->dev_heap = heap;
+		ret = amdxdna_gem_insert_node_locked(abo, use_vmap);
+		if (ret != -ENOSPC)
+			break;
 	}
-	to_gobj(abo)->funcs = &amdxdna_gem_dev_obj_funcs;
-	abo->type = AMDXDNA_BO_DEV;
-	abo->client = client;
-	abo->dev_heap = heap;
-	ret = amdxdna_gem_insert_node_locked(abo, use_vmap);
 	if (ret) {
-		XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
+		XDNA_DBG(xdna, "Failed to alloc dev bo memory, ret %d", ret);
 		goto mm_unlock;
 	}
 
-	drm_gem_object_get(to_gobj(heap));
+	drm_gem_object_get(to_gobj(abo->dev_heap));
 	drm_gem_private_object_init(&xdna->ddev, to_gobj(abo), aligned_sz);
 
 	mutex_unlock(&client->mm_lock);
@@ -597,9 +649,51 @@ amdxdna_drm_alloc_dev_bo(struct drm_device *dev,
 
 mm_unlock:
 	mutex_unlock(&client->mm_lock);
+	mutex_destroy(&abo->lock);
+	kfree(abo);
 	return ERR_PTR(ret);
 }
 
+int amdxdna_gem_query_dev_heap(struct amdxdna_client *client,
+				struct amdxdna_drm_query_dev_heap *info)
+{
+	u64 hole_start, hole_end, hole_size;
+	struct amdxdna_gem_obj *heap;
+	struct drm_mm_node *node;
+	u32 i;
+
+	memset(info, 0, sizeof(*info));
+
+	mutex_lock(&client->mm_lock);
+	for (i = 0; i < client->num_dev_heaps; i++) {
+		heap = client->dev_heaps[i];
+		info->size += heap->mem.size;
+		drm_mm_for_each_hole(node, &heap->mm, hole_start, hole_end) {
+			hole_size = hole_end - hole_start;
+			info->free_bytes += hole_size;
+			info->largest_free = max(info->largest_free, hole_size);
+		}
+		drm_mm_for_each_node(node, &heap->mm)
+			info->node_count++;
+	}
+	info->num_segments = client->num_dev_heaps;
+	mutex_unlock(&client->mm_lock);
+	return 0;
+}
+
+struct amdxdna_gem_obj *amdxdna_gem_get_dev_heap(struct amdxdna_client *client, u32 idx)
+{
+	struct amdxdna_gem_obj *heap = NULL;
+
+	mutex_lock(&client->mm_lock);
+	if (idx < client->num_dev_heaps) {
+		heap = client->dev_heaps[idx];
+		drm_gem_object_get(to_gobj(heap));
+	}
+	mutex_unlock(&client->mm_lock);
+	return heap;
+}
+
 static struct amdxdna_gem_obj *
 amdxdna_drm_create_cmd_bo(struct drm_device *dev,
 			  struct amdxdna_drm_create_bo *args,
@@ -10,6 +10,13 @@
 #include <drm/drm_gem.h>
 #include <drm/drm_gem_shmem_helper.h>
 
+/*
+ * MMU invalidation of a userptr range is tracked in chunks, only invalidated
+ * chunks are faulted in again before the next submission.
+ */
+#define AMDXDNA_HMM_CHUNK_SHIFT		21
+#define AMDXDNA_HMM_CHUNK_SIZE		BIT(AMDXDNA_HMM_CHUNK_SHIFT)
+
 struct amdxdna_mem {
 	u64				userptr;
 	void				*kva;
@@ -20,6 +27,9 @@ struct amdxdna_mem {
 	u32				nr_pages;
 	struct mmu_interval_notifier	notifier;
 	unsigned long			*pfns;
+	/* Bitmap of invalidated chunks, protected by resv lock */
+	unsigned long			*invalid_chunks;
+	u32				nr_chunks;
 	bool				map_invalid;
 #ifdef AMDXDNA_DEVEL
 	struct sg_table			*sgt;
@@ -27,6 +37,12 @@ struct amdxdna_mem {
 #endif
 };
 
+/*
+ * Device heap grows in segments of dev_mem_size. Segment i covers device
+ * address dev_mem_base + i * dev_mem_size.
+ */
+#define AMDXDNA_MAX_DEV_HEAPS	4
+
 #define BO_SUBMIT_PINNED	BIT(0)
 #define BO_SUBMIT_LOCKED	BIT(1)
 struct amdxdna_gem_obj {
@@ -69,6 +85,10 @@ amdxdna_drm_alloc_dev_bo(struct drm_device *dev,
 			 struct amdxdna_drm_create_bo *args,
 			 struct drm_file *filp, bool use_vmap);
 
+struct amdxdna_gem_obj *amdxdna_gem_get_dev_heap(struct amdxdna_client *client, u32 idx);
+int amdxdna_gem_query_dev_heap(struct amdxdna_client *client,
+				struct amdxdna_drm_query_dev_heap *info);
+
 int amdxdna_gem_pin_nolock(struct amdxdna_gem_obj *abo);
 int amdxdna_gem_pin(struct amdxdna_gem_obj *abo);
 void amdxdna_gem_unpin(struct amdxdna_gem_obj *abo);
@@ -70,6 +70,56 @@ TRACE_EVENT(xdna_job,
 		      __entry->op)
 );
 
+DECLARE_EVENT_CLASS(xdna_hmm_range,
+		    TP_PROTO(u64 userptr, u64 offset, u64 size),
+
+		    TP_ARGS(userptr, offset, size),
+
+		    TP_STRUCT__entry(__field(u64, userptr)
+				     __field(u64, offset)
+				     __field(u64, size)),
+
+		    TP_fast_assign(__entry->userptr = userptr;
+				   __entry->offset = offset;
+				   __entry->size = size;),
+
+		    TP_printk("userptr 0x%llx offset 0x%llx size 0x%llx",
+			      __entry->userptr, __entry->offset, __entry->size)
+);
+
+DEFINE_EVENT(xdna_hmm_range, xdna_hmm_invalidate,
+	     TP_PROTO(u64 userptr, u64 offset, u64 size),
+	     TP_ARGS(userptr, offset, size)
+);
+
+DEFINE_EVENT(xdna_hmm_range, xdna_hmm_populate,
+	     TP_PROTO(u64 userptr, u64 offset, u64 size),
+	     TP_ARGS(userptr, offset, size)
+);
+
+TRACE_EVENT(xdna_hmm_refault,
+	    TP_PROTO(const char *name, u64 seq, u64 bytes),
+
+	    TP_ARGS(name, seq, bytes),
+
+	    TP_STRUCT__entry(__string(name, name)
+			     __field(u64, seq)
+			     __field(u64, bytes)),
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0)
+	    TP_fast_assign(__assign_str(name, name);
+			   __entry->seq = seq;
+			   __entry->bytes = bytes;),
+#else
+	    TP_fast_assign(__assign_str(name);
+			   __entry->seq = seq;
+			   __entry->bytes = bytes;),
+#endif
+
+	    TP_printk("%s seq#:%lld refaulted %lld bytes", __get_str(name),
+		      __entry->seq, __entry->bytes)
+);
+
 DECLARE_EVENT_CLASS(xdna_mbox_msg,
 		    TP_PROTO(char *name, u8 chann_id, u32 opcode, u32 msg_id),
 
@@ -48,6 +48,9 @@ enum amdxdna_drm_ioctl_id {
 	DRM_AMDXDNA_WAIT_CMD,
 	DRM_AMDXDNA_GET_INFO,
 	DRM_AMDXDNA_SET_STATE,
+	DRM_AMDXDNA_WAIT_CMDS,
+	DRM_AMDXDNA_CREATE_CMD_TMPL,
+	DRM_AMDXDNA_DESTROY_CMD_TMPL,
 	DRM_AMDXDNA_NUM_IOCTLS
 };
 
@@ -80,7 +83,7 @@ struct amdxdna_qos_info {
 /**
  * struct amdxdna_drm_create_hwctx - Create hardware context.
  * @ext: MBZ.
- * @ext_flags: MBZ.
+ * @ext_flags: AMDXDNA_HWCTX_MAX_CMDS if @max_cmds is set by user, other bits MBZ.
  * @qos_p: Address of QoS info.
  * @umq_bo: BO handle for user mode queue(UMQ).
  * @log_buf_bo: BO handle for log buffer.
@@ -89,7 +92,12 @@ struct amdxdna_qos_info {
  * @mem_size: Size of AIE tile memory.
  * @umq_doorbell: Returned offset of doorbell associated with UMQ.
  * @handle: Returned hardware context handle.
+ * @max_cmds: Depth of the in-flight command window of this context, only read
+ *            with AMDXDNA_HWCTX_MAX_CMDS, which older driver rejects. 0 means
+ *            driver default. Driver may round it up. Returns the chosen depth.
  */
+#define AMDXDNA_HWCTX_MAX_CMDS		(1ULL << 0)
+
 struct amdxdna_drm_create_hwctx {
 	__u64 ext;
 	__u64 ext_flags;
@@ -101,6 +109,7 @@ struct amdxdna_drm_create_hwctx {
 	__u32 mem_size;
 	__u32 umq_doorbell;
 	__u32 handle;
+	__u32 max_cmds;
 };
 
 /**
@@ -137,10 +146,17 @@ struct amdxdna_hwctx_param_config_cu {
 	struct amdxdna_cu_config cu_configs[] __counted_by(num_cus);
 };
 
+/*
+ * DRM_AMDXDNA_HWCTX_ASSIGN_EVENTFD: param_val is an eventfd file descriptor.
+ * Driver adds 1 to the eventfd counter each time a command of the hardware
+ * context completes, so that completion can be polled together with other
+ * fds. Can only be assigned once per hardware context.
+ */
 enum amdxdna_drm_config_hwctx_param {
 	DRM_AMDXDNA_HWCTX_CONFIG_CU,
 	DRM_AMDXDNA_HWCTX_ASSIGN_DBG_BUF,
 	DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF,
+	DRM_AMDXDNA_HWCTX_ASSIGN_EVENTFD,
 	DRM_AMDXDNA_HWCTX_CONFIG_NUM
 };
 
@@ -232,10 +248,36 @@ struct amdxdna_drm_sync_bo {
 	__u64 size;
 };
 
+/*
+ * AMDXDNA_CMD_SUBMIT_DEFERRED_DEPENDENCY is the same as
+ * AMDXDNA_CMD_SUBMIT_DEPENDENCY, except that the syncobj points do not
+ * have to be submitted yet. The dependency is held in the driver until
+ * the points are submitted and signaled, so user does not need to wait
+ * for the points to be available before submission.
+ *
+ * AMDXDNA_CMD_SUBMIT_TEMPLATE submits the command BO and argument BOs of a
+ * command template, see struct amdxdna_drm_create_cmd_tmpl. @cmd_handles is
+ * the template handle, @cmd_count must be 1 and @arg_count must be 0.
+ */
 enum amdxdna_cmd_type {
 	AMDXDNA_CMD_SUBMIT_EXEC_BUF = 0,
 	AMDXDNA_CMD_SUBMIT_DEPENDENCY,
 	AMDXDNA_CMD_SUBMIT_SIGNAL,
+	AMDXDNA_CMD_SUBMIT_DEFERRED_DEPENDENCY,
+	AMDXDNA_CMD_SUBMIT_TEMPLATE,
+};
+
+/**
+ * struct amdxdna_drm_exec_cmd_entry - One command in a batched submission.
+ * @handle: Command buffer object handle.
+ * @arg_count: Number of argument handles of this command in the args array.
+ * @seq: Returned sequence number for this command. Left untouched if the
+ *       command was not submitted.
+ */
+struct amdxdna_drm_exec_cmd_entry {
+	__u32 handle;
+	__u32 arg_count;
+	__u64 seq;
 };
 
 /**
@@ -245,10 +287,15 @@ enum amdxdna_cmd_type {
  * @hwctx: Hardware context handle.
  * @type: One of command type in enum amdxdna_cmd_type.
  * @cmd_handles: Array of command handles or the command handle itself in case of just one.
- * @args: Array of arguments for all command handles.
+ *               For AMDXDNA_CMD_SUBMIT_EXEC_BUF with @cmd_count > 1, this is a user
+ *               pointer to an array of struct amdxdna_drm_exec_cmd_entry.
+ * @args: Array of arguments for all command handles. In case of more than one
+ *        command, the argument handles of all commands are concatenated in the
+ *        same order as the command entries.
  * @cmd_count: Number of command handles in the cmd_handles array.
  * @arg_count: Number of arguments in the args array.
- * @seq: Returned sequence number for this command.
+ * @seq: Returned sequence number for this command. In case of more than one
+ *       command, this is the sequence number of the last command.
  */
 struct amdxdna_drm_exec_cmd {
 	__u64 ext;
@@ -262,6 +309,44 @@ struct amdxdna_drm_exec_cmd {
 	__u64 seq;
 };
 
+/**
+ * struct amdxdna_drm_create_cmd_tmpl - Create a command template.
+ * @ext: MBZ.
+ * @ext_flags: MBZ.
+ * @args: User pointer to an array of argument BO handles.
+ * @cmd_handle: Command BO handle.
+ * @arg_count: Number of argument BO handles in the args array.
+ * @handle: Returned command template handle.
+ * @pad: MBZ.
+ *
+ * The driver looks up and pins the command BO and argument BOs once and
+ * keeps them until the template is destroyed. Submitting the template then
+ * skips the per submission handle look up. The command BO stays mapped to
+ * user, scalar arguments are changed by writing the command BO before each
+ * submission.
+ */
+struct amdxdna_drm_create_cmd_tmpl {
+	__u64 ext;
+	__u64 ext_flags;
+	__u64 args;
+	__u32 cmd_handle;
+	__u32 arg_count;
+	__u32 handle;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_drm_destroy_cmd_tmpl - Destroy a command template.
+ * @handle: Command template handle.
+ * @pad: MBZ.
+ *
+ * Commands already submitted with the template keep their BOs until done.
+ */
+struct amdxdna_drm_destroy_cmd_tmpl {
+	__u32 handle;
+	__u32 pad;
+};
+
 /**
  * struct amdxdna_drm_wait_cmd - Wait exectuion command.
  *
@@ -277,6 +362,43 @@ struct amdxdna_drm_wait_cmd {
 	__u64 seq;
 };
 
+/**
+ * struct amdxdna_wait_cmd_entry - One command to wait in DRM_IOCTL_AMDXDNA_WAIT_CMDS.
+ *
+ * @hwctx: hardware context handle.
+ * @signaled: set to 1 if the command is completed when the ioctl returns.
+ * @seq: sequence number of the command returned by execute command.
+ */
+struct amdxdna_wait_cmd_entry {
+	__u32 hwctx;
+	__u32 signaled; /* out */
+	__u64 seq;
+};
+
+#define AMDXDNA_WAIT_CMDS_ALL	(1 << 0)
+#define AMDXDNA_MAX_WAIT_CMDS	1024
+
+/**
+ * struct amdxdna_drm_wait_cmds - Wait several commands with one ioctl.
+ *
+ * @entries: user pointer to an array of struct amdxdna_wait_cmd_entry.
+ * @count: number of entries, no more than AMDXDNA_MAX_WAIT_CMDS.
+ * @flags: AMDXDNA_WAIT_CMDS_ALL waits for all of the commands, otherwise
+ *         returns once any of them completes.
+ * @timeout: timeout in ms, 0 implies infinite wait.
+ * @first_signaled: index of the first entry found completed.
+ *
+ * The signaled field of every entry is updated, also when the wait times out
+ * with ETIME.
+ */
+struct amdxdna_drm_wait_cmds {
+	__u64 entries;
+	__u32 count;
+	__u32 flags;
+	__u32 timeout;
+	__u32 first_signaled; /* out */
+};
+
 /**
  * struct amdxdna_drm_query_aie_status - Query the status of the AIE hardware
  * @buffer: The user space buffer that will return the AIE status
@@ -483,6 +605,25 @@ struct amdxdna_drm_query_firmware_version {
 	__u32 build; /* out */
 };
 
+/**
+ * struct amdxdna_drm_query_dev_heap - Usage of the device memory heap of the caller
+ * @size: The heap size in bytes, summed over all segments. 0 if the heap is not
+ *        created yet.
+ * @free_bytes: The total free bytes in the heap.
+ * @largest_free: The largest contiguous free block in bytes. A device BO larger
+ *                than this can not be allocated, regardless of free_bytes.
+ * @node_count: The number of device BOs allocated from the heap.
+ * @num_segments: The number of heap segments. Another AMDXDNA_BO_DEV_HEAP BO
+ *                adds a segment, until the driver returns EBUSY.
+ */
+struct amdxdna_drm_query_dev_heap {
+	__u64 size; /* out */
+	__u64 free_bytes; /* out */
+	__u64 largest_free; /* out */
+	__u32 node_count; /* out */
+	__u32 num_segments; /* out */
+};
+
 enum amdxdna_drm_get_param {
 	DRM_AMDXDNA_QUERY_AIE_STATUS,
 	DRM_AMDXDNA_QUERY_AIE_METADATA,
@@ -495,6 +636,7 @@ enum amdxdna_drm_get_param {
 	DRM_AMDXDNA_QUERY_FIRMWARE_VERSION,
 	DRM_AMDXDNA_GET_POWER_MODE,
 	DRM_AMDXDNA_QUERY_TELEMETRY,
+	DRM_AMDXDNA_QUERY_DEV_HEAP,
 	DRM_AMDXDNA_NUM_GET_PARAM,
 };
 
@@ -579,6 +721,18 @@ struct amdxdna_drm_set_state {
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_SET_STATE, \
 		 struct amdxdna_drm_set_state)
 
+#define DRM_IOCTL_AMDXDNA_WAIT_CMDS \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_WAIT_CMDS, \
+		 struct amdxdna_drm_wait_cmds)
+
+#define DRM_IOCTL_AMDXDNA_CREATE_CMD_TMPL \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_CREATE_CMD_TMPL, \
+		 struct amdxdna_drm_create_cmd_tmpl)
+
+#define DRM_IOCTL_AMDXDNA_DESTROY_CMD_TMPL \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_DESTROY_CMD_TMPL, \
+		 struct amdxdna_drm_destroy_cmd_tmpl)
+
 #if defined(__cplusplus)
 } /* extern c end */
 #endif
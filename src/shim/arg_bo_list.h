@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _ARG_BO_LIST_XDNA_H_
+#define _ARG_BO_LIST_XDNA_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace shim_xdna {
+
+// Argument BO handles of a command BO, kept sorted by argument position.
+// Up to inline_args entries are stored in the object, only commands with
+// more arguments go to the heap. Arguments are mostly bound in increasing
+// position, which is an append. Not thread safe.
+class arg_bo_list
+{
+public:
+  static constexpr size_t inline_args = 64;
+
+  struct entry
+  {
+    size_t pos;
+    uint32_t handle;
+  };
+
+  void
+  clear()
+  {
+    m_size = 0;
+    m_spilled = false;
+    m_heap.clear();
+  }
+
+  // Set handle of the argument at pos, replacing what is bound there
+  void
+  set(size_t pos, uint32_t handle)
+  {
+    auto b = storage();
+    auto e = b + m_size;
+
+    if (m_size && (e - 1)->pos >= pos) {
+      auto it = std::lower_bound(b, e, pos,
+        [] (const entry& en, size_t p) { return en.pos < p; });
+      if (it->pos == pos) {
+        it->handle = handle;
+        return;
+      }
+      insert(it - b, { pos, handle });
+      return;
+    }
+    insert(m_size, { pos, handle });
+  }
+
+  size_t
+  size() const
+  {
+    return m_size;
+  }
+
+  const entry *
+  begin() const
+  {
+    return m_spilled ? m_heap.data() : m_inline.data();
+  }
+
+  const entry *
+  end() const
+  {
+    return begin() + m_size;
+  }
+
+private:
+  entry *
+  storage()
+  {
+    return m_spilled ? m_heap.data() : m_inline.data();
+  }
+
+  void
+  insert(size_t idx, const entry& en)
+  {
+    if (!m_spilled && m_size == inline_args) {
+      m_heap.assign(m_inline.begin(), m_inline.end());
+      m_spilled = true;
+    }
+
+    if (m_spilled) {
+      m_heap.insert(m_heap.begin() + idx, en);
+    } else {
+      std::copy_backward(m_inline.begin() + idx, m_inline.begin() + m_size,
+        m_inline.begin() + m_size + 1);
+      m_inline[idx] = en;
+    }
+    m_size++;
+  }
+
+  std::array<entry, inline_args> m_inline;
+  std::vector<entry> m_heap;
+  size_t m_size = 0;
+  bool m_spilled = false;
+};
+
+} // shim_xdna
+
+#endif // _ARG_BO_LIST_XDNA_H_
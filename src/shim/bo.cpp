@@ -24,6 +24,7 @@ free_drm_bo(const shim_xdna::pdev& dev, uint32_t boh)
 {
   drm_gem_close close_bo = {boh, 0};
   dev.ioctl(DRM_IOCTL_GEM_CLOSE, &close_bo);
+  dev.note_bo_close(boh);
 }
 
 void
@@ -127,7 +128,7 @@ namespace shim_xdna {
 
 bo::drm_bo::
 drm_bo(bo& parent, const amdxdna_drm_get_bo_info& bo_info)
-  : m_parent(parent)
+  : m_pdev(parent.m_pdev)
   , m_handle(bo_info.handle)
   , m_map_offset(bo_info.map_offset)
   , m_vaddr(bo_info.vaddr)
@@ -141,7 +142,7 @@ bo::drm_bo::
   if (m_handle == AMDXDNA_INVALID_BO_HANDLE)
     return;
   try {
-    free_drm_bo(m_parent.m_pdev, m_handle);
+    free_drm_bo(m_pdev, m_handle);
   } catch (const xrt_core::system_error& e) {
     shim_debug("Failed to free DRM BO: %s", e.what());
   }
@@ -319,6 +320,20 @@ get_cmd_id() const
   return m_cmd_id;
 }
 
+void
+bo::
+set_submit_time(std::chrono::steady_clock::time_point t)
+{
+  m_submit_time = t;
+}
+
+std::chrono::steady_clock::time_point
+bo::
+get_submit_time() const
+{
+  return m_submit_time;
+}
+
 uint32_t
 bo::
 get_drm_bo_handle() const
@@ -356,6 +371,7 @@ share() const
 {
   auto boh = get_drm_bo_handle();
   auto fd = export_drm_bo(m_pdev, boh);
+  m_exported = true;
   shim_debug("Exported bo %d to fd %d", boh, fd);
   return std::make_unique<shared>(fd);
 }
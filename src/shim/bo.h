@@ -16,6 +16,7 @@
 #include "drm_local/amdxdna_accel.h"
 #include <string>
 #include <atomic>
+#include <chrono>
 
 namespace shim_xdna {
 
@@ -55,6 +56,12 @@ public:
   // For cmd BO only
   uint64_t
   get_cmd_id() const;
+  // For cmd BO only, when it was last submitted
+  void
+  set_submit_time(std::chrono::steady_clock::time_point t);
+  // For cmd BO only
+  std::chrono::steady_clock::time_point
+  get_submit_time() const;
 
   uint32_t
   get_drm_bo_handle() const;
@@ -67,7 +74,7 @@ protected:
   // DRM BO managed by driver.
   class drm_bo {
   public:
-    bo& m_parent;
+    const pdev& m_pdev;
     uint32_t m_handle = AMDXDNA_INVALID_BO_HANDLE;
     off_t m_map_offset = AMDXDNA_INVALID_ADDR;
     uint64_t m_xdna_addr = AMDXDNA_INVALID_ADDR;
@@ -98,7 +105,7 @@ protected:
   void
   munmap_bo();
 
-  uint64_t
+  virtual uint64_t
   get_paddr() const;
 
   std::string
@@ -117,12 +124,17 @@ protected:
   size_t m_aligned_size = 0;
   uint64_t m_flags = 0;
   amdxdna_bo_type m_type = AMDXDNA_BO_INVALID;
-  std::unique_ptr<drm_bo> m_bo;
+  // Shared by sub-BOs carved out of this BO
+  std::shared_ptr<drm_bo> m_bo;
   const shared m_import;
 
   // Command ID in the queue after command submission.
   // Only valid for cmd BO.
   uint64_t m_cmd_id = -1;
+  std::chrono::steady_clock::time_point m_submit_time;
+
+  // Exported BO may still be in use by importer after it is freed here.
+  mutable bool m_exported = false;
 
   // Used when exclusively assigned to a HW context. By default, BO is shared
   // among all HW contexts.
@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _BO_POOL_XDNA_H_
+#define _BO_POOL_XDNA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace shim_xdna {
+
+struct bo_pool_stats
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t cached_bytes;
+  size_t cached_count;
+};
+
+// Cache of freed BOs, so that a new BO of the same flags and size class can
+// be handed out without going through BO creation and mmap again.
+// Entries are recycled most recently freed first and evicted least recently
+// freed first once the cache is over max_bytes. Entry is destroyed (the real
+// BO free) outside of the pool lock.
+template <typename Entry>
+class bo_pool
+{
+public:
+  explicit
+  bo_pool(size_t max_bytes)
+    : m_max_bytes(max_bytes)
+  {}
+
+  bool
+  enabled() const
+  {
+    return m_max_bytes != 0;
+  }
+
+  // Size classes are spaced a quarter of the power of two below them apart,
+  // so rounding up wastes less than 25% of a BO.
+  static size_t
+  size_class(size_t size)
+  {
+    if (size <= min_class)
+      return min_class;
+
+    size_t pow2 = size_t(1) << (63 - __builtin_clzl(size));
+    size_t step = std::max(pow2 / 4, min_class);
+    return (size + step - 1) & ~(step - 1);
+  }
+
+  // Size must be a size class
+  std::optional<Entry>
+  get(uint64_t flags, size_t size)
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+
+    auto it = m_free.find({flags, size});
+    if (it == m_free.end() || it->second.empty()) {
+      m_misses++;
+      return std::nullopt;
+    }
+
+    auto node = it->second.back();
+    it->second.pop_back();
+    std::optional<Entry> e(std::move(node->entry));
+    m_cached_bytes -= node->size;
+    m_lru.erase(node);
+    m_hits++;
+    return e;
+  }
+
+  // Returns false if entry is not taken, the caller should free it.
+  bool
+  put(uint64_t flags, size_t size, Entry&& e)
+  {
+    std::vector<Entry> evicted;
+
+    if (!enabled() || size > m_max_bytes)
+      return false;
+
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      evict_locked(m_max_bytes - size, evicted);
+      m_lru.push_front({flags, size, std::move(e)});
+      m_free[{flags, size}].push_back(m_lru.begin());
+      m_cached_bytes += size;
+    }
+    return true;
+  }
+
+  // Free cached BOs until no more than keep_bytes are cached.
+  // Used on memory pressure with keep_bytes set to zero.
+  void
+  trim(size_t keep_bytes = 0)
+  {
+    std::vector<Entry> evicted;
+
+    std::lock_guard<std::mutex> lg(m_lock);
+    evict_locked(keep_bytes, evicted);
+    // evicted is freed after the lock is dropped, declared before it
+  }
+
+  bo_pool_stats
+  stats() const
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    return { m_hits, m_misses, m_evictions, m_cached_bytes, m_lru.size() };
+  }
+
+private:
+  static constexpr size_t min_class = 4096;
+
+  using key = std::pair<uint64_t, size_t>; // flags, size class
+
+  struct item
+  {
+    uint64_t flags;
+    size_t size;
+    Entry entry;
+  };
+
+  void
+  evict_locked(size_t keep_bytes, std::vector<Entry>& evicted)
+  {
+    while (m_cached_bytes > keep_bytes) {
+      auto& oldest = m_lru.back();
+      auto& list = m_free[{oldest.flags, oldest.size}];
+      // The oldest entry of a key is always at the front of its list
+      list.erase(list.begin());
+      m_cached_bytes -= oldest.size;
+      evicted.push_back(std::move(oldest.entry));
+      m_lru.pop_back();
+      m_evictions++;
+    }
+  }
+
+  const size_t m_max_bytes;
+
+  mutable std::mutex m_lock;
+  // Most recently freed first
+  std::list<item> m_lru;
+  std::map<key, std::vector<typename std::list<item>::iterator>> m_free;
+  size_t m_cached_bytes = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+  uint64_t m_evictions = 0;
+};
+
+} // shim_xdna
+
+#endif // _BO_POOL_XDNA_H_
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _CACHE_FLUSH_XDNA_H_
+#define _CACHE_FLUSH_XDNA_H_
+
+#include <cpuid.h>
+#include <cstddef>
+#include <cstdint>
+#include <x86intrin.h>
+
+// CPU cache maintenance for buffers shared with the non-coherent device.
+
+namespace shim_xdna {
+
+enum class flush_insn {
+  clflush,    // strongly ordered, always available
+  clflushopt, // weakly ordered, needs trailing sfence
+  clwb,       // weakly ordered, writes back without evicting the line
+};
+
+namespace cache_detail {
+
+struct cpu_caps {
+  flush_insn flush;
+  flush_insn writeback;
+  size_t line_size;
+};
+
+inline cpu_caps
+probe_cpu()
+{
+  cpu_caps caps = { flush_insn::clflush, flush_insn::clflush, 64 };
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    // CLFLUSH line size is reported in 8-byte units
+    size_t sz = ((ebx >> 8) & 0xff) * 8;
+    if (sz)
+      caps.line_size = sz;
+  }
+
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    if (ebx & bit_CLFLUSHOPT)
+      caps.flush = caps.writeback = flush_insn::clflushopt;
+    if (ebx & bit_CLWB)
+      caps.writeback = flush_insn::clwb;
+  }
+  return caps;
+}
+
+inline const cpu_caps&
+get_cpu_caps()
+{
+  static const cpu_caps caps = probe_cpu();
+  return caps;
+}
+
+__attribute__((target("clflushopt"))) inline void
+clflushopt_lines(uintptr_t cur, uintptr_t last, size_t line)
+{
+  for (; cur <= last; cur += line)
+    _mm_clflushopt(reinterpret_cast<void *>(cur));
+  _mm_sfence();
+}
+
+__attribute__((target("clwb"))) inline void
+clwb_lines(uintptr_t cur, uintptr_t last, size_t line)
+{
+  for (; cur <= last; cur += line)
+    _mm_clwb(reinterpret_cast<void *>(cur));
+  _mm_sfence();
+}
+
+inline void
+clflush_lines(uintptr_t cur, uintptr_t last, size_t line)
+{
+  for (; cur <= last; cur += line)
+    _mm_clflush(reinterpret_cast<const void *>(cur));
+}
+
+} // cache_detail
+
+// Flush [addr, addr + len) with the given instruction. All flushes are
+// complete when this returns. At least one cache line is always flushed.
+inline void
+flush_range(flush_insn insn, const volatile void *addr, size_t len)
+{
+  auto line = cache_detail::get_cpu_caps().line_size;
+  auto start = reinterpret_cast<uintptr_t>(addr);
+  auto cur = start & ~(line - 1);
+  auto last = start + (len ? len - 1 : 0);
+
+  switch (insn) {
+  case flush_insn::clwb:
+    cache_detail::clwb_lines(cur, last, line);
+    break;
+  case flush_insn::clflushopt:
+    cache_detail::clflushopt_lines(cur, last, line);
+    break;
+  default:
+    cache_detail::clflush_lines(cur, last, line);
+    break;
+  }
+}
+
+// Write back and invalidate, use when device may have updated the memory.
+inline void
+flush_range(const volatile void *addr, size_t len)
+{
+  flush_range(cache_detail::get_cpu_caps().flush, addr, len);
+}
+
+// Write back only, enough when device is going to read the memory.
+inline void
+writeback_range(const volatile void *addr, size_t len)
+{
+  flush_range(cache_detail::get_cpu_caps().writeback, addr, len);
+}
+
+inline flush_insn
+get_flush_insn()
+{
+  return cache_detail::get_cpu_caps().flush;
+}
+
+inline flush_insn
+get_writeback_insn()
+{
+  return cache_detail::get_cpu_caps().writeback;
+}
+
+} // shim_xdna
+
+#endif // _CACHE_FLUSH_XDNA_H_
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _CMD_LATENCY_XDNA_H_
+#define _CMD_LATENCY_XDNA_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace shim_xdna {
+
+// Recent command latency, kept as an EWMA per key (CU index), used to
+// decide how long a waiter should spin on command state before falling
+// back to the blocking wait ioctl. Updates from racing waiters may be
+// lost, which only delays the average a little.
+class cmd_latency
+{
+public:
+  static constexpr size_t max_keys = 32;
+
+  void
+  update(uint32_t key, uint64_t ns)
+  {
+    auto& avg = m_avg[key % max_keys];
+    auto old = avg.load(std::memory_order_relaxed);
+    avg.store(old ? old - old / weight + ns / weight : ns, std::memory_order_relaxed);
+  }
+
+  // 0 if nothing is recorded for the key yet
+  uint64_t
+  expected(uint32_t key) const
+  {
+    return m_avg[key % max_keys].load(std::memory_order_relaxed);
+  }
+
+  // How long to spin for a command submitted elapsed_ns ago. Spin till a
+  // bit past the expected completion, unless that is more than max_ns away,
+  // in which case blocking right away is cheaper.
+  static uint64_t
+  spin_budget(uint64_t expected_ns, uint64_t elapsed_ns, uint64_t max_ns)
+  {
+    if (!expected_ns)
+      return 0;
+
+    auto deadline = expected_ns + expected_ns / 4;
+    if (elapsed_ns >= deadline)
+      return 0;
+    auto budget = deadline - elapsed_ns;
+    return budget > max_ns ? 0 : budget;
+  }
+
+private:
+  static constexpr uint64_t weight = 8;
+
+  std::array<std::atomic<uint64_t>, max_keys> m_avg = {};
+};
+
+} // shim_xdna
+
+#endif // _CMD_LATENCY_XDNA_H_
@@ -4,7 +4,12 @@
 #include "bo.h"
 #include "device.h"
 #include "hwctx.h"
+#include "hwq.h"
 #include "fence.h"
+#include "shim_query.h"
+#include "kmq/bo.h"
+#include "kmq/device.h"
+#include "kmq/hwq.h"
 
 #include "core/common/query_requests.h"
 
@@ -611,6 +616,173 @@ struct sequence_name
   }
 };
 
+inline shim_xdna::hw_q*
+get_hw_q(xrt_core::hwqueue_handle* hwq)
+{
+  auto q = dynamic_cast<shim_xdna::hw_q*>(hwq);
+  if (!q)
+    throw xrt_core::error("Invalid HW queue handle");
+  return q;
+}
+
+// Command ids of UMQ queues are slots, not driver seqs, so requests which
+// pass them to the driver only work on KMQ queues
+inline shim_xdna::hw_q_kmq*
+get_hw_q_kmq(xrt_core::hwqueue_handle* hwq)
+{
+  auto q = dynamic_cast<shim_xdna::hw_q_kmq*>(get_hw_q(hwq));
+  if (!q)
+    shim_err(EOPNOTSUPP, "Only supported on KMQ HW queue");
+  return q;
+}
+
+// Shim private requests working on a HW queue, see shim_query.h
+struct hw_queue_op
+{
+  static std::any
+  get(const xrt_core::device* /*device*/, key_type key)
+  {
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+
+  static std::any
+  get(const xrt_core::device* /*device*/, key_type key, const std::any& param)
+  {
+    if (key == shim_xdna::query::submit_commands::key) {
+      auto& args = std::any_cast<const shim_xdna::query::submit_commands::args&>(param);
+      shim_xdna::query::submit_commands::result_type res = {};
+      try {
+        get_hw_q(args.hwq)->submit_commands(args.cmds, res.seqs);
+      } catch (const xrt_core::system_error& ex) {
+        res.error = ex.get_code();
+        shim_debug("%s", ex.what());
+      }
+      return res;
+    }
+    if (key == shim_xdna::query::wait_commands::key) {
+      auto& args = std::any_cast<const shim_xdna::query::wait_commands::args&>(param);
+      using wait_mode = shim_xdna::hw_q_kmq::wait_mode;
+      auto mode = args.wait_all ? wait_mode::all : wait_mode::any;
+      shim_xdna::query::wait_commands::result_type done;
+      get_hw_q_kmq(args.hwq)->wait_commands(args.cmds, mode, args.timeout_ms, done);
+      return done;
+    }
+    if (key == shim_xdna::query::completion_fd::key) {
+      auto& args = std::any_cast<const shim_xdna::query::completion_fd::args&>(param);
+      return get_hw_q_kmq(args.hwq)->get_completion_fd();
+    }
+    if (key == shim_xdna::query::submit_template::key) {
+      auto& args = std::any_cast<const shim_xdna::query::submit_template::args&>(param);
+      shim_xdna::query::submit_template::result_type res;
+      res.seq = get_hw_q_kmq(args.hwq)->submit_template(args.cmd, res.created);
+      return res;
+    }
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+};
+
+// Shim private requests working on a KMQ BO, see shim_query.h
+struct bo_op
+{
+  static std::any
+  get(const xrt_core::device* /*device*/, key_type key)
+  {
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+
+  static std::any
+  get(const xrt_core::device* /*device*/, key_type key, const std::any& param)
+  {
+    using write_tracking = shim_xdna::bo_kmq::write_tracking;
+
+    if (key == shim_xdna::query::bo_write_tracking::key) {
+      auto& args = std::any_cast<const shim_xdna::query::bo_write_tracking::args&>(param);
+      auto bo = get_bo_kmq(key, args.bo);
+      if (args.mode > static_cast<uint32_t>(write_tracking::soft_dirty))
+        shim_err(EINVAL, "Invalid write tracking mode %u", args.mode);
+      bo->set_write_tracking(static_cast<write_tracking>(args.mode));
+      return static_cast<uint32_t>(bo->get_write_tracking());
+    }
+    if (key == shim_xdna::query::bo_mark_dirty::key) {
+      auto& args = std::any_cast<const shim_xdna::query::bo_mark_dirty::args&>(param);
+      auto bo = get_bo_kmq(key, args.bo);
+      if (args.len)
+        bo->mark_dirty(args.offset, args.len);
+      return bo->get_dirty_bytes();
+    }
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+
+private:
+  static shim_xdna::bo_kmq*
+  get_bo_kmq(key_type key, xrt_core::buffer_handle* bh)
+  {
+    auto bo = dynamic_cast<shim_xdna::bo_kmq*>(bh);
+    if (!bo)
+      throw xrt_core::query::no_such_key(key, "Not implemented");
+    return bo;
+  }
+};
+
+// Shim private requests working on fences, see shim_query.h
+struct fence_op
+{
+  static std::any
+  get(const xrt_core::device* /*device*/, key_type key)
+  {
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+
+  static std::any
+  get(const xrt_core::device* device, key_type key, const std::any& param)
+  {
+    if (key == shim_xdna::query::fence_poll::key) {
+      auto& args = std::any_cast<const shim_xdna::query::fence_poll::args&>(param);
+      return get_fence(key, args.fence)->is_signaled();
+    }
+    if (key == shim_xdna::query::fence_wait::key) {
+      auto& args = std::any_cast<const shim_xdna::query::fence_wait::args&>(param);
+      for (auto f : args.fences)
+        get_fence(key, f);
+      shim_xdna::query::fence_wait::result_type res = {};
+      res.signaled = shim_xdna::fence::wait(get_pcidev_impl(device), args.fences,
+        args.wait_all, args.timeout_ms, &res.first);
+      return res;
+    }
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+
+private:
+  static const shim_xdna::fence*
+  get_fence(key_type key, const xrt_core::fence_handle* fh)
+  {
+    auto f = dynamic_cast<const shim_xdna::fence*>(fh);
+    if (!f)
+      throw xrt_core::query::no_such_key(key, "Not implemented");
+    return f;
+  }
+};
+
+// Shim private counters, see shim_query.h
+struct shim_stats
+{
+  static std::any
+  get(const xrt_core::device* device, key_type key)
+  {
+    if (key == shim_xdna::query::bo_pool_stats::key) {
+      auto dev = dynamic_cast<const shim_xdna::device_kmq*>(device);
+      if (!dev)
+        throw xrt_core::query::no_such_key(key, "Not implemented");
+      return dev->get_bo_pool_stats();
+    }
+    if (key == shim_xdna::query::ioctl_stats::key)
+      return get_pcidev_impl(device).get_ioctl_stats();
+    if (key == shim_xdna::query::fence_pool_stats::key)
+      return get_pcidev_impl(device).get_syncobj_pool().stats();
+    throw xrt_core::query::no_such_key(key, "Not implemented");
+  }
+};
+
 template <typename QueryRequestType>
 struct sysfs_get : virtual QueryRequestType
 {
@@ -746,6 +918,18 @@ initialize_query_table()
   emplace_func1_request<query::sequence_name,                  sequence_name>();
   emplace_func1_request<query::xclbin_name,                    xclbin_name>();
   emplace_func0_request<query::firmware_version,               firmware_version>();
+
+  emplace_func1_request<shim_xdna::query::submit_commands,     hw_queue_op>();
+  emplace_func0_request<shim_xdna::query::bo_pool_stats,       shim_stats>();
+  emplace_func0_request<shim_xdna::query::ioctl_stats,         shim_stats>();
+  emplace_func1_request<shim_xdna::query::completion_fd,       hw_queue_op>();
+  emplace_func1_request<shim_xdna::query::wait_commands,       hw_queue_op>();
+  emplace_func1_request<shim_xdna::query::submit_template,     hw_queue_op>();
+  emplace_func1_request<shim_xdna::query::bo_write_tracking,   bo_op>();
+  emplace_func1_request<shim_xdna::query::bo_mark_dirty,       bo_op>();
+  emplace_func1_request<shim_xdna::query::fence_poll,          fence_op>();
+  emplace_func1_request<shim_xdna::query::fence_wait,          fence_op>();
+  emplace_func0_request<shim_xdna::query::fence_pool_stats,    shim_stats>();
 }
 
 struct X { X() { initialize_query_table(); }};
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _DIRTY_RANGE_XDNA_H_
+#define _DIRTY_RANGE_XDNA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+// Write tracking of host buffers, so that sync only needs to flush what
+// has been written since last sync.
+
+namespace shim_xdna {
+
+// Set of disjoint, non-adjacent [start, end) intervals. Not thread safe.
+class dirty_range
+{
+public:
+  void
+  add(size_t start, size_t len)
+  {
+    if (!len)
+      return;
+
+    auto end = start + len;
+    // First interval which could touch or overlap with [start, end)
+    auto it = m_ranges.upper_bound(start);
+    if (it != m_ranges.begin() && std::prev(it)->second >= start)
+      --it;
+
+    while (it != m_ranges.end() && it->first <= end) {
+      start = std::min(start, it->first);
+      end = std::max(end, it->second);
+      it = m_ranges.erase(it);
+    }
+    m_ranges.emplace(start, end);
+  }
+
+  // Call func on each dirty piece within [start, start + len) and
+  // remove the pieces from the set.
+  void
+  take(size_t start, size_t len, const std::function<void(size_t, size_t)>& func)
+  {
+    auto end = start + len;
+    auto it = m_ranges.upper_bound(start);
+    if (it != m_ranges.begin() && std::prev(it)->second > start)
+      --it;
+
+    while (it != m_ranges.end() && it->first < end) {
+      auto r_start = it->first;
+      auto r_end = it->second;
+      auto s = std::max(r_start, start);
+      auto e = std::min(r_end, end);
+
+      func(s, e - s);
+      it = m_ranges.erase(it);
+      // Keep the parts outside of the requested window
+      if (r_start < s)
+        m_ranges.emplace(r_start, s);
+      if (e < r_end)
+        it = m_ranges.emplace(e, r_end).first;
+    }
+  }
+
+  void
+  clear()
+  {
+    m_ranges.clear();
+  }
+
+  bool
+  empty() const
+  {
+    return m_ranges.empty();
+  }
+
+  size_t
+  bytes() const
+  {
+    size_t total = 0;
+    for (auto& r : m_ranges)
+      total += r.second - r.first;
+    return total;
+  }
+
+private:
+  std::map<size_t, size_t> m_ranges; // start -> end
+};
+
+// Kernel soft-dirty page tracking, see Documentation/admin-guide/mm/soft-dirty.rst.
+// Clearing is process wide, so callers must collect dirty pages of every
+// tracked buffer before calling clear().
+class soft_dirty
+{
+public:
+  static bool
+  supported()
+  {
+    static const bool ok = probe();
+    return ok;
+  }
+
+  // Call func with the offset of each soft-dirty page in [addr, addr + len)
+  static bool
+  for_each_dirty_page(const void *addr, size_t len, const std::function<void(size_t)>& func)
+  {
+    const size_t pgsz = getpagesize();
+    auto first = reinterpret_cast<uintptr_t>(addr) / pgsz;
+    auto last = (reinterpret_cast<uintptr_t>(addr) + len + pgsz - 1) / pgsz;
+    std::vector<uint64_t> entries(std::min<size_t>(last - first, batch_pages));
+
+    int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+
+    for (auto pg = first; pg < last; pg += entries.size()) {
+      auto n = std::min<size_t>(entries.size(), last - pg);
+      auto sz = n * sizeof(uint64_t);
+      if (pread(fd, entries.data(), sz, pg * sizeof(uint64_t)) != static_cast<ssize_t>(sz)) {
+        close(fd);
+        return false;
+      }
+      for (size_t i = 0; i < n; i++) {
+        if (entries[i] & pm_soft_dirty)
+          func((pg + i - first) * pgsz);
+      }
+    }
+    close(fd);
+    return true;
+  }
+
+  static bool
+  clear()
+  {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    auto ret = write(fd, "4", 1);
+    close(fd);
+    return ret == 1;
+  }
+
+private:
+  static constexpr uint64_t pm_soft_dirty = 1ULL << 55;
+  static constexpr size_t batch_pages = 512;
+
+  // clear_refs may be accepted even if kernel does not track soft-dirty bit
+  static bool
+  probe()
+  {
+    const size_t pgsz = getpagesize();
+    auto p = static_cast<volatile char *>(mmap(nullptr, pgsz, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (p == MAP_FAILED)
+      return false;
+
+    bool dirty = false;
+    p[0] = 1;
+    if (clear()) {
+      p[0] = 2;
+      for_each_dirty_page(const_cast<char *>(p), pgsz, [&dirty] (size_t) { dirty = true; });
+    }
+    munmap(const_cast<char *>(p), pgsz);
+    return dirty;
+  }
+};
+
+} // shim_xdna
+
+#endif // _DIRTY_RANGE_XDNA_H_
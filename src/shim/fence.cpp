@@ -3,7 +3,11 @@
 
 #include "fence.h"
 #include "drm_local/amdxdna_accel.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
+#include <atomic>
 #include <limits>
+#include <time.h>
 
 namespace {
 
@@ -27,6 +31,17 @@ destroy_syncobj(const shim_xdna::pdev& dev, uint32_t hdl)
   dev.ioctl(DRM_IOCTL_SYNCOBJ_DESTROY, &dsobj);
 }
 
+void
+reset_syncobj(const shim_xdna::pdev& dev, uint32_t hdl)
+{
+  drm_syncobj_array sobjs = {
+    .handles = reinterpret_cast<uintptr_t>(&hdl),
+    .count_handles = 1,
+    .pad = 0
+  };
+  dev.ioctl(DRM_IOCTL_SYNCOBJ_RESET, &sobjs);
+}
+
 uint64_t
 query_syncobj_timeline(const shim_xdna::pdev& dev, uint32_t sobj_hdl)
 {
@@ -77,17 +92,43 @@ signal_syncobj(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint
   dev.ioctl(DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL, &sobjs);
 }
 
-void
-wait_syncobj_done(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint)
+// DRM syncobj wait takes an absolute CLOCK_MONOTONIC deadline, 0 means forever
+int64_t
+timeout_to_deadline_ns(uint32_t timeout_ms)
+{
+  if (!timeout_ms)
+    return std::numeric_limits<int64_t>::max(); /* wait forever */
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec + timeout_ms * 1000000LL;
+}
+
+// Returns false if the wait has timed out. first_signaled is the index of
+// the first signaled syncobj for any-semantics wait.
+bool
+wait_syncobjs_done(const shim_xdna::pdev& dev, const uint32_t* sobj_hdls,
+  const uint64_t* timepoints, uint32_t num, bool wait_all, uint32_t timeout_ms,
+  uint32_t *first_signaled)
 {
   drm_syncobj_timeline_wait wsobj = {
-    .handles = reinterpret_cast<uintptr_t>(&sobj_hdl),
-    .points = reinterpret_cast<uintptr_t>(&timepoint),
-    .timeout_nsec = std::numeric_limits<int64_t>::max(), /* wait forever */
-    .count_handles = 1,
-    .flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+    .handles = reinterpret_cast<uintptr_t>(sobj_hdls),
+    .points = reinterpret_cast<uintptr_t>(timepoints),
+    .timeout_nsec = timeout_to_deadline_ns(timeout_ms),
+    .count_handles = num,
+    .flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT |
+             (wait_all ? DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL : 0u),
   };
-  dev.ioctl(DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
+  try {
+    dev.ioctl(DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ETIME)
+      throw;
+    return false;
+  }
+  if (first_signaled)
+    *first_signaled = wsobj.first_signaled;
+  return true;
 }
 
 void
@@ -106,15 +147,28 @@ wait_syncobj_available(const shim_xdna::pdev& dev,
   dev.ioctl(DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
 }
 
+// Let driver hold the dependency till the points are submitted, instead of
+// waiting for them here. Needs a driver supporting deferred dependency.
+bool
+deferred_dependency()
+{
+  static bool deferred =
+    xrt_core::config::detail::get_bool_value("Debug.fence_deferred_dependency", false);
+  return deferred;
+}
+
 void
 submit_wait_syncobjs(const shim_xdna::pdev& dev, const shim_xdna::hw_ctx *ctx,
   const uint32_t* sobj_hdls, const uint64_t* points, uint32_t num)
 {
-  wait_syncobj_available(dev, sobj_hdls, points, num);
+  bool deferred = deferred_dependency();
+
+  if (!deferred)
+    wait_syncobj_available(dev, sobj_hdls, points, num);
 
   amdxdna_drm_exec_cmd ecmd = {
     .hwctx = ctx->get_slotidx(),
-    .type = AMDXDNA_CMD_SUBMIT_DEPENDENCY,
+    .type = deferred ? AMDXDNA_CMD_SUBMIT_DEFERRED_DEPENDENCY : AMDXDNA_CMD_SUBMIT_DEPENDENCY,
     .cmd_handles = reinterpret_cast<uintptr_t>(sobj_hdls),
     .args = reinterpret_cast<uintptr_t>(points),
     .cmd_count = num,
@@ -142,44 +196,137 @@ submit_signal_syncobj(const shim_xdna::pdev& dev, const shim_xdna::hw_ctx *ctx,
 
 namespace shim_xdna {
 
+// Syncobj handle shared by a fence and its clones, destroyed or put back to
+// the pool of the device with the last of them. A recycled syncobj keeps its
+// timeline, points of the new fence start after the last point used on it.
+class fence::syncobj
+{
+public:
+  explicit
+  syncobj(const pdev& dev)
+    : m_pdev(dev)
+    , m_poolable(dev.get_syncobj_pool().enabled())
+  {
+    auto e = m_poolable ? dev.get_syncobj_pool().get() : std::nullopt;
+    if (e) {
+      m_handle = e->handle;
+      m_base = m_last_point = e->point;
+    } else {
+      m_handle = create_syncobj(m_pdev);
+    }
+  }
+
+  syncobj(const pdev& dev, int fd)
+    : m_pdev(dev)
+    , m_handle(import_syncobj(dev, fd))
+    , m_poolable(false)
+  {}
+
+  ~syncobj()
+  {
+    if (m_poolable && all_points_signaled() &&
+      m_pdev.get_syncobj_pool().put({ m_handle, m_last_point }))
+      return;
+    try {
+      destroy_syncobj(m_pdev, m_handle);
+    } catch (const xrt_core::system_error& e) {
+      shim_debug("Failed to destroy fence");
+    }
+  }
+
+  uint32_t
+  handle() const
+  {
+    return m_handle;
+  }
+
+  // Timeline point of a fence state
+  uint64_t
+  point(uint64_t state) const
+  {
+    return m_base + state;
+  }
+
+  void
+  use_point(uint64_t pt)
+  {
+    auto last = m_last_point.load();
+    while (last < pt && !m_last_point.compare_exchange_weak(last, pt));
+  }
+
+  // Fence in other process starts from point 0, so timeline of a recycled
+  // syncobj is restarted. Exported syncobj can't be recycled any more.
+  int
+  share()
+  {
+    if (m_base) {
+      if (m_last_point != m_base)
+        shim_err(-EINVAL, "Can't share fence not at initial state.");
+      reset_syncobj(m_pdev, m_handle);
+      m_base = m_last_point = 0;
+    }
+    m_poolable = false;
+    return export_syncobj(m_pdev, m_handle);
+  }
+
+private:
+  // A point waited on but never signaled may still be signaled later, e.g.
+  // by a command submitted with it. Recycled, the late signal would satisfy
+  // the next fence on the syncobj, so such a syncobj is not recycled.
+  bool
+  all_points_signaled() const
+  {
+    try {
+      return query_syncobj_timeline(m_pdev, m_handle) >= m_last_point;
+    } catch (const xrt_core::system_error& e) {
+      return false;
+    }
+  }
+
+  const pdev& m_pdev;
+  uint32_t m_handle;
+  std::atomic<uint64_t> m_base = 0;
+  std::atomic<uint64_t> m_last_point = 0;
+  std::atomic<bool> m_poolable;
+};
+
 fence::
 fence(const device& device)
   : m_pdev(device.get_pdev())
   , m_import(std::make_unique<shared>(-1))
-  , m_syncobj_hdl(create_syncobj(m_pdev))
+  , m_syncobj(std::make_shared<syncobj>(m_pdev))
+  , m_syncobj_hdl(m_syncobj->handle())
 {
-  shim_debug("Fence allocated: %d@%d", m_syncobj_hdl, m_state);
+  shim_debug("Fence allocated: %d@%ld", m_syncobj_hdl, m_syncobj->point(m_state));
 }
 
 fence::
 fence(const device& device, xrt_core::shared_handle::export_handle ehdl)
   : m_pdev(device.get_pdev())
   , m_import(std::make_unique<shared>(ehdl))
-  , m_syncobj_hdl(import_syncobj(m_pdev, m_import->get_export_handle()))
+  , m_syncobj(std::make_shared<syncobj>(m_pdev, m_import->get_export_handle()))
+  , m_syncobj_hdl(m_syncobj->handle())
 {
   shim_debug("Fence imported: %d@%ld", m_syncobj_hdl, m_state);
 }
 
+// Clone shares the syncobj handle, no need to go through an fd
 fence::
 fence(const fence& f)
   : m_pdev(f.m_pdev)
-  , m_import(f.share())
-  , m_syncobj_hdl(import_syncobj(m_pdev, m_import->get_export_handle()))
-  , m_state{f.m_state}
+  , m_import(std::make_unique<shared>(-1))
+  , m_syncobj(f.m_syncobj)
+  , m_syncobj_hdl(f.m_syncobj_hdl)
   , m_signaled{f.m_signaled}
+  , m_state{f.m_state}
 {
-  shim_debug("Fence cloned: %d@%ld", m_syncobj_hdl, m_state);
+  shim_debug("Fence cloned: %d@%ld", m_syncobj_hdl, m_syncobj->point(m_state));
 }
 
 fence::
 ~fence()
 {
-  shim_debug("Fence going away: %d@%ld", m_syncobj_hdl, m_state);
-  try {
-    destroy_syncobj(m_pdev, m_syncobj_hdl);
-  } catch (const xrt_core::system_error& e) {
-    shim_debug("Failed to destroy fence");
-  }
+  shim_debug("Fence going away: %d@%ld", m_syncobj_hdl, m_syncobj->point(m_state));
 }
 
 std::unique_ptr<xrt_core::shared_handle>
@@ -189,7 +336,7 @@ share() const
   if (m_state != initial_state)
     shim_err(-EINVAL, "Can't share fence not at initial state.");
 
-  return std::make_unique<shared>(export_syncobj(m_pdev, m_syncobj_hdl));
+  return std::make_unique<shared>(m_syncobj->share());
 }
 
 uint64_t
@@ -214,17 +361,68 @@ wait_next_state() const
 
   if (m_state != initial_state && m_signaled)
     shim_err(-EINVAL, "Can't wait on fence that has been signaled before.");
-  return ++m_state;
+  auto pt = m_syncobj->point(++m_state);
+  m_syncobj->use_point(pt);
+  return pt;
 }
 
-// Timeout value is ignored for now.
+// Throws ETIME if the fence is not signaled within timeout_ms, 0 means
+// wait forever. The fence state is left as is on timeout, so the same
+// point is waited on again by next call.
 void
 fence::
 wait(uint32_t timeout_ms) const
 {
   auto st = signal_next_state();
-  shim_debug("Waiting for command fence %d@%ld", m_syncobj_hdl, st);
-  wait_syncobj_done(m_pdev, m_syncobj_hdl, st);
+  shim_debug("Waiting for command fence %d@%ld, timeout %dms", m_syncobj_hdl, st, timeout_ms);
+  if (wait_syncobjs_done(m_pdev, &m_syncobj_hdl, &st, 1, true, timeout_ms, nullptr))
+    return;
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_syncobj->point(m_state) == st) {
+      if (--m_state == initial_state)
+        m_signaled = false;
+    }
+  }
+  shim_err(-ETIME, "Timed out waiting for command fence %d@%ld", m_syncobj_hdl, st);
+}
+
+bool
+fence::
+is_signaled() const
+{
+  auto pt = m_syncobj->point(get_next_state());
+  return query_syncobj_timeline(m_pdev, m_syncobj_hdl) >= pt;
+}
+
+bool
+fence::
+wait(const pdev& dev, const std::vector<xrt_core::fence_handle*>& fences, bool wait_all,
+  uint32_t timeout_ms, size_t *first_signaled)
+{
+  std::vector<uint32_t> hdls;
+  std::vector<uint64_t> pts;
+  uint32_t first = 0;
+
+  if (fences.empty())
+    shim_err(-EINVAL, "No fence to wait on");
+
+  hdls.reserve(fences.size());
+  pts.reserve(fences.size());
+  for (auto f : fences) {
+    auto fh = static_cast<const fence*>(f);
+    hdls.push_back(fh->m_syncobj_hdl);
+    pts.push_back(fh->m_syncobj->point(fh->get_next_state()));
+  }
+
+  shim_debug("Waiting for %ld command fences (%s), timeout %dms",
+    fences.size(), wait_all ? "all" : "any", timeout_ms);
+  if (!wait_syncobjs_done(dev, hdls.data(), pts.data(), hdls.size(), wait_all, timeout_ms, &first))
+    return false;
+  if (first_signaled)
+    *first_signaled = first;
+  return true;
 }
 
 void
@@ -246,7 +444,9 @@ signal_next_state() const
     shim_err(-EINVAL, "Can't signal fence that has been waited before.");
   if (m_state == initial_state)
     m_signaled = true;
-  return ++m_state;
+  auto pt = m_syncobj->point(++m_state);
+  m_syncobj->use_point(pt);
+  return pt;
 }
 
 void
@@ -271,23 +471,39 @@ void
 fence::
 submit_wait(const pdev& dev, const hw_ctx *ctx, const std::vector<xrt_core::fence_handle*>& fences)
 {
-  constexpr int max_fences = 1024;
-  uint32_t hdls[max_fences];
-  uint64_t pts[max_fences];
-  int i = 0;
-
-  if (fences.size() > max_fences)
-    shim_err(-EINVAL, "Too many fences in one submit: %d", fences.size());
+  // Max syncobjs driver takes in one dependency submission
+  constexpr size_t max_deps = 4095;
+  std::vector<std::pair<uint32_t, uint64_t>> deps;
+  std::vector<uint32_t> hdls;
+  std::vector<uint64_t> pts;
 
+  deps.reserve(fences.size());
   for (auto f : fences) {
     auto fh = static_cast<const fence*>(f);
     auto st = fh->wait_next_state();
     shim_debug("Waiting for command fence %d@%ld", fh->m_syncobj_hdl, st);
-    hdls[i] = fh->m_syncobj_hdl;
-    pts[i] = st;
-    i++;
+    deps.emplace_back(fh->m_syncobj_hdl, st);
+  }
+
+  // Waiting on the latest point of a syncobj covers the earlier ones
+  std::sort(deps.begin(), deps.end());
+  hdls.reserve(deps.size());
+  pts.reserve(deps.size());
+  for (auto& d : deps) {
+    if (!hdls.empty() && hdls.back() == d.first) {
+      pts.back() = d.second;
+      continue;
+    }
+    hdls.push_back(d.first);
+    pts.push_back(d.second);
+  }
+
+  // Jobs of a context run in order, so the rest of the set can be sent
+  // as more dependency submissions.
+  for (size_t i = 0; i < hdls.size(); i += max_deps) {
+    auto n = std::min(max_deps, hdls.size() - i);
+    submit_wait_syncobjs(dev, ctx, &hdls[i], &pts[i], n);
   }
-  submit_wait_syncobjs(dev, ctx, hdls, pts, i);
 }
 
 } // shim_xdna
@@ -10,7 +10,9 @@
 
 #include "shim_debug.h"
 #include "core/common/shim/fence_handle.h"
+#include <memory>
 #include <mutex>
+#include <vector>
 
 namespace shim_xdna {
 
@@ -41,6 +43,19 @@ public:
   signal() const override;
 
 public:
+  // Non-blocking check whether the state next wait would be waiting for
+  // has been reached. Fence state is not moved forward.
+  bool
+  is_signaled() const;
+
+  // Wait on many fences at once for all or any of them to reach the state
+  // next wait would be waiting for. Fence states are not moved forward.
+  // Returns false on timeout, 0 timeout means wait forever. first_signaled
+  // is set to the index of a signaled fence for any-semantics wait.
+  static bool
+  wait(const pdev& dev, const std::vector<xrt_core::fence_handle*>& fences, bool wait_all,
+    uint32_t timeout_ms, size_t *first_signaled = nullptr);
+
   void
   submit_wait(const hw_ctx*) const;
 
@@ -51,15 +66,20 @@ public:
   submit_signal(const hw_ctx*) const;
 
 private:
+  // Move to next state, returns its timeline point
   uint64_t
   wait_next_state() const;
 
   uint64_t
   signal_next_state() const;
 
+  class syncobj;
+
   const pdev& m_pdev;
   const std::unique_ptr<xrt_core::shared_handle> m_import;
-  uint32_t m_syncobj_hdl;
+  // Shared with clones
+  const std::shared_ptr<syncobj> m_syncobj;
+  const uint32_t m_syncobj_hdl;
 
   // Protecting below mutables
   mutable std::mutex m_lock;
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _FLUSH_POOL_XDNA_H_
+#define _FLUSH_POOL_XDNA_H_
+
+#include "cache_flush.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+namespace shim_xdna {
+
+// Small worker pool splitting cache flush of a large range across threads.
+// The calling thread works on the range as well, so a pool of N workers
+// flushes with N + 1 threads. One range is flushed at a time.
+// A forked child starts its own workers on its first parallel flush.
+class flush_pool
+{
+public:
+  flush_pool(size_t nworkers, size_t threshold)
+    : m_threshold(threshold)
+    , m_nworkers(nworkers)
+  {
+    start_workers();
+    auto& reg = fork_registry();
+    std::lock_guard<std::mutex> lg(reg.lock);
+    reg.pools.push_back(this);
+  }
+
+  ~flush_pool()
+  {
+    {
+      auto& reg = fork_registry();
+      std::lock_guard<std::mutex> lg(reg.lock);
+      reg.pools.erase(std::find(reg.pools.begin(), reg.pools.end(), this));
+    }
+    {
+      std::lock_guard<std::mutex> lk(m_lock);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto& t : m_workers)
+      t->join();
+  }
+
+  // Ranges below threshold are flushed on the calling thread only.
+  void
+  flush(flush_insn insn, const volatile void *addr, size_t len)
+  {
+    if (!m_nworkers || len < m_threshold) {
+      flush_range(insn, addr, len);
+      return;
+    }
+
+    std::lock_guard<std::mutex> job_lk(m_job_lock);
+    if (m_workers.empty())
+      start_workers();
+    auto nthreads = m_nworkers + 1;
+    {
+      std::lock_guard<std::mutex> lk(m_lock);
+      m_insn = insn;
+      m_base = reinterpret_cast<uintptr_t>(addr);
+      m_len = len;
+      m_chunk = std::max((len / nthreads + chunk_align - 1) & ~(chunk_align - 1), chunk_align);
+      m_next = 0;
+      m_active = m_nworkers;
+      m_gen++;
+    }
+    m_cv.notify_all();
+
+    run_chunks();
+
+    std::unique_lock<std::mutex> lk(m_lock);
+    m_done_cv.wait(lk, [this] { return m_active == 0; });
+  }
+
+  size_t
+  size() const
+  {
+    return m_nworkers;
+  }
+
+private:
+  static constexpr size_t chunk_align = 64 * 1024;
+
+  // Pools alive in the process, so that fork() can take their locks
+  struct registry
+  {
+    std::mutex lock;
+    std::vector<flush_pool *> pools;
+  };
+
+  static registry&
+  fork_registry()
+  {
+    // Never freed, pools are statics which may go away in any order
+    static registry *reg = [] {
+      pthread_atfork(before_fork, after_fork_in_parent, after_fork_in_child);
+      return new registry;
+    }();
+    return *reg;
+  }
+
+  // No flush is in flight while the process forks, so that the child
+  // does not inherit a half done range or locks held by workers
+  static void
+  before_fork()
+  {
+    auto& reg = fork_registry();
+    reg.lock.lock();
+    for (auto p : reg.pools) {
+      p->m_job_lock.lock();
+      p->m_lock.lock();
+    }
+  }
+
+  static void
+  after_fork_in_parent()
+  {
+    auto& reg = fork_registry();
+    for (auto p : reg.pools) {
+      p->m_lock.unlock();
+      p->m_job_lock.unlock();
+    }
+    reg.lock.unlock();
+  }
+
+  static void
+  after_fork_in_child()
+  {
+    auto& reg = fork_registry();
+    for (auto p : reg.pools) {
+      // Workers are gone, their handles can neither be joined nor detached,
+      // and the condition variables may still count them as waiters
+      for (auto& t : p->m_workers)
+        t.release();
+      p->m_workers.clear();
+      new (&p->m_cv) std::condition_variable;
+      new (&p->m_done_cv) std::condition_variable;
+      p->m_active = 0;
+      p->m_lock.unlock();
+      p->m_job_lock.unlock();
+    }
+    reg.lock.unlock();
+  }
+
+  void
+  start_workers()
+  {
+    for (size_t i = 0; i < m_nworkers; i++)
+      m_workers.push_back(std::make_unique<std::thread>(&flush_pool::worker, this));
+  }
+
+  void
+  run_chunks()
+  {
+    for (;;) {
+      auto off = m_next.fetch_add(m_chunk, std::memory_order_relaxed);
+      if (off >= m_len)
+        break;
+      flush_range(m_insn, reinterpret_cast<const void *>(m_base + off),
+        std::min(m_chunk, m_len - off));
+    }
+  }
+
+  void
+  worker()
+  {
+    uint64_t seen = 0;
+
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lk(m_lock);
+        m_cv.wait(lk, [&] { return m_stop || m_gen != seen; });
+        if (m_stop)
+          return;
+        seen = m_gen;
+      }
+
+      run_chunks();
+
+      std::lock_guard<std::mutex> lk(m_lock);
+      if (--m_active == 0)
+        m_done_cv.notify_one();
+    }
+  }
+
+  const size_t m_threshold;
+  const size_t m_nworkers;
+  std::vector<std::unique_ptr<std::thread>> m_workers;
+
+  // Serializes callers, only one range in flight
+  std::mutex m_job_lock;
+
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::condition_variable m_done_cv;
+  uint64_t m_gen = 0;
+  size_t m_active = 0;
+  bool m_stop = false;
+
+  // Current range, written under m_lock before m_gen is bumped
+  flush_insn m_insn = flush_insn::clflush;
+  uintptr_t m_base = 0;
+  size_t m_len = 0;
+  size_t m_chunk = 0;
+  std::atomic<size_t> m_next = 0;
+};
+
+} // shim_xdna
+
+#endif // _FLUSH_POOL_XDNA_H_
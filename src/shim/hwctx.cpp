@@ -5,12 +5,22 @@
 #include "hwctx.h"
 #include "hwq.h"
 
+#include "core/common/config_reader.h"
 #include "core/common/xclbin_parser.h"
 #include "core/common/query_requests.h"
 #include "core/common/api/xclbin_int.h"
 
 namespace {
 
+// Requested depth of in-flight command window, 0 means driver default
+uint32_t
+get_max_cmds()
+{
+  static const uint32_t max_cmds =
+    xrt_core::config::detail::get_uint_value("Debug.hwctx_max_cmds", 0);
+  return max_cmds;
+}
+
 std::vector<uint8_t>
 get_pdi(const xrt_core::xclbin::aie_partition_obj& aie, uint16_t kernel_id)
 {
@@ -30,7 +40,7 @@ namespace shim_xdna {
 
 hw_ctx::
 hw_ctx(const device& dev, const qos_type& qos, std::unique_ptr<hw_q> q, const xrt::xclbin& xclbin)
-  : m_device(dev), m_q(std::move(q)), m_doorbell(0), m_log_buf(nullptr)
+  : m_device(dev), m_q(std::move(q)), m_doorbell(0), m_max_cmds(0), m_log_buf(nullptr)
 {
   shim_debug("Creating HW context...");
   init_qos_info(qos);
@@ -199,10 +209,24 @@ create_ctx_on_device()
   arg.log_buf_bo = m_log_bo ?
     static_cast<bo*>(m_log_bo.get())->get_drm_bo_handle() :
     AMDXDNA_INVALID_BO_HANDLE;
-  m_device.get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CREATE_HWCTX, &arg);
+  arg.max_cmds = get_max_cmds();
+  if (arg.max_cmds)
+    arg.ext_flags |= AMDXDNA_HWCTX_MAX_CMDS;
+  try {
+    m_device.get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CREATE_HWCTX, &arg);
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != EINVAL || !arg.ext_flags)
+      throw;
+    // Older driver takes no depth, or the depth is out of range
+    shim_info("Command window depth %u not taken, using driver default", arg.max_cmds);
+    arg.ext_flags &= ~AMDXDNA_HWCTX_MAX_CMDS;
+    arg.max_cmds = 0;
+    m_device.get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CREATE_HWCTX, &arg);
+  }
 
   set_slotidx(arg.handle);
   set_doorbell(arg.umq_doorbell);
+  set_max_cmds(arg.max_cmds);
 
   m_q->bind_hwctx(this);
 }
@@ -254,4 +278,20 @@ get_doorbell() const
   return m_doorbell;
 }
 
+void
+hw_ctx::
+set_max_cmds(uint32_t max_cmds)
+{
+  // Older driver returns what it is given, which is 0 for its fixed depth of 4
+  m_max_cmds = max_cmds ? max_cmds : 4;
+  shim_debug("HW context (%d) command window depth: %d", m_handle, m_max_cmds);
+}
+
+uint32_t
+hw_ctx::
+get_max_cmds() const
+{
+  return m_max_cmds;
+}
+
 } // shim_xdna
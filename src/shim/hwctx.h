@@ -61,6 +61,10 @@ public:
   uint32_t
   get_doorbell() const;
 
+  // Max number of commands in flight on this context
+  uint32_t
+  get_max_cmds() const;
+
 protected:
   const device&
   get_device();
@@ -80,6 +84,9 @@ protected:
   void
   set_doorbell(uint32_t db);
 
+  void
+  set_max_cmds(uint32_t max_cmds);
+
   void
   create_ctx_on_device();
 
@@ -98,6 +105,7 @@ private:
   uint32_t m_ops_per_cycle;
   uint32_t m_num_cols;
   uint32_t m_doorbell;
+  uint32_t m_max_cmds;
   std::unique_ptr<xrt_core::buffer_handle> m_log_bo;
   void *m_log_buf;
 
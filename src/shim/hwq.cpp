@@ -5,10 +5,42 @@
 #include "hwq.h"
 #include "fence.h"
 #include "shim_debug.h"
+#include "core/common/config_reader.h"
 #include "core/common/trace.h"
 
+#include <x86intrin.h>
+
 namespace {
 
+// Upper bound of spinning on command state before waiting in driver.
+// 0 disables spinning. Within the bound, spin time is derived from recent
+// latency of commands on the same CU.
+uint64_t
+get_cmd_wait_spin_max_ns()
+{
+  static uint64_t max_ns =
+    xrt_core::config::detail::get_uint_value("Debug.cmd_wait_spin_max_us", 0) * 1000;
+  return max_ns;
+}
+
+// Latency is tracked per CU, chained commands on their own
+uint32_t
+get_latency_key(xrt_core::buffer_handle *cmd)
+{
+  auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cmd->map(xrt_core::buffer_handle::map_type::write));
+
+  if (cmdpkt->opcode == ERT_CMD_CHAIN || !cmdpkt->cu_mask)
+    return shim_xdna::cmd_latency::max_keys - 1;
+  return __builtin_ctz(cmdpkt->cu_mask) % (shim_xdna::cmd_latency::max_keys - 1);
+}
+
+uint64_t
+ns_since(std::chrono::steady_clock::time_point t)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - t).count();
+}
+
 ert_packet *
 get_chained_command_pkt(xrt_core::buffer_handle *boh)
 {
@@ -99,13 +131,53 @@ poll_command(xrt_core::buffer_handle *cmd) const
   return 0;
 }
 
+bool
+hw_q::
+spin_wait(xrt_core::buffer_handle *cmd, uint32_t key) const
+{
+  auto boh = static_cast<bo*>(cmd);
+  auto budget = cmd_latency::spin_budget(m_latency.expected(key),
+    ns_since(boh->get_submit_time()), get_cmd_wait_spin_max_ns());
+  if (!budget)
+    return false;
+
+  auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(budget);
+  for (int spin = 1; ; spin++) {
+    if (poll_command(cmd))
+      return true;
+    // Reading the clock costs more than a pause, check it once in a while
+    if (!(spin % 64) && std::chrono::steady_clock::now() >= end)
+      return false;
+    _mm_pause();
+  }
+}
+
 int
 hw_q::
 wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
 {
   if (poll_command(cmd))
       return 1;
-  return wait_cmd(m_pdev, m_hwctx, cmd, timeout_ms);
+  if (!get_cmd_wait_spin_max_ns())
+    return wait_cmd(m_pdev, m_hwctx, cmd, timeout_ms);
+
+  auto key = get_latency_key(cmd);
+  int ret = spin_wait(cmd, key) ? 1 : wait_cmd(m_pdev, m_hwctx, cmd, timeout_ms);
+  // Completion seen after blocking includes wakeup latency, close enough
+  if (ret)
+    m_latency.update(key, ns_since(static_cast<bo*>(cmd)->get_submit_time()));
+  return ret;
+}
+
+void
+hw_q::
+set_cmd_id(xrt_core::buffer_handle *cmd, uint64_t id) const
+{
+  auto boh = static_cast<bo*>(cmd);
+  boh->set_cmd_id(id);
+  // Submit time only feeds spin_wait(), skip reading the clock without it
+  if (get_cmd_wait_spin_max_ns())
+    boh->set_submit_time(std::chrono::steady_clock::now());
 }
 
 void
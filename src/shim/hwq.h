@@ -4,6 +4,7 @@
 #ifndef _HWQ_XDNA_H_
 #define _HWQ_XDNA_H_
 
+#include "cmd_latency.h"
 #include "fence.h"
 #include "hwctx.h"
 #include "shim_debug.h"
@@ -20,6 +21,14 @@ public:
   void
   submit_command(xrt_core::buffer_handle *) override;
 
+  // Submit a batch of command BOs at lower cost than one by one.
+  // Sequence number of each submitted command is appended to seqs, in the
+  // same order. On failure seqs holds the commands before the failed one,
+  // which are submitted and can be waited on.
+  virtual void
+  submit_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos,
+    std::vector<uint64_t>& seqs) = 0;
+
   int
   poll_command(xrt_core::buffer_handle *) const override;
 
@@ -53,9 +62,21 @@ protected:
   virtual void
   issue_command(xrt_core::buffer_handle *) = 0;
 
+  // Record the cmd ID of a submitted cmd BO, and its submit time when
+  // wait_command() may spin on it
+  void
+  set_cmd_id(xrt_core::buffer_handle *cmd, uint64_t id) const;
+
   const hw_ctx *m_hwctx;
   const pdev& m_pdev;
   uint32_t m_queue_boh;
+
+private:
+  // Spin on command state before blocking in driver, see wait_command()
+  bool
+  spin_wait(xrt_core::buffer_handle *cmd, uint32_t key) const;
+
+  mutable cmd_latency m_latency;
 };
 
 } // shim_xdna
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _IOCTL_STATS_XDNA_H_
+#define _IOCTL_STATS_XDNA_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <utility>
+#include <vector>
+
+namespace shim_xdna {
+
+struct ioctl_stat
+{
+  static constexpr size_t hist_buckets = 32;
+
+  unsigned long cmd;
+  uint64_t count;
+  uint64_t total_ns;
+  // Bucket i counts calls taking [2^(i-1), 2^i) ns, last one is open ended
+  std::array<uint64_t, hist_buckets> hist;
+};
+
+// Call counts and latency histograms of ioctl commands.
+// Each thread records into its own counters, which are only summed up when
+// stats are read, so recording takes no lock and shares no cache line.
+// Counters of exited threads are folded into one set of totals and their
+// own counters are freed when the next thread starts recording.
+class ioctl_stats
+{
+public:
+  static size_t
+  bucket(uint64_t ns)
+  {
+    if (!ns)
+      return 0;
+    return std::min<size_t>(64 - __builtin_clzll(ns), ioctl_stat::hist_buckets - 1);
+  }
+
+  void
+  record(unsigned long cmd, uint64_t ns)
+  {
+    auto& c = local().cmds[_IOC_NR(cmd)];
+    // Only this thread writes, plain load and store is enough
+    auto inc = [] (std::atomic<uint64_t>& v, uint64_t n) {
+      v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    };
+
+    c.cmd.store(cmd, std::memory_order_relaxed);
+    inc(c.count, 1);
+    inc(c.total_ns, ns);
+    inc(c.hist[bucket(ns)], 1);
+  }
+
+  // Sum of all threads, for commands called at least once
+  std::vector<ioctl_stat>
+  snapshot() const
+  {
+    std::vector<ioctl_stat> ret;
+    std::array<ioctl_stat, max_cmds> sum = {};
+
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      if (m_exited)
+        sum = *m_exited;
+      for (auto& t : m_threads)
+        add(sum, *t);
+    }
+
+    for (auto& s : sum) {
+      if (s.count)
+        ret.push_back(s);
+    }
+    return ret;
+  }
+
+  // Threads having counters of their own, including exited ones not
+  // folded into the totals yet
+  size_t
+  thread_count() const
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    return m_threads.size();
+  }
+
+private:
+  // Commands are told apart by their number, which is unique per device
+  static constexpr size_t max_cmds = 1 << _IOC_NRBITS;
+
+  struct counters
+  {
+    std::atomic<unsigned long> cmd;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::array<std::atomic<uint64_t>, ioctl_stat::hist_buckets> hist;
+  };
+
+  struct thread_counters
+  {
+    std::array<counters, max_cmds> cmds = {};
+  };
+
+  using totals = std::array<ioctl_stat, max_cmds>;
+
+  static void
+  add(totals& sum, const thread_counters& t)
+  {
+    for (size_t i = 0; i < max_cmds; i++) {
+      auto& c = t.cmds[i];
+      auto& s = sum[i];
+      auto count = c.count.load(std::memory_order_relaxed);
+      if (!count)
+        continue;
+      s.cmd = c.cmd.load(std::memory_order_relaxed);
+      s.count += count;
+      s.total_ns += c.total_ns.load(std::memory_order_relaxed);
+      for (size_t b = 0; b < ioctl_stat::hist_buckets; b++)
+        s.hist[b] += c.hist[b].load(std::memory_order_relaxed);
+    }
+  }
+
+  // Counters of an exited thread are only referenced here, fold them into
+  // the totals and free them. Called with m_lock held.
+  void
+  release_dead_threads()
+  {
+    auto it = std::stable_partition(m_threads.begin(), m_threads.end(),
+      [] (const std::shared_ptr<thread_counters>& t) { return t.use_count() > 1; });
+    if (it == m_threads.end())
+      return;
+    if (!m_exited)
+      m_exited = std::make_unique<totals>();
+    for (auto t = it; t != m_threads.end(); t++)
+      add(*m_exited, **t);
+    m_threads.erase(it, m_threads.end());
+  }
+
+  thread_counters&
+  local()
+  {
+    // Threads usually talk to one device, look up is linear
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<thread_counters>>> tls;
+
+    for (auto& t : tls) {
+      if (t.first == m_id)
+        return *t.second;
+    }
+
+    auto tc = std::make_shared<thread_counters>();
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      release_dead_threads();
+      m_threads.push_back(tc);
+    }
+    tls.emplace_back(m_id, tc);
+    return *tc;
+  }
+
+  static uint64_t
+  next_id()
+  {
+    static std::atomic<uint64_t> id = 0;
+    return id++;
+  }
+
+  const uint64_t m_id = next_id();
+  mutable std::mutex m_lock;
+  std::vector<std::shared_ptr<thread_counters>> m_threads;
+  // Totals of exited threads, allocated when the first one is folded
+  std::unique_ptr<totals> m_exited;
+};
+
+} // shim_xdna
+
+#endif // _IOCTL_STATS_XDNA_H_
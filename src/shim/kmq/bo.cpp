@@ -2,8 +2,12 @@
 // Copyright (C) 2023-2024, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "bo.h"
+#include "pcidev.h"
+#include "../cache_flush.h"
+#include "../flush_pool.h"
 #include "core/common/config_reader.h"
-#include <x86intrin.h>
+
+#include <cstring>
 
 namespace {
 
@@ -27,26 +31,28 @@ flag_to_type(uint64_t bo_flags)
 }
 
 
+// Large syncs are split across a few worker threads, by default disabled
+shim_xdna::flush_pool&
+get_flush_pool()
+{
+  static shim_xdna::flush_pool pool(
+    xrt_core::config::detail::get_uint_value("Debug.sync_threads", 0),
+    xrt_core::config::detail::get_uint_value("Debug.sync_parallel_threshold", 16 * 1024 * 1024));
+  return pool;
+}
+
 // flash cache line for non coherence memory
 inline void
-clflush_data(const void *base, size_t offset, size_t len)
+clflush_data(const void *base, size_t offset, size_t len, xrt_core::buffer_handle::direction dir)
 {
-  static long cacheline_size = 0;
-
-  if (!cacheline_size) {
-    long sz = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
-    if (sz <= 0)
-      shim_err(EINVAL, "Invalid cache line size: %ld", sz);
-    cacheline_size = sz;
-  }
-
-  const char *cur = (const char *)base;
-  cur += offset;
-  uintptr_t lastline = (uintptr_t)(cur + len - 1) | (cacheline_size - 1);
-  do {
-    _mm_clflush(cur);
-    cur += cacheline_size;
-  } while (cur <= (const char *)lastline);
+  auto cur = static_cast<const char *>(base) + offset;
+
+  // Device is going to read, write back is enough. Otherwise stale lines
+  // must be evicted before host reads what device wrote.
+  if (dir == xrt_core::buffer_handle::direction::host2device)
+    get_flush_pool().flush(shim_xdna::get_writeback_insn(), cur, len);
+  else
+    get_flush_pool().flush(shim_xdna::get_flush_insn(), cur, len);
 }
 
 void
@@ -63,6 +69,45 @@ sync_drm_bo(const shim_xdna::pdev& dev, uint32_t boh, xrt_core::buffer_handle::d
   dev.ioctl(DRM_IOCTL_AMDXDNA_SYNC_BO, &sbo);
 }
 
+// All BOs in soft-dirty mode. Clearing soft-dirty bits is process wide, so
+// dirty pages of all of them are collected before each clear.
+std::mutex soft_dirty_bos_lock;
+std::set<shim_xdna::bo_kmq*> soft_dirty_bos;
+
+void
+collect_and_clear_soft_dirty()
+{
+  std::lock_guard<std::mutex> lg(soft_dirty_bos_lock);
+
+  for (auto b : soft_dirty_bos)
+    b->collect_soft_dirty();
+  if (!shim_xdna::soft_dirty::clear())
+    shim_err(errno, "Failed to clear soft-dirty bits");
+}
+
+// Allocate AMDXDNA_BO_DEV as SHMEM BO once device heap can't fit it
+bool
+is_dev_bo_shmem_fallback()
+{
+  static const bool fallback =
+    xrt_core::config::detail::get_bool_value("Debug.dev_bo_shmem_fallback", false);
+  return fallback;
+}
+
+amdxdna_drm_query_dev_heap
+query_dev_heap(const shim_xdna::pdev& dev)
+{
+  amdxdna_drm_query_dev_heap heap = {};
+  amdxdna_drm_get_info arg = {
+    .param = DRM_AMDXDNA_QUERY_DEV_HEAP,
+    .buffer_size = sizeof(heap),
+    .buffer = reinterpret_cast<uintptr_t>(&heap)
+  };
+
+  dev.ioctl(DRM_IOCTL_AMDXDNA_GET_INFO, &arg);
+  return heap;
+}
+
 bool
 is_driver_sync()
 {
@@ -79,10 +124,38 @@ is_driver_sync()
 
 namespace shim_xdna {
 
+bo_kmq::backing::
+backing(const pdev& pdev, std::shared_ptr<drm_bo> bo, void *aligned, size_t size,
+  void *parent, size_t parent_size)
+  : m_pdev(pdev)
+  , m_bo(std::move(bo))
+  , m_aligned(aligned)
+  , m_size(size)
+  , m_parent(parent)
+  , m_parent_size(parent_size)
+{
+}
+
+bo_kmq::backing::
+~backing()
+{
+  // Taken over by a new BO
+  if (!m_bo)
+    return;
+
+  shim_debug("Freeing pooled KMQ BO, drm_bo=%d, size=%ld", m_bo->m_handle, m_size);
+  if (m_bo->m_map_offset != AMDXDNA_INVALID_ADDR) {
+    m_pdev.munmap(m_aligned, m_size);
+    if (m_parent)
+      m_pdev.munmap(m_parent, m_parent_size);
+  }
+  m_bo.reset();
+}
+
 bo_kmq::
 bo_kmq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
-  size_t size, uint64_t flags)
-  : bo_kmq(device, ctx_id, size, flags, flag_to_type(flags))
+  size_t size, uint64_t flags, pool* bo_pool)
+  : bo_kmq(device, ctx_id, size, flags, flag_to_type(flags), bo_pool)
 {
   if (m_type == AMDXDNA_BO_INVALID)
     shim_err(EINVAL, "Invalid BO flags: 0x%lx", flags);
@@ -90,43 +163,72 @@ bo_kmq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
 
 bo_kmq::
 bo_kmq(const device& device, size_t size, amdxdna_bo_type type)
-  : bo_kmq(device, AMDXDNA_INVALID_CTX_HANDLE, size, 0, type)
+  : bo_kmq(device, AMDXDNA_INVALID_CTX_HANDLE, size, 0, type, nullptr)
 {
 }
 
 bo_kmq::
 bo_kmq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
-  size_t size, uint64_t flags, amdxdna_bo_type type)
+  size_t size, uint64_t flags, amdxdna_bo_type type, pool* bo_pool)
   : bo(device, ctx_id, size, flags, type)
+  // Dev heap is small and only grows, a cached dev BO holds heap space
+  // the next heap allocation could use, and size class rounding wastes it
+  , m_pool(type == AMDXDNA_BO_DEV ? nullptr : bo_pool)
+  , m_size(size)
 {
   size_t align = 0;
 
   if (m_type == AMDXDNA_BO_DEV_HEAP)
     align = 64 * 1024 * 1024; // Device mem heap must align at 64MB boundary.
 
-  alloc_bo();
-  mmap_bo(align);
+  alloc_and_map(device, align);
 
   // Newly allocated buffer may contain dirty pages. If used as output buffer,
   // the data in cacheline will be flushed onto memory and pollute the output
   // from device. We perform a cache flush right after the BO is allocated to
   // avoid this issue.
-  if (m_type == AMDXDNA_BO_SHMEM)
+  if (m_type == AMDXDNA_BO_SHMEM) {
     sync(direction::host2device, size, 0);
+  }
 
   attach_to_ctx();
 
-  shim_debug("Allocated KMQ BO (userptr=0x%lx, size=%ld, flags=0x%llx, type=%d, drm_bo=%d)",
+  shim_debug("Allocated KMQ BO (userptr=%p, size=%ld, flags=0x%lx, type=%d, drm_bo=%d)",
     m_aligned, m_aligned_size, m_flags, m_type, get_drm_bo_handle());
 }
 
+bo_kmq::slab::
+slab(const device& device, size_t size)
+  : m_backing(std::make_unique<bo_kmq>(device, size, AMDXDNA_BO_SHMEM))
+  , m_alloc(size)
+{
+}
+
+bo_kmq::
+bo_kmq(const device& device, std::shared_ptr<slab> slab, size_t offset,
+  size_t size, uint64_t flags)
+  : bo(device, AMDXDNA_INVALID_CTX_HANDLE, size, flags, AMDXDNA_BO_SHMEM)
+  , m_slab(std::move(slab))
+  , m_slab_offset(offset)
+{
+  m_bo = m_slab->m_backing->m_bo;
+  m_aligned = static_cast<char *>(m_slab->m_backing->m_aligned) + offset;
+
+  // Block may hold data of a previous sub-BO, hand it out as clean as a new BO
+  std::memset(m_aligned, 0, size);
+  sync(direction::host2device, size, 0);
+
+  shim_debug("Allocated KMQ sub-BO (userptr=%p, size=%ld, flags=0x%lx, drm_bo=%d, offset=0x%lx)",
+    m_aligned, m_aligned_size, m_flags, get_drm_bo_handle(), m_slab_offset);
+}
+
 bo_kmq::
 bo_kmq(const device& device, xrt_core::shared_handle::export_handle ehdl)
   : bo(device, ehdl)
 {
   import_bo();
   mmap_bo();
-  shim_debug("Imported KMQ BO (userptr=0x%lx, size=%ld, flags=0x%llx, type=%d, drm_bo=%d)",
+  shim_debug("Imported KMQ BO (userptr=%p, size=%ld, flags=0x%lx, type=%d, drm_bo=%d)",
     m_aligned, m_aligned_size, m_flags, m_type, get_drm_bo_handle());
 }
 
@@ -135,6 +237,23 @@ bo_kmq::
 {
   shim_debug("Freeing KMQ BO, %s", describe().c_str());
 
+  if (m_tracking == write_tracking::soft_dirty) {
+    std::lock_guard<std::mutex> lg(soft_dirty_bos_lock);
+    soft_dirty_bos.erase(this);
+  }
+  // Template holds the DRM BO, drop it before BO is recycled or freed
+  try {
+    destroy_cmd_template();
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to destroy cmd template: %s", e.what());
+  }
+  if (m_slab) {
+    std::lock_guard<std::mutex> lg(m_slab->m_lock);
+    m_slab->m_alloc.free(m_slab_offset);
+    return;
+  }
+  if (recycle())
+    return;
   munmap_bo();
   try {
     detach_from_ctx();
@@ -145,12 +264,126 @@ bo_kmq::
   }
 }
 
+void
+bo_kmq::
+alloc_dev_or_shmem_bo(const device& device)
+{
+  auto& pdev = static_cast<const pdev_kmq&>(m_pdev);
+
+  if (m_type == AMDXDNA_BO_DEV)
+    pdev.create_dev_heap(device);
+
+  for (;;) {
+    auto seen = pdev.get_dev_heap_segments();
+    try {
+      alloc_bo();
+      return;
+    } catch (const xrt_core::system_error& ex) {
+      if (m_type != AMDXDNA_BO_DEV || ex.get_code() != ENOSPC)
+        throw;
+      if (pdev.grow_dev_heap(device, seen))
+        continue;
+      if (!is_dev_bo_shmem_fallback())
+        throw;
+    }
+
+    auto heap = query_dev_heap(m_pdev);
+    shim_debug("Dev heap can't fit %ld bytes (%d segments, free %lld, largest free %lld, %d BOs), "
+      "falling back to SHMEM BO", m_aligned_size, heap.num_segments, heap.free_bytes,
+      heap.largest_free, heap.node_count);
+    m_type = AMDXDNA_BO_SHMEM;
+    alloc_bo();
+    return;
+  }
+}
+
+void
+bo_kmq::
+alloc_and_map(const device& device, size_t align)
+{
+  if (!m_pool) {
+    alloc_dev_or_shmem_bo(device);
+    mmap_bo(align);
+    return;
+  }
+
+  m_aligned_size = pool::size_class(m_aligned_size);
+  if (auto b = m_pool->get(m_flags, m_aligned_size)) {
+    auto& bk = *b;
+    m_bo = std::move(bk->m_bo);
+    m_aligned = bk->m_aligned;
+    m_parent = bk->m_parent;
+    m_parent_size = bk->m_parent_size;
+    // Hand it out as clean as a new BO, not with data of its previous user
+    if (m_aligned)
+      std::memset(m_aligned, 0, m_size);
+    shim_debug("Recycled KMQ BO from pool, drm_bo=%d", get_drm_bo_handle());
+    return;
+  }
+
+  try {
+    alloc_dev_or_shmem_bo(device);
+    mmap_bo(align);
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ENOMEM)
+      throw;
+    // Memory pressure, give cached BOs back and try once more
+    shim_debug("Out of memory, trimming BO pool");
+    if (m_bo)
+      munmap_bo();
+    free_bo();
+    m_aligned = m_parent = nullptr;
+    m_pool->trim();
+    alloc_dev_or_shmem_bo(device);
+    mmap_bo(align);
+  }
+}
+
+bo::properties
+bo_kmq::
+get_properties() const
+{
+  auto props = bo::get_properties();
+
+  if (m_pool)
+    props.size = m_size;
+  return props;
+}
+
+uint64_t
+bo_kmq::
+get_paddr() const
+{
+  // Sub-BO shares device address of its slab
+  if (m_slab && m_bo->m_xdna_addr != AMDXDNA_INVALID_ADDR)
+    return m_bo->m_xdna_addr + m_slab_offset;
+  return bo::get_paddr();
+}
+
+bool
+bo_kmq::
+recycle()
+{
+  // Exported BO may still be used by importer. BO fallen back to SHMEM
+  // should not be handed out again as a dev BO.
+  if (!m_pool || m_exported || m_owner_ctx_id != AMDXDNA_INVALID_CTX_HANDLE ||
+    m_type != flag_to_type(m_flags))
+    return false;
+
+  auto b = std::make_unique<backing>(m_pdev, std::move(m_bo), m_aligned, m_aligned_size,
+    m_parent, m_parent_size);
+  // Entry is freed on return if pool does not take it
+  if (!m_pool->put(m_flags, m_aligned_size, std::move(b)))
+    shim_debug("BO pool is full, freeing BO");
+  return true;
+}
+
 void
 bo_kmq::
 sync(direction dir, size_t size, size_t offset)
 {
   if (is_driver_sync()) {
-    sync_drm_bo(m_pdev, get_drm_bo_handle(), dir, offset, size);
+    sync_drm_bo(m_pdev, get_drm_bo_handle(), dir, m_slab_offset + offset, size);
     return;
   }
 
@@ -160,11 +393,11 @@ sync(direction dir, size_t size, size_t offset)
   switch (m_type) {
   case AMDXDNA_BO_SHMEM:
   case AMDXDNA_BO_CMD:
-    clflush_data(m_aligned, offset, size); 
+    flush_cpu_cache(dir, size, offset);
     break;
   case AMDXDNA_BO_DEV:
     if (m_owner_ctx_id == AMDXDNA_INVALID_CTX_HANDLE)
-      clflush_data(m_aligned, offset, size); 
+      flush_cpu_cache(dir, size, offset);
     else
       sync_drm_bo(m_pdev, get_drm_bo_handle(), dir, offset, size);
     break;
@@ -173,22 +406,100 @@ sync(direction dir, size_t size, size_t offset)
   }
 }
 
+void
+bo_kmq::
+flush_cpu_cache(direction dir, size_t size, size_t offset)
+{
+  if (m_tracking == write_tracking::off) {
+    clflush_data(m_aligned, offset, size, dir);
+    return;
+  }
+
+  if (m_tracking == write_tracking::soft_dirty)
+    collect_and_clear_soft_dirty();
+
+  std::lock_guard<std::mutex> lg(m_dirty_lock);
+  if (dir == direction::host2device) {
+    m_dirty.take(offset, size, [this, dir] (size_t off, size_t len) {
+      clflush_data(m_aligned, off, len, dir);
+    });
+    return;
+  }
+  // Evicting the range writes back all dirty lines in it as well
+  clflush_data(m_aligned, offset, size, dir);
+  m_dirty.take(offset, size, [] (size_t, size_t) {});
+}
+
+void
+bo_kmq::
+set_write_tracking(write_tracking mode)
+{
+  if (mode == write_tracking::soft_dirty && !soft_dirty::supported()) {
+    shim_debug("Soft-dirty tracking not supported by kernel, tracking disabled");
+    mode = write_tracking::off;
+  }
+
+  std::lock_guard<std::mutex> lg(soft_dirty_bos_lock);
+  if (mode == write_tracking::soft_dirty)
+    soft_dirty_bos.insert(this);
+  else
+    soft_dirty_bos.erase(this);
+
+  // Pages may have been written before tracking starts, play safe
+  std::lock_guard<std::mutex> dlg(m_dirty_lock);
+  m_dirty.clear();
+  if (mode != write_tracking::off)
+    m_dirty.add(0, m_aligned_size);
+  m_tracking = mode;
+}
+
+void
+bo_kmq::
+mark_dirty(size_t offset, size_t len)
+{
+  if (offset + len > m_aligned_size)
+    shim_err(EINVAL, "Invalid BO offset and size for marking dirty: %ld, %ld", offset, len);
+
+  std::lock_guard<std::mutex> lg(m_dirty_lock);
+  if (m_tracking != write_tracking::off)
+    m_dirty.add(offset, len);
+}
+
+size_t
+bo_kmq::
+get_dirty_bytes()
+{
+  std::lock_guard<std::mutex> lg(m_dirty_lock);
+  return m_dirty.bytes();
+}
+
+void
+bo_kmq::
+collect_soft_dirty()
+{
+  std::lock_guard<std::mutex> lg(m_dirty_lock);
+  size_t pgsz = getpagesize();
+
+  if (!soft_dirty::for_each_dirty_page(m_aligned, m_aligned_size,
+    [this, pgsz] (size_t off) { m_dirty.add(off, pgsz); }))
+    m_dirty.add(0, m_aligned_size);
+}
+
 void
 bo_kmq::
 bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size)
 {
   auto boh = reinterpret_cast<const bo_kmq*>(bh);
-  std::lock_guard<std::mutex> lg(m_args_map_lock);
 
   if (m_type != AMDXDNA_BO_CMD)
     shim_err(EINVAL, "Can't call bind_at() on non-cmd BO");
 
   if (!pos)
-    m_args_map.clear();
+    m_args.clear();
 
   if (boh->get_type() != AMDXDNA_BO_CMD) {
     auto h = boh->get_drm_bo_handle();
-    m_args_map[pos] = h;
+    m_args.set(pos, h);
     shim_debug("Added arg BO %d to cmd BO %d", h, get_drm_bo_handle());
   } else {
     const size_t max_args_order = 6;
@@ -196,12 +507,10 @@ bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size)
     size_t key = pos << max_args_order;
     uint32_t hs[max_args];
     auto arg_cnt = boh->get_arg_bo_handles(hs, max_args);
-    std::string bohs;
     for (int i = 0; i < arg_cnt; i++) {
-      m_args_map[key + i] = hs[i];
-      bohs += std::to_string(hs[i]) + " ";
+      m_args.set(key + i, hs[i]);
+      shim_debug("Added arg BO %d to cmd BO %d", hs[i], get_drm_bo_handle());
     }
-    shim_debug("Added arg BO %s to cmd BO %d", bohs.c_str(), get_drm_bo_handle());
   }
 }
 
@@ -209,16 +518,83 @@ uint32_t
 bo_kmq::
 get_arg_bo_handles(uint32_t *handles, size_t num) const
 {
-  std::lock_guard<std::mutex> lg(m_args_map_lock);
-
-  auto sz = m_args_map.size();
+  auto sz = m_args.size();
   if (sz > num)
     shim_err(E2BIG, "There are %ld BO args, provided buffer can hold only %ld", sz, num);
 
-  for (auto m : m_args_map)
-    *(handles++) = m.second;
+  uint32_t cnt = 0;
+  for (auto& a : m_args) {
+    // Sub-BOs of one slab share the DRM BO, pass it only once
+    if (std::find(handles, handles + cnt, a.handle) == handles + cnt)
+      handles[cnt++] = a.handle;
+  }
+
+  return cnt;
+}
+
+uint32_t
+bo_kmq::
+get_cmd_template(bool& created)
+{
+  // Assuming 1024 max args per cmd bo
+  const size_t max_arg_bos = 1024;
+  uint32_t hdls[max_arg_bos];
+
+  created = false;
+  auto cnt = get_arg_bo_handles(hdls, max_arg_bos);
+  if (m_tmpl_hdl && std::equal(hdls, hdls + cnt, m_tmpl_args.begin(), m_tmpl_args.end(),
+    [this] (uint32_t h, const std::pair<uint32_t, uint32_t>& a) {
+      return h == a.first && m_pdev.get_bo_close_gen(h) == a.second;
+    }))
+    return m_tmpl_hdl;
+
+  // Generations are read before the template looks handles up, a close
+  // racing with us only costs a re-create on next call
+  destroy_cmd_template();
+  m_tmpl_args.clear();
+  for (uint32_t i = 0; i < cnt; i++)
+    m_tmpl_args.emplace_back(hdls[i], m_pdev.get_bo_close_gen(hdls[i]));
+  amdxdna_drm_create_cmd_tmpl ct = {
+    .args = reinterpret_cast<uintptr_t>(hdls),
+    .cmd_handle = get_drm_bo_handle(),
+    .arg_count = cnt,
+  };
+  m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CREATE_CMD_TMPL, &ct);
+  m_tmpl_hdl = ct.handle;
+  created = true;
+  shim_debug("Created cmd template %d for cmd BO %d with %d arg BOs",
+    m_tmpl_hdl, get_drm_bo_handle(), cnt);
+  return m_tmpl_hdl;
+}
+
+std::unique_lock<std::mutex>
+bo_kmq::
+lock_cmd_template()
+{
+  return std::unique_lock<std::mutex>(m_tmpl_lock);
+}
 
-  return sz;
+void
+bo_kmq::
+destroy_cmd_template()
+{
+  if (!m_tmpl_hdl)
+    return;
+
+  amdxdna_drm_destroy_cmd_tmpl dt = { .handle = m_tmpl_hdl };
+  m_tmpl_hdl = 0;
+  m_tmpl_args.clear();
+  m_pdev.ioctl(DRM_IOCTL_AMDXDNA_DESTROY_CMD_TMPL, &dt);
+}
+
+std::unique_ptr<xrt_core::shared_handle>
+bo_kmq::
+share() const
+{
+  // Exporting the DRM BO would expose the whole slab
+  if (m_slab)
+    shim_not_supported_err("Sharing sub-BO");
+  return bo::share();
 }
 
 } // namespace shim_xdna
@@ -5,17 +5,58 @@
 #define _BO_KMQ_H_
 
 #include "../bo.h"
+#include "../arg_bo_list.h"
+#include "../bo_pool.h"
+#include "../dirty_range.h"
+#include "../slab_allocator.h"
 #include "drm_local/amdxdna_accel.h"
 
 #include <set>
+#include <utility>
 
 namespace shim_xdna {
 
 class bo_kmq : public bo {
 public:
-  bo_kmq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
+  // DRM BO and its CPU mapping, kept in BO pool after bo_kmq is freed.
+  // Freed for real when evicted from the pool.
+  class backing {
+  public:
+    backing(const pdev& pdev, std::shared_ptr<drm_bo> bo, void *aligned, size_t size,
+      void *parent, size_t parent_size);
+
+    ~backing();
+
+    const pdev& m_pdev;
+    std::shared_ptr<drm_bo> m_bo;
+    void* m_aligned;
+    size_t m_size;
+    void* m_parent;
+    size_t m_parent_size;
+  };
+
+  using pool = bo_pool<std::unique_ptr<backing>>;
+
+  // Large SHMEM BO which small BOs are carved out of. Sub-BOs share its
+  // DRM BO, so a command refers to one GEM object for all of them.
+  class slab {
+  public:
+    slab(const device& device, size_t size);
+
+    std::unique_ptr<bo_kmq> m_backing;
+    slab_allocator m_alloc;
+    std::mutex m_lock;
+  };
+
+  // Sub-BO of size bytes at offset of slab
+  bo_kmq(const device& device, std::shared_ptr<slab> slab, size_t offset,
     size_t size, uint64_t flags);
 
+  // BO is allocated at size class of size and recycled through bo_pool
+  // if bo_pool is given.
+  bo_kmq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
+    size_t size, uint64_t flags, pool* bo_pool = nullptr);
+
   bo_kmq(const device& device, xrt_core::shared_handle::export_handle ehdl);
 
   ~bo_kmq();
@@ -26,6 +67,46 @@ public:
   void
   bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size) override;
 
+  properties
+  get_properties() const override;
+
+  std::unique_ptr<xrt_core::shared_handle>
+  share() const override;
+
+  // How host writes are tracked so that host2device sync only flushes
+  // what has been written since last sync. Tracking is off for every BO
+  // until its owner opts in, since only the owner knows it will report
+  // all of its writes.
+  //
+  // soft_dirty costs a pagemap read of every soft-dirty BO plus a process
+  // wide clear_refs on each sync, which write protects all pages of the
+  // process again. A write to any soft-dirty BO landing between collecting
+  // the bits and clearing them is missed, so no such BO may be written
+  // while another thread syncs.
+  enum class write_tracking {
+    off,        // flush the whole requested range
+    manual,     // only ranges passed to mark_dirty()
+    soft_dirty, // pages reported dirty by kernel soft-dirty tracking
+  };
+
+  void
+  set_write_tracking(write_tracking mode);
+
+  // Record host writes to [offset, offset + len) in manual tracking mode
+  void
+  mark_dirty(size_t offset, size_t len);
+
+  write_tracking
+  get_write_tracking() const
+  {
+    return m_tracking;
+  }
+
+  // Bytes written since last host2device sync covering them, as far as
+  // tracking knows. Soft-dirty pages are only collected on sync.
+  size_t
+  get_dirty_bytes();
+
 public:
   // Support BO creation from internal
   bo_kmq(const device& device, size_t size, amdxdna_bo_type type);
@@ -34,13 +115,72 @@ public:
   uint32_t
   get_arg_bo_handles(uint32_t *handles, size_t num) const;
 
+  // Driver command template of this cmd BO and its arg BOs, created again
+  // when arg BOs have changed or any of their handles was closed since last
+  // call. Sets created if it is a new one.
+  // Template holds references to its arg BOs in driver. An arg BO freed by
+  // user stays allocated and pinned until the template is created again on
+  // next call, or destroyed with this cmd BO.
+  // Caller holds lock_cmd_template() till the template is submitted.
+  uint32_t
+  get_cmd_template(bool& created);
+
+  // Issue command may run on many threads with the same cmd BO, the lock
+  // keeps the template from being re-created under a submission using it
+  std::unique_lock<std::mutex>
+  lock_cmd_template();
+
+  // Move kernel soft-dirty pages into dirty ranges before bits are cleared
+  void
+  collect_soft_dirty();
+
 private:
   bo_kmq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
-    size_t size, uint64_t flags, amdxdna_bo_type type);
+    size_t size, uint64_t flags, amdxdna_bo_type type, pool* bo_pool);
+
+  // AMDXDNA_BO_DEV grows device heap by one segment when it can't fit, and
+  // may fall back to SHMEM BO once the heap can't grow anymore
+  void
+  alloc_dev_or_shmem_bo(const device& device);
+
+  // Alloc and map DRM BO, or take one from BO pool
+  void
+  alloc_and_map(const device& device, size_t align);
+
+  // Hand DRM BO and mapping over to BO pool, returns false if not poolable
+  bool
+  recycle();
+
+  void
+  flush_cpu_cache(direction dir, size_t size, size_t offset);
+
+  uint64_t
+  get_paddr() const override;
+
+  void
+  destroy_cmd_template();
+
+  // Only for AMDXDNA_BO_CMD type. Like the run owning it, a command BO is
+  // bound and submitted by one thread at a time, no lock is taken.
+  arg_bo_list m_args;
+
+  // Only for AMDXDNA_BO_CMD type, protected by m_tmpl_lock
+  std::mutex m_tmpl_lock;
+  uint32_t m_tmpl_hdl = 0;
+  // Arg BO handles of template with their close generation at creation
+  std::vector<std::pair<uint32_t, uint32_t>> m_tmpl_args;
+
+  write_tracking m_tracking = write_tracking::off;
+  dirty_range m_dirty;
+  std::mutex m_dirty_lock;
+
+  pool* m_pool = nullptr;
+  // Size asked for, BO from pool is allocated at its size class
+  size_t m_size = 0;
 
-  // Only for AMDXDNA_BO_CMD type
-  std::map<size_t, uint32_t> m_args_map;
-  mutable std::mutex m_args_map_lock;
+  // Only for sub-BO
+  std::shared_ptr<slab> m_slab;
+  size_t m_slab_offset = 0;
 };
 
 } // namespace shim_xdna
@@ -5,12 +5,43 @@
 #include "device.h"
 #include "hwctx.h"
 #include "drm_local/amdxdna_accel.h"
+#include "core/common/config_reader.h"
+
+namespace {
+
+// Bytes of freed BOs kept for reuse, 0 disables BO pool
+size_t
+get_bo_pool_max_bytes()
+{
+  static size_t max_bytes = xrt_core::config::detail::get_uint_value("Debug.bo_pool_max_bytes", 0);
+  return max_bytes;
+}
+
+// Host only BOs up to this size are carved out of shared slabs, 0 disables it
+size_t
+get_bo_slab_max_size()
+{
+  static size_t max_size = xrt_core::config::detail::get_uint_value("Debug.bo_slab_max_size", 0);
+  return max_size;
+}
+
+const size_t slab_size = 1024 * 1024;
+
+bool
+is_host_only_bo(uint64_t flags)
+{
+  auto boflags = (static_cast<uint32_t>(xcl_bo_flags{flags}.boflags) << 24);
+  return boflags == XCL_BO_FLAGS_NONE || boflags == XCL_BO_FLAGS_HOST_ONLY;
+}
+
+}
 
 namespace shim_xdna {
 
 device_kmq::
 device_kmq(const pdev& pdev, handle_type shim_handle, id_type device_id)
 : device(pdev, shim_handle, device_id)
+, m_bo_pool(get_bo_pool_max_bytes())
 {
   shim_debug("Created KMQ device (%s) ...", get_pdev().m_sysfs_name.c_str());
 }
@@ -18,7 +49,16 @@ device_kmq(const pdev& pdev, handle_type shim_handle, id_type device_id)
 device_kmq::
 ~device_kmq()
 {
-  shim_debug("Destroying KMQ device (%s) ...", get_pdev().m_sysfs_name.c_str());
+  auto s = m_bo_pool.stats();
+  shim_debug("Destroying KMQ device (%s), BO pool hits %ld misses %ld evictions %ld ...",
+    get_pdev().m_sysfs_name.c_str(), s.hits, s.misses, s.evictions);
+}
+
+bo_pool_stats
+device_kmq::
+get_bo_pool_stats() const
+{
+  return m_bo_pool.stats();
 }
 
 std::unique_ptr<xrt_core::hwctx_handle>
@@ -36,9 +76,70 @@ alloc_bo(void* userptr, xrt_core::hwctx_handle::slot_id ctx_id,
   if (userptr)
     shim_not_supported_err("User ptr BO");;
 
+  if (ctx_id == AMDXDNA_INVALID_CTX_HANDLE && is_host_only_bo(flags) &&
+    size <= std::min(get_bo_slab_max_size(), slab_allocator::chunk_size)) {
+    auto sub_bo = alloc_sub_bo(size, flags);
+    if (sub_bo)
+      return sub_bo;
+  }
+
+  // BO owned by a context is attached to it in driver, not worth pooling
+  if (m_bo_pool.enabled() && ctx_id == AMDXDNA_INVALID_CTX_HANDLE)
+    return std::make_unique<bo_kmq>(*this, ctx_id, size, flags, &m_bo_pool);
   return std::make_unique<bo_kmq>(*this, ctx_id, size, flags);
 }
 
+std::unique_ptr<xrt_core::buffer_handle>
+device_kmq::
+alloc_sub_bo(size_t size, uint64_t flags)
+{
+  std::lock_guard<std::mutex> lg(m_slabs_lock);
+
+  release_empty_slabs();
+
+  auto try_alloc = [size] (bo_kmq::slab& s) {
+    std::lock_guard<std::mutex> slg(s.m_lock);
+    return s.m_alloc.alloc(size);
+  };
+
+  for (auto& s : m_slabs) {
+    if (auto off = try_alloc(*s))
+      return std::make_unique<bo_kmq>(*this, s, *off, size, flags);
+  }
+
+  // All slabs are full. Fall back to a standalone BO if a new one can't be had.
+  std::shared_ptr<bo_kmq::slab> s;
+  try {
+    s = std::make_shared<bo_kmq::slab>(*this, slab_size);
+  } catch (const xrt_core::system_error& ex) {
+    shim_debug("Failed to alloc BO slab: %s", ex.what());
+    return nullptr;
+  }
+  m_slabs.push_back(s);
+  return std::make_unique<bo_kmq>(*this, s, *try_alloc(*s), size, flags);
+}
+
+void
+device_kmq::
+release_empty_slabs()
+{
+  bool spare = false;
+
+  for (auto it = m_slabs.begin(); it != m_slabs.end();) {
+    bool empty;
+    {
+      std::lock_guard<std::mutex> slg((*it)->m_lock);
+      empty = (*it)->m_alloc.empty();
+    }
+    if (empty && spare) {
+      it = m_slabs.erase(it);
+      continue;
+    }
+    spare = spare || empty;
+    ++it;
+  }
+}
+
 std::unique_ptr<xrt_core::buffer_handle>
 device_kmq::
 import_bo(xrt_core::shared_handle::export_handle ehdl) const
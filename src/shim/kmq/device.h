@@ -4,6 +4,7 @@
 #ifndef _DEVICE_KMQ_H_
 #define _DEVICE_KMQ_H_
 
+#include "bo.h"
 #include "../device.h"
 #include "core/common/memalign.h"
 
@@ -19,6 +20,10 @@ public:
   alloc_bo(void* userptr, xrt_core::hwctx_handle::slot_id ctx_id,
     size_t size, uint64_t flags) override;
 
+  // Hit/miss counters and usage of the freed BO cache
+  bo_pool_stats
+  get_bo_pool_stats() const;
+
 protected:
   std::unique_ptr<xrt_core::hwctx_handle>
   create_hw_context(const device& dev, const xrt::xclbin& xclbin,
@@ -26,6 +31,23 @@ protected:
 
   std::unique_ptr<xrt_core::buffer_handle>
   import_bo(xrt_core::shared_handle::export_handle ehdl) const override;
+
+private:
+  // Carve a small BO out of a slab, nullptr if no slab can be allocated
+  std::unique_ptr<xrt_core::buffer_handle>
+  alloc_sub_bo(size_t size, uint64_t flags);
+
+  // Give empty slabs back, but keep one for the next small BO.
+  // Caller holds m_slabs_lock.
+  void
+  release_empty_slabs();
+
+  bo_kmq::pool m_bo_pool;
+
+  // Slabs live until they are found empty while allocating a sub-BO, the
+  // device is closed, or the last sub-BO in them is freed after that
+  std::mutex m_slabs_lock;
+  std::vector<std::shared_ptr<bo_kmq::slab>> m_slabs;
 };
 
 } // namespace shim_xdna
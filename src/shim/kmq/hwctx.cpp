@@ -3,6 +3,7 @@
 
 #include "hwctx.h"
 #include "hwq.h"
+#include "pcidev.h"
 #include "../bo.h"
 
 #include "core/common/config_reader.h"
@@ -29,6 +30,8 @@ hw_ctx_kmq::
 hw_ctx_kmq(const device& device, const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos)
   : hw_ctx(device, qos, std::make_unique<hw_q_kmq>(device), xclbin)
 {
+  // Driver maps device heap to the context when it is created
+  static_cast<const pdev_kmq&>(device.get_pdev()).create_dev_heap(device);
   hw_ctx::create_ctx_on_device();
 
   auto cu_info = get_cu_info();
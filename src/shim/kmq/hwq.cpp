@@ -4,6 +4,29 @@
 #include "bo.h"
 #include "hwq.h"
 
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+// Must match driver limits on one batched EXEC_CMD
+const size_t max_cmds_per_submit = 256;
+const size_t max_args_per_submit = 4095;
+
+// Driver leaves seq of a batched command alone if it is not submitted
+const uint64_t unsubmitted_seq = ~0ULL;
+
+// Submit single commands through driver command templates, so that arg BOs
+// are not looked up again each time the same command is submitted
+bool
+use_cmd_template()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.cmd_template", false);
+  return enabled;
+}
+
+}
+
 namespace shim_xdna {
 
 hw_q_kmq::
@@ -16,6 +39,8 @@ hw_q_kmq::
 ~hw_q_kmq()
 {
   shim_debug("Destroying KMQ HW queue");
+  if (m_completion_fd >= 0)
+    close(m_completion_fd);
 }
 
 void
@@ -25,6 +50,12 @@ issue_command(xrt_core::buffer_handle *cmd_bo)
   // Assuming 1024 max args per cmd bo
   const size_t max_arg_bos = 1024;
 
+  if (use_cmd_template()) {
+    bool created;
+    submit_template(cmd_bo, created);
+    return;
+  }
+
   uint32_t arg_bo_hdls[max_arg_bos];
   auto boh = static_cast<bo_kmq*>(cmd_bo);
   uint32_t cmd_bo_hdl = boh->get_drm_bo_handle();
@@ -39,17 +70,226 @@ issue_command(xrt_core::buffer_handle *cmd_bo)
   };
   m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
 
-  auto id = ecmd.seq;
-  boh->set_cmd_id(id);
+  uint64_t id = ecmd.seq;
+  set_cmd_id(boh, id);
   shim_debug("Submitted command (%ld)", id);
 }
 
+uint64_t
+hw_q_kmq::
+submit_template(xrt_core::buffer_handle *cmd_bo, bool& created)
+{
+  auto boh = static_cast<bo_kmq*>(cmd_bo);
+  auto lk = boh->lock_cmd_template();
+
+  amdxdna_drm_exec_cmd ecmd = {
+    .hwctx = m_hwctx->get_slotidx(),
+    .type = AMDXDNA_CMD_SUBMIT_TEMPLATE,
+    .cmd_handles = boh->get_cmd_template(created),
+    .cmd_count = 1,
+  };
+  m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+
+  uint64_t id = ecmd.seq;
+  set_cmd_id(boh, id);
+  shim_debug("Submitted command (%ld) through template %lld", id, ecmd.cmd_handles);
+  return id;
+}
+
+void
+hw_q_kmq::
+submit_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos,
+  std::vector<uint64_t>& seqs)
+{
+  // Assuming 1024 max args per cmd bo
+  const size_t max_arg_bos = 1024;
+
+  std::vector<amdxdna_drm_exec_cmd_entry> entries;
+  std::vector<uint32_t> arg_bo_hdls;
+  std::vector<bo_kmq*> bos;
+
+  // No point to pack more commands than the context can hold in flight
+  auto window = std::min<size_t>(max_cmds_per_submit, m_hwctx->get_max_cmds());
+
+  auto first = seqs.size();
+  seqs.reserve(first + cmd_bos.size());
+  entries.reserve(std::min(cmd_bos.size(), window));
+
+  auto flush = [&] () {
+    if (entries.empty())
+      return;
+
+    amdxdna_drm_exec_cmd ecmd = {
+      .hwctx = m_hwctx->get_slotidx(),
+      .type = AMDXDNA_CMD_SUBMIT_EXEC_BUF,
+      .cmd_handles = reinterpret_cast<uintptr_t>(entries.data()),
+      .args = reinterpret_cast<uintptr_t>(arg_bo_hdls.data()),
+      .cmd_count = static_cast<uint32_t>(entries.size()),
+      .arg_count = static_cast<uint32_t>(arg_bo_hdls.size()),
+    };
+    // Single command goes through the legacy path taking the handle by value
+    if (entries.size() == 1)
+      ecmd.cmd_handles = entries[0].handle;
+    try {
+      m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+    } catch (const xrt_core::system_error& ex) {
+      // Driver stops at the first command it fails to submit, the ones
+      // before it are running and get their seq back as usual
+      for (size_t i = 0; i < entries.size() && entries[i].seq != unsubmitted_seq; i++) {
+        set_cmd_id(bos[i], entries[i].seq);
+        seqs.push_back(entries[i].seq);
+      }
+      shim_err(ex.get_code(), "Submitted %zu of %zu commands: %s",
+        seqs.size() - first, cmd_bos.size(), ex.what());
+    }
+    if (entries.size() == 1)
+      entries[0].seq = ecmd.seq;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+      set_cmd_id(bos[i], entries[i].seq);
+      seqs.push_back(entries[i].seq);
+    }
+    shim_debug("Submitted %ld commands (%lld - %lld)",
+      entries.size(), entries.front().seq, entries.back().seq);
+    entries.clear();
+    arg_bo_hdls.clear();
+    bos.clear();
+  };
+
+  for (auto cmd_bo : cmd_bos) {
+    auto boh = static_cast<bo_kmq*>(cmd_bo);
+    auto off = arg_bo_hdls.size();
+
+    arg_bo_hdls.resize(off + max_arg_bos);
+    auto cnt = boh->get_arg_bo_handles(arg_bo_hdls.data() + off, max_arg_bos);
+    arg_bo_hdls.resize(off + cnt);
+
+    if (entries.size() == window || arg_bo_hdls.size() > max_args_per_submit) {
+      std::vector<uint32_t> hdls(arg_bo_hdls.begin() + off, arg_bo_hdls.end());
+      arg_bo_hdls.resize(off);
+      flush();
+      arg_bo_hdls = std::move(hdls);
+    }
+
+    entries.push_back({ .handle = boh->get_drm_bo_handle(), .arg_count = cnt, .seq = unsubmitted_seq });
+    bos.push_back(boh);
+  }
+  flush();
+}
+
+size_t
+hw_q_kmq::
+wait_commands(const std::vector<xrt_core::buffer_handle *>& cmds, wait_mode mode,
+  uint32_t timeout_ms, std::vector<bool>& done) const
+{
+  std::vector<amdxdna_wait_cmd_entry> entries;
+  std::vector<size_t> pending;
+  size_t ncompleted = 0;
+
+  done.assign(cmds.size(), false);
+  for (size_t i = 0; i < cmds.size(); i++) {
+    if (poll_command(cmds[i])) {
+      done[i] = true;
+      ncompleted++;
+      continue;
+    }
+    auto boh = static_cast<bo_kmq*>(cmds[i]);
+    entries.push_back({ .hwctx = m_hwctx->get_slotidx(), .signaled = 0, .seq = boh->get_cmd_id() });
+    pending.push_back(i);
+  }
+  if (entries.empty() || (mode == wait_mode::any && ncompleted))
+    return ncompleted;
+  if (entries.size() > AMDXDNA_MAX_WAIT_CMDS)
+    shim_err(EINVAL, "Too many commands to wait: %ld", entries.size());
+
+  amdxdna_drm_wait_cmds wcmds = {
+    .entries = reinterpret_cast<uintptr_t>(entries.data()),
+    .count = static_cast<uint32_t>(entries.size()),
+    .flags = mode == wait_mode::all ? AMDXDNA_WAIT_CMDS_ALL : 0u,
+    .timeout = timeout_ms,
+  };
+  try {
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_WAIT_CMDS, &wcmds);
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ETIME)
+      throw;
+  }
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (!entries[i].signaled)
+      continue;
+    done[pending[i]] = true;
+    ncompleted++;
+  }
+  shim_debug("Waited %ld cmds, %ld completed", cmds.size(), ncompleted);
+  return ncompleted;
+}
+
 void
 hw_q_kmq::
 bind_hwctx(const hw_ctx *ctx)
 {
   // link hwctx by parent class
   hw_q::bind_hwctx(ctx);
+
+  // Context is created again, e.g. on xclbin reload, keep the same eventfd
+  std::lock_guard<std::mutex> lg(m_completion_fd_lock);
+  if (m_completion_fd >= 0)
+    assign_completion_fd(m_completion_fd);
+}
+
+void
+hw_q_kmq::
+assign_completion_fd(int fd)
+{
+  amdxdna_drm_config_hwctx arg = {};
+  arg.handle = m_hwctx->get_slotidx();
+  arg.param_type = DRM_AMDXDNA_HWCTX_ASSIGN_EVENTFD;
+  arg.param_val = static_cast<uint64_t>(fd);
+  m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CONFIG_HWCTX, &arg);
+  shim_debug("Assigned completion eventfd %d to HW context %d", fd, arg.handle);
+}
+
+int
+hw_q_kmq::
+get_completion_fd()
+{
+  std::lock_guard<std::mutex> lg(m_completion_fd_lock);
+
+  if (m_completion_fd >= 0)
+    return m_completion_fd;
+  if (!m_hwctx)
+    shim_err(EINVAL, "HW queue is not bound to HW context");
+
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fd < 0)
+    shim_err(errno, "Failed to create eventfd");
+
+  try {
+    assign_completion_fd(fd);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+
+  m_completion_fd = fd;
+  return m_completion_fd;
+}
+
+uint64_t
+hw_q_kmq::
+read_completions()
+{
+  uint64_t cnt = 0;
+
+  if (m_completion_fd < 0)
+    return 0;
+  if (read(m_completion_fd, &cnt, sizeof(cnt)) != static_cast<ssize_t>(sizeof(cnt))) {
+    if (errno == EAGAIN)
+      return 0;
+    shim_err(errno, "Failed to read completion eventfd");
+  }
+  return cnt;
 }
 
 } // shim_xdna
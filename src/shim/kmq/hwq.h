@@ -6,6 +6,8 @@
 
 #include "../hwq.h"
 
+#include <mutex>
+
 namespace shim_xdna {
 
 class hw_q_kmq : public hw_q
@@ -16,10 +18,50 @@ public:
   ~hw_q_kmq();
 
   void
-  bind_hwctx(const hw_ctx *ctx);
+  bind_hwctx(const hw_ctx *ctx) override;
 
   void
   issue_command(xrt_core::buffer_handle *) override;
+
+  // Submit all command BOs with as few EXEC_CMD ioctls as possible
+  void
+  submit_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos,
+    std::vector<uint64_t>& seqs) override;
+
+  // Submit a command BO through its driver command template, see
+  // bo_kmq::get_cmd_template(). Returns the sequence number of the command,
+  // created tells whether the template was created for this submission.
+  uint64_t
+  submit_template(xrt_core::buffer_handle *cmd_bo, bool& created);
+
+  enum class wait_mode { any, all };
+
+  // Wait on a set of submitted commands with one syscall. done[i] is set
+  // for each completed command. Returns number of completed commands,
+  // which is 0 if nothing completed before timeout. Only KMQ cmd ids are
+  // driver seqs, UMQ ones are queue slots.
+  size_t
+  wait_commands(const std::vector<xrt_core::buffer_handle *>& cmds, wait_mode mode,
+    uint32_t timeout_ms, std::vector<bool>& done) const;
+
+  // Non-blocking eventfd which becomes readable when commands of this queue
+  // complete, for epoll/io_uring based callers. Created on first call, needs
+  // the queue to be bound to a HW context. Owned by the queue, and assigned
+  // again to the HW context the queue is bound to later.
+  int
+  get_completion_fd();
+
+  // Number of completions since last call, 0 if none. Caller finds out
+  // which commands completed with poll_command().
+  uint64_t
+  read_completions();
+
+private:
+  void
+  assign_completion_fd(int fd);
+
+  std::mutex m_completion_fd_lock;
+  int m_completion_fd = -1;
 };
 
 } // shim_xdna
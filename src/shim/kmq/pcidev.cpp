@@ -7,7 +7,8 @@
 
 namespace {
 
-// Device memory heap needs to be within one 64MB page. The maximum size is 64MB.
+// Each device memory heap segment needs to be within one 64MB page.
+// The maximum size of a segment is 64MB.
 const size_t dev_mem_size = (64 << 20);
 
 }
@@ -31,25 +32,54 @@ std::shared_ptr<xrt_core::device>
 pdev_kmq::
 create_device(xrt_core::device::handle_type handle, xrt_core::device::id_type id) const
 {
-  auto dev = std::make_shared<device_kmq>(*this, handle, id);
+  // Device heap is not allocated here, processes only doing queries
+  // do not need it.
+  return std::make_shared<device_kmq>(*this, handle, id);
+}
+
+void
+pdev_kmq::
+create_dev_heap(const device& dev) const
+{
+  // Driver returning EBUSY means the heap exists already
+  grow_dev_heap(dev, 0);
+}
+
+size_t
+pdev_kmq::
+get_dev_heap_segments() const
+{
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+  return m_dev_heap_bos.size();
+}
+
+bool
+pdev_kmq::
+grow_dev_heap(const device& dev, size_t seen) const
+{
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+
+  if (m_dev_heap_bos.size() != seen)
+    return true;
+
   try {
-    // Alloc device memory on first device creation.
-    // No locking is needed since driver will ensure only one heap BO is created.
-    if (m_dev_heap_bo == nullptr)
-      m_dev_heap_bo = std::make_unique<bo_kmq>(*dev, dev_mem_size, AMDXDNA_BO_DEV_HEAP);
+    m_dev_heap_bos.push_back(std::make_unique<bo_kmq>(dev, dev_mem_size, AMDXDNA_BO_DEV_HEAP));
   } catch (const xrt_core::system_error& ex) {
+    // Driver has all the segments it can take
     if (ex.get_code() != EBUSY)
       throw;
+    return false;
   }
-  return dev;
+  shim_debug("Created dev heap segment %ld", m_dev_heap_bos.size() - 1);
+  return true;
 }
 
 void
 pdev_kmq::
 on_last_close() const
 {
-  m_dev_heap_bo.reset();
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+  m_dev_heap_bos.clear();
 }
 
 } // namespace shim_xdna
-
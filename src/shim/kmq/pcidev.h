@@ -6,9 +6,14 @@
 
 #include "../pcidev.h"
 
+#include <mutex>
+#include <vector>
+
 
 namespace shim_xdna {
 
+class device;
+
 class pdev_kmq : public pdev
 {
 public:
@@ -18,9 +23,25 @@ public:
   std::shared_ptr<xrt_core::device>
   create_device(xrt_core::device::handle_type handle, xrt_core::device::id_type id) const override;
 
+  // Device heap is created on first need, see create_dev_heap()
+  size_t
+  get_dev_heap_segments() const;
+
+  // Create first device heap segment if there is none yet. Called before
+  // first AMDXDNA_BO_DEV allocation and first HW context creation.
+  void
+  create_dev_heap(const device& dev) const;
+
+  // Add a device heap segment, unless someone else did since the caller saw
+  // seen segments. Returns false if driver can't take more segments.
+  bool
+  grow_dev_heap(const device& dev, size_t seen) const;
+
 private:
-  // Create on first device creation and removed right before device is closed
-  mutable std::unique_ptr<xrt_core::buffer_handle> m_dev_heap_bo;
+  // First segment is created on first need, the others when device BO
+  // can't fit. All removed right before device is closed.
+  mutable std::mutex m_dev_heap_lock;
+  mutable std::vector<std::unique_ptr<xrt_core::buffer_handle>> m_dev_heap_bos;
 
   virtual void
   on_last_close() const override;
@@ -6,7 +6,9 @@
 #include "pcidrv.h"
 #include "shim_debug.h"
 #include "drm_local/amdxdna_accel.h"
+#include "core/common/config_reader.h"
 #include "core/common/trace.h"
+#include <chrono>
 
 namespace {
 
@@ -30,6 +32,12 @@ namespace {
       return "DRM_IOCTL_AMDXDNA_EXEC_CMD";
     case DRM_IOCTL_AMDXDNA_WAIT_CMD:
       return "DRM_IOCTL_AMDXDNA_WAIT_CMD";
+    case DRM_IOCTL_AMDXDNA_WAIT_CMDS:
+      return "DRM_IOCTL_AMDXDNA_WAIT_CMDS";
+    case DRM_IOCTL_AMDXDNA_CREATE_CMD_TMPL:
+      return "DRM_IOCTL_AMDXDNA_CREATE_CMD_TMPL";
+    case DRM_IOCTL_AMDXDNA_DESTROY_CMD_TMPL:
+      return "DRM_IOCTL_AMDXDNA_DESTROY_CMD_TMPL";
     case DRM_IOCTL_AMDXDNA_GET_INFO:
       return "DRM_IOCTL_AMDXDNA_GET_INFO";
     case DRM_IOCTL_AMDXDNA_SET_STATE:
@@ -46,6 +54,8 @@ namespace {
       return "DRM_IOCTL_SYNCOBJ_QUERY";
     case DRM_IOCTL_SYNCOBJ_DESTROY:
       return "DRM_IOCTL_SYNCOBJ_DESTROY";
+    case DRM_IOCTL_SYNCOBJ_RESET:
+      return "DRM_IOCTL_SYNCOBJ_RESET";
     case DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD:
       return "DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD";
     case DRM_IOCTL_SYNCOBJ_FD_TO_HANDLE:
@@ -59,6 +69,41 @@ namespace {
     return "UNKNOWN(" + std::to_string(cmd) + ")";
   }
 
+  // Syncobjs of freed fences kept for reuse, 0 disables fence pool
+  size_t
+  get_fence_pool_size()
+  {
+    static size_t size = xrt_core::config::detail::get_uint_value("Debug.fence_pool_size", 0);
+    return size;
+  }
+
+  // Collect ioctl stats and print them when device goes away at exit
+  bool
+  get_ioctl_stats_enabled()
+  {
+    static bool enabled = xrt_core::config::detail::get_bool_value("Debug.ioctl_stats", false);
+    return enabled;
+  }
+
+  void
+  print_ioctl_stats(const std::vector<shim_xdna::ioctl_stat>& stats)
+  {
+    for (auto& s : stats) {
+      std::string hist;
+      for (size_t b = 0; b < s.hist.size(); b++) {
+        if (!s.hist[b])
+          continue;
+        if (b == s.hist.size() - 1)
+          hist += " >=" + std::to_string(1ULL << (b - 1)) + "ns:";
+        else
+          hist += " <" + std::to_string(1ULL << b) + "ns:";
+        hist += std::to_string(s.hist[b]);
+      }
+      shim_info("%s: %ld calls, avg %ldns,%s", ioctl_cmd2name(s.cmd).c_str(),
+        s.count, s.total_ns / s.count, hist.c_str());
+    }
+  }
+
 }
 
 namespace shim_xdna {
@@ -66,6 +111,7 @@ namespace shim_xdna {
 pdev::
 pdev(std::shared_ptr<const drv> driver, std::string sysfs_name)
   : xrt_core::pci::dev(driver, std::move(sysfs_name))
+  , m_syncobj_pool(get_fence_pool_size())
 {
   m_is_ready = true; // We're always ready.
 }
@@ -75,6 +121,8 @@ pdev::
 {
   if (m_dev_fd != -1)
     shim_debug("Device node fd leaked!! fd=%d", m_dev_fd);
+  if (get_ioctl_stats_enabled())
+    print_ioctl_stats(m_ioctl_stats.snapshot());
 }
 
 xrt_core::device::handle_type
@@ -117,6 +165,11 @@ close() const
   if (m_dev_users == 0) {
     on_last_close();
 
+    // Pooled syncobjs go away with the fd
+    auto s = m_syncobj_pool.stats();
+    shim_debug("Fence pool hits %ld misses %ld", s.hits, s.misses);
+    m_syncobj_pool.clear();
+
     // Stop new users of the fd from other threads.
     fd = m_dev_fd;
     m_dev_fd = -1;
@@ -126,15 +179,56 @@ close() const
   }
 }
 
+syncobj_pool&
+pdev::
+get_syncobj_pool() const
+{
+  return m_syncobj_pool;
+}
+
 void
 pdev::
 ioctl(unsigned long cmd, void* arg) const
 {
   XRT_TRACE_POINT_SCOPE2(ioctl, cmd, arg);
-  if (xrt_core::pci::dev::ioctl(m_dev_fd, cmd, arg) == -1)
+  int ret;
+
+  if (get_ioctl_stats_enabled()) {
+    auto start = std::chrono::steady_clock::now();
+    ret = xrt_core::pci::dev::ioctl(m_dev_fd, cmd, arg);
+    auto err = errno;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    m_ioctl_stats.record(cmd, ns);
+    errno = err;
+  } else {
+    ret = xrt_core::pci::dev::ioctl(m_dev_fd, cmd, arg);
+  }
+  if (ret == -1)
     shim_err(errno, "%s IOCTL failed", ioctl_cmd2name(cmd).c_str());
 }
 
+std::vector<ioctl_stat>
+pdev::
+get_ioctl_stats() const
+{
+  return m_ioctl_stats.snapshot();
+}
+
+uint32_t
+pdev::
+get_bo_close_gen(uint32_t handle) const
+{
+  return m_bo_close_gen[handle % bo_close_gens].load(std::memory_order_acquire);
+}
+
+void
+pdev::
+note_bo_close(uint32_t handle) const
+{
+  m_bo_close_gen[handle % bo_close_gens].fetch_add(1, std::memory_order_release);
+}
+
 void*
 pdev::
 mmap(void *addr, size_t len, int prot, int flags, off_t offset) const
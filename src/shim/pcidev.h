@@ -4,11 +4,16 @@
 #ifndef PCIDEV_XDNA_H
 #define PCIDEV_XDNA_H
 
+#include "ioctl_stats.h"
 #include "shim_debug.h"
+#include "syncobj_pool.h"
 
 #include "core/pcie/linux/device_linux.h"
 #include "core/pcie/linux/pcidev.h"
 
+#include <array>
+#include <atomic>
+
 namespace shim_xdna {
 
 // Forward declaration
@@ -43,6 +48,25 @@ public:
   void
   close() const;
 
+  // Syncobjs of destroyed fences for reuse, see fence.cpp
+  syncobj_pool&
+  get_syncobj_pool() const;
+
+  // Per command call count and latency histogram of ioctls from all
+  // threads. Empty unless Debug.ioctl_stats is set in xrt.ini.
+  std::vector<ioctl_stat>
+  get_ioctl_stats() const;
+
+  // Close generation of a BO handle. Closed handle may be given to a new
+  // BO, so anything caching the handle in driver is stale once its
+  // generation changes. Handles share a fixed number of generations, closing
+  // one may make caches of another stale too, which only costs a refresh.
+  uint32_t
+  get_bo_close_gen(uint32_t handle) const;
+
+  void
+  note_bo_close(uint32_t handle) const;
+
 private:
   virtual void
   on_first_open() const {}
@@ -52,6 +76,10 @@ private:
   mutable int m_dev_fd = -1;
   mutable int m_dev_users = 0;
   mutable std::mutex m_lock;
+  mutable syncobj_pool m_syncobj_pool;
+  mutable ioctl_stats m_ioctl_stats;
+  static constexpr size_t bo_close_gens = 1024;
+  mutable std::array<std::atomic<uint32_t>, bo_close_gens> m_bo_close_gen = {};
 };
 
 } // namespace shim_xdna
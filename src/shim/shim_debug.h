@@ -4,28 +4,55 @@
 #ifndef SHIM_DEBUG_H
 #define SHIM_DEBUG_H
 
+#include "shim_log.h"
+
 #include "core/common/error.h"
 #include "core/common/debug.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <memory>
+#include <string>
 #include <unistd.h>
 
 namespace {
 
+// snprintf() which takes a message without arguments as is
+template <typename ...Args>
+int
+shim_format(char *buf, size_t size, const char* fmt, Args&&... args)
+{
+  if constexpr (sizeof...(Args) == 0)
+    return std::snprintf(buf, size, "%s", fmt);
+  else
+    return std::snprintf(buf, size, fmt, args ...);
+}
+
 template <typename ...Args>
 [[ noreturn ]] void
 shim_err(int err, const char* fmt, Args&&... args)
 {
-  std::string format = std::string(fmt);
-  format += " (err=%d)";
-  int sz = std::snprintf(nullptr, 0, format.c_str(), args ..., err) + 1;
-  if(sz <= 0)
-    throw xrt_core::system_error(sz, "could not format error string");
-
-  auto size = static_cast<size_t>(sz);
-  std::unique_ptr<char[]> buf(new char[size]);
-  std::snprintf(buf.get(), size, format.c_str(), args ..., err);
-  throw xrt_core::system_error(err, std::string(buf.get()));
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), " (err=%d)", err);
+
+  // Most messages fit on stack, only format twice for the long ones.
+  // The message string is the only allocation, the exception keeps it.
+  char sbuf[256];
+  int sz = shim_format(sbuf, sizeof(sbuf), fmt, args ...);
+  if (sz < 0)
+    throw xrt_core::system_error(err, "could not format error string");
+
+  std::string msg;
+  msg.reserve(static_cast<size_t>(sz) + sizeof(suffix));
+  if (static_cast<size_t>(sz) < sizeof(sbuf)) {
+    msg.assign(sbuf, static_cast<size_t>(sz));
+  } else {
+    msg.resize(static_cast<size_t>(sz));
+    shim_format(msg.data(), msg.size() + 1, fmt, args ...);
+  }
+  msg += suffix;
+  throw xrt_core::system_error(err, msg);
 }
 
 [[ noreturn ]] inline void
@@ -34,28 +61,39 @@ shim_not_supported_err(const char* msg)
   shim_err(ENOTSUP, msg);
 }
 
-template <typename ...Args>
-void
-shim_debug(const char* fmt, Args&&... args)
+}
+
+namespace shim_xdna {
+
+// Logger of the shim. Level is Debug.shim_log_level in xrt.ini, 0 for off,
+// 1 for error, 2 for info and 3 for debug. Debug build logs everything by
+// default. Queued messages are written out at exit.
+inline logger&
+shim_logger()
 {
+  static logger *lg = [] {
 #ifdef XDNA_SHIM_DEBUG
-  std::string format = "PID(%d): ";
-  format += std::string(fmt);
-  format += "\n";
-  XRT_PRINTF(format.c_str(), getpid(), std::forward<Args>(args)...);
+    const auto def = log_level::debug;
+#else
+    const auto def = log_level::info;
 #endif
+    auto level = xrt_core::config::detail::get_uint_value("Debug.shim_log_level",
+      static_cast<unsigned int>(def));
+    level = std::min(level, static_cast<unsigned int>(log_level::debug));
+    // Never freed, threads may still log while statics go away at exit
+    auto l = new logger(static_cast<log_level>(level));
+    std::atexit([] { shim_logger().flush(); });
+    return l;
+  }();
+  return *lg;
 }
 
-template <typename ...Args>
-void
-shim_info(const char* fmt, Args&&... args)
-{
-  std::string format = "PID(%d): ";
-  format += std::string(fmt);
-  format += "\n";
-  XRT_PRINTF(format.c_str(), getpid(), std::forward<Args>(args)...);
-}
+} // shim_xdna
 
-}
+#define shim_debug(fmt, ...) \
+  XDNA_LOG(shim_xdna::shim_logger(), shim_xdna::log_level::debug, fmt, ##__VA_ARGS__)
+
+#define shim_info(fmt, ...) \
+  XDNA_LOG(shim_xdna::shim_logger(), shim_xdna::log_level::info, fmt, ##__VA_ARGS__)
 
 #endif // SHIM_DEBUG_H
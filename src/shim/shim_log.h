@@ -0,0 +1,367 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _SHIM_LOG_XDNA_H_
+#define _SHIM_LOG_XDNA_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace shim_xdna {
+
+enum class log_level : int { off = 0, error, info, debug };
+
+struct log_entry
+{
+  log_level level;
+  pid_t tid;
+  char msg[248];
+};
+
+// Single producer, single consumer ring of log entries of one thread.
+// Entries are dropped, not waited for, if the ring is full.
+class log_ring
+{
+public:
+  static constexpr size_t slots = 256;
+
+  log_ring()
+    : m_tid(static_cast<pid_t>(syscall(SYS_gettid)))
+  {}
+
+  // Producer side, nullptr if full
+  log_entry *
+  reserve()
+  {
+    auto head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) >= slots) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    auto e = &m_entries[head % slots];
+    e->tid = m_tid;
+    return e;
+  }
+
+  void
+  commit()
+  {
+    m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumer side
+  template <typename Func>
+  size_t
+  drain(Func&& func)
+  {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    auto head = m_head.load(std::memory_order_acquire);
+    size_t n = head - tail;
+
+    for (; tail != head; tail++)
+      func(m_entries[tail % slots]);
+    m_tail.store(tail, std::memory_order_release);
+    return n;
+  }
+
+  uint64_t
+  dropped() const
+  {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+  bool
+  empty() const
+  {
+    return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_relaxed);
+  }
+
+private:
+  const pid_t m_tid;
+  std::array<log_entry, slots> m_entries;
+  alignas(64) std::atomic<uint64_t> m_head = 0;
+  alignas(64) std::atomic<uint64_t> m_tail = 0;
+  std::atomic<uint64_t> m_dropped = 0;
+};
+
+// Leveled logger which does not allocate on the logging thread.
+// Debug messages are formatted into a ring of the calling thread and
+// written out by a drain thread, so that they can stay on in hot paths.
+// Errors and info are rare and written out right away, which keeps them in
+// order with whatever the process prints around them.
+// Use XDNA_LOG() so that arguments are not even evaluated if the level is
+// off, which makes a disabled message cost one relaxed load and a branch.
+// Loggers survive fork(), the child starts over with its own drain thread
+// and drops what the parent had queued, the parent writes that out.
+class logger
+{
+public:
+  using sink_type = std::function<void(const log_entry&)>;
+
+  logger(log_level level, sink_type sink = print_entry,
+    std::chrono::milliseconds interval = std::chrono::milliseconds(10))
+    : m_level(static_cast<int>(level))
+    , m_sink(std::move(sink))
+    , m_interval(interval)
+    , m_id(next_id())
+  {
+    auto& reg = fork_registry();
+    std::lock_guard<std::mutex> lg(reg.lock);
+    reg.loggers.push_back(this);
+  }
+
+  ~logger()
+  {
+    {
+      auto& reg = fork_registry();
+      std::lock_guard<std::mutex> lg(reg.lock);
+      reg.loggers.erase(std::find(reg.loggers.begin(), reg.loggers.end(), this));
+    }
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_drainer)
+      m_drainer->join();
+    flush();
+  }
+
+  bool
+  enabled(log_level level) const
+  {
+    return static_cast<int>(level) <= m_level.load(std::memory_order_relaxed);
+  }
+
+  void
+  set_level(log_level level)
+  {
+    m_level.store(static_cast<int>(level), std::memory_order_relaxed);
+  }
+
+  __attribute__((format(printf, 3, 4)))
+  void
+  write(log_level level, const char *fmt, ...)
+  {
+    va_list ap;
+
+    if (level != log_level::debug) {
+      log_entry e = { level, 0, {} };
+      va_start(ap, fmt);
+      std::vsnprintf(e.msg, sizeof(e.msg), fmt, ap);
+      va_end(ap);
+      e.tid = static_cast<pid_t>(syscall(SYS_gettid));
+      std::lock_guard<std::mutex> lg(m_sink_lock);
+      m_sink(e);
+      return;
+    }
+
+    auto& ring = local();
+    auto e = ring.reserve();
+    if (!e)
+      return;
+    e->level = level;
+    va_start(ap, fmt);
+    std::vsnprintf(e->msg, sizeof(e->msg), fmt, ap);
+    va_end(ap);
+    ring.commit();
+  }
+
+  // Write out queued messages of all threads
+  void
+  flush()
+  {
+    std::vector<std::shared_ptr<log_ring>> rings;
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      rings = m_rings;
+    }
+
+    std::lock_guard<std::mutex> lg(m_sink_lock);
+    for (auto& r : rings)
+      r->drain(m_sink);
+  }
+
+  // Messages lost to full rings
+  uint64_t
+  dropped() const
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    uint64_t n = m_dead_dropped;
+    for (auto& r : m_rings)
+      n += r->dropped();
+    return n;
+  }
+
+  static void
+  print_entry(const log_entry& e)
+  {
+    std::printf("PID(%d) TID(%d): %s\n", getpid(), e.tid, e.msg);
+  }
+
+private:
+  struct tls_entry
+  {
+    uint64_t id;
+    std::shared_ptr<log_ring> ring;
+  };
+
+  // Loggers alive in the process, so that fork() can take their locks
+  struct registry
+  {
+    std::mutex lock;
+    std::vector<logger *> loggers;
+  };
+
+  static uint64_t
+  next_id()
+  {
+    static std::atomic<uint64_t> id = 0;
+    return ++id;
+  }
+
+  static registry&
+  fork_registry()
+  {
+    // Never freed, like the shim logger which may outlive statics
+    static registry *reg = [] {
+      pthread_atfork(before_fork, after_fork_in_parent, after_fork_in_child);
+      return new registry;
+    }();
+    return *reg;
+  }
+
+  // Nobody is in the middle of logging while the process forks, so that
+  // the child does not inherit locks held by threads it does not have
+  static void
+  before_fork()
+  {
+    auto& reg = fork_registry();
+    reg.lock.lock();
+    for (auto l : reg.loggers) {
+      l->m_lock.lock();
+      l->m_sink_lock.lock();
+    }
+  }
+
+  static void
+  after_fork_in_parent()
+  {
+    auto& reg = fork_registry();
+    for (auto l : reg.loggers) {
+      l->m_sink_lock.unlock();
+      l->m_lock.unlock();
+    }
+    reg.lock.unlock();
+  }
+
+  static void
+  after_fork_in_child()
+  {
+    auto& reg = fork_registry();
+    for (auto l : reg.loggers) {
+      // Drain thread is gone, its handle can neither be joined nor detached,
+      // and the condition variable may still count it as waiter.
+      // Rings belong to threads which are gone as well, except the forking
+      // one, which finds its ring stale by the new id and gets a new one.
+      l->m_drainer.release();
+      new (&l->m_cv) std::condition_variable;
+      l->m_rings.clear();
+      l->m_id = next_id();
+      l->m_sink_lock.unlock();
+      l->m_lock.unlock();
+    }
+    reg.lock.unlock();
+  }
+
+  log_ring&
+  local()
+  {
+    // Threads usually log to one logger, look up is linear
+    thread_local std::vector<tls_entry> tls;
+    auto id = m_id;
+
+    for (auto& t : tls) {
+      if (t.id == id)
+        return *t.ring;
+    }
+
+    auto ring = std::make_shared<log_ring>();
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_rings.push_back(ring);
+      if (!m_drainer)
+        m_drainer = std::make_unique<std::thread>(&logger::drain, this);
+    }
+    tls.push_back({ id, ring });
+    return *ring;
+  }
+
+  // Ring of an exited thread is only referenced here, free it once drained.
+  // A concurrent flush() holding a reference just defers it to next round.
+  void
+  release_dead_rings()
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    auto it = std::stable_partition(m_rings.begin(), m_rings.end(),
+      [] (const std::shared_ptr<log_ring>& r) { return r.use_count() > 1 || !r->empty(); });
+    for (auto r = it; r != m_rings.end(); r++)
+      m_dead_dropped += (*r)->dropped();
+    m_rings.erase(it, m_rings.end());
+  }
+
+  void
+  drain()
+  {
+    std::unique_lock<std::mutex> lk(m_lock);
+    while (!m_stop) {
+      m_cv.wait_for(lk, m_interval);
+      lk.unlock();
+      flush();
+      release_dead_rings();
+      lk.lock();
+    }
+  }
+
+  std::atomic<int> m_level;
+  const sink_type m_sink;
+  const std::chrono::milliseconds m_interval;
+  // Tells rings of this logger in thread local storage apart, new after fork
+  uint64_t m_id;
+
+  // Protecting rings and drain thread state
+  mutable std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::vector<std::shared_ptr<log_ring>> m_rings;
+  std::unique_ptr<std::thread> m_drainer;
+  uint64_t m_dead_dropped = 0;
+  bool m_stop = false;
+
+  // Serializing output
+  std::mutex m_sink_lock;
+};
+
+} // shim_xdna
+
+#define XDNA_LOG(lg, level, fmt, ...)               \
+  do {                                              \
+    if ((lg).enabled(level))                        \
+      (lg).write(level, fmt, ##__VA_ARGS__);        \
+  } while (0)
+
+#endif // _SHIM_LOG_XDNA_H_
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _SHIM_QUERY_XDNA_H_
+#define _SHIM_QUERY_XDNA_H_
+
+#include "bo_pool.h"
+#include "ioctl_stats.h"
+#include "syncobj_pool.h"
+
+#include "core/common/query_requests.h"
+#include "core/common/shim/buffer_handle.h"
+#include "core/common/shim/fence_handle.h"
+#include "core/common/shim/hwqueue_handle.h"
+
+#include <any>
+#include <cstdint>
+#include <vector>
+
+// Query requests only this shim knows about, for tools and shim_test to
+// reach shim features which have no call in xrt_core interfaces.
+// Use them with xrt_core::device_query<>() like any other request.
+namespace shim_xdna::query {
+
+using key_type = xrt_core::query::key_type;
+
+// Well above any key defined by XRT
+constexpr unsigned int key_base = 0x8000;
+
+// Submit command BOs to a HW queue with as few ioctls as possible.
+// Failing to submit a command is no error of the query, the commands before
+// it are submitted and can be waited on.
+struct submit_commands : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::hwqueue_handle *hwq;
+    std::vector<xrt_core::buffer_handle *> cmds;
+  };
+  struct result_type
+  {
+    // Sequence number of each submitted command, in the same order
+    std::vector<uint64_t> seqs;
+    // 0 if all are submitted, else errno of command seqs.size()
+    int error;
+  };
+  static const key_type key = static_cast<key_type>(key_base + 0);
+
+  static const char*
+  name()
+  {
+    return "shim_submit_commands";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Hit/miss counters and usage of the freed BO cache of a KMQ device
+struct bo_pool_stats : xrt_core::query::request
+{
+  using result_type = shim_xdna::bo_pool_stats;
+  static const key_type key = static_cast<key_type>(key_base + 1);
+
+  static const char*
+  name()
+  {
+    return "shim_bo_pool_stats";
+  }
+
+  std::any
+  get(const xrt_core::device*) const override = 0;
+};
+
+// Eventfd of a KMQ HW queue which becomes readable on command completion
+struct completion_fd : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::hwqueue_handle *hwq;
+  };
+  using result_type = int;
+  static const key_type key = static_cast<key_type>(key_base + 2);
+
+  static const char*
+  name()
+  {
+    return "shim_completion_fd";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Wait on a set of submitted commands of a KMQ HW queue with one syscall.
+// Returns whether each command is done, in the same order. Timing out is
+// no error, commands not done by then are false. Fails with EOPNOTSUPP on
+// UMQ HW queue.
+struct wait_commands : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::hwqueue_handle *hwq;
+    std::vector<xrt_core::buffer_handle *> cmds;
+    bool wait_all;
+    uint32_t timeout_ms;
+  };
+  using result_type = std::vector<bool>;
+  static const key_type key = static_cast<key_type>(key_base + 3);
+
+  static const char*
+  name()
+  {
+    return "shim_wait_commands";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Call counts and latency histograms of ioctls on the device, summed up
+// over all threads. Empty unless Debug.ioctl_stats is set in xrt.ini.
+struct ioctl_stats : xrt_core::query::request
+{
+  using result_type = std::vector<shim_xdna::ioctl_stat>;
+  static const key_type key = static_cast<key_type>(key_base + 4);
+
+  static const char*
+  name()
+  {
+    return "shim_ioctl_stats";
+  }
+
+  std::any
+  get(const xrt_core::device*) const override = 0;
+};
+
+// Submit a command BO to a KMQ HW queue through its driver command template,
+// whether or not Debug.cmd_template is set. Tells whether the template was
+// created for this submission or reused.
+struct submit_template : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::hwqueue_handle *hwq;
+    xrt_core::buffer_handle *cmd;
+  };
+  struct result_type
+  {
+    uint64_t seq;
+    bool created;
+  };
+  static const key_type key = static_cast<key_type>(key_base + 5);
+
+  static const char*
+  name()
+  {
+    return "shim_submit_template";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Set how host writes to a KMQ BO are tracked, so that host2device sync
+// only flushes what is written, see bo_kmq::write_tracking. Mode is 0 for
+// off, 1 for manual and 2 for soft-dirty. Returns the mode in effect,
+// soft-dirty falls back to off if kernel does not support it.
+struct bo_write_tracking : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::buffer_handle *bo;
+    uint32_t mode;
+  };
+  using result_type = uint32_t;
+  static const key_type key = static_cast<key_type>(key_base + 6);
+
+  static const char*
+  name()
+  {
+    return "shim_bo_write_tracking";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Record host writes to [offset, offset + len) of a KMQ BO in manual write
+// tracking mode. Returns bytes of the BO written and not flushed yet, len 0
+// only reads that.
+struct bo_mark_dirty : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::buffer_handle *bo;
+    size_t offset;
+    size_t len;
+  };
+  using result_type = size_t;
+  static const key_type key = static_cast<key_type>(key_base + 7);
+
+  static const char*
+  name()
+  {
+    return "shim_bo_mark_dirty";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Non-blocking check whether a fence has reached the state its next wait
+// would be waiting for. Fence state is not moved forward.
+struct fence_poll : xrt_core::query::request
+{
+  struct args
+  {
+    xrt_core::fence_handle *fence;
+  };
+  using result_type = bool;
+  static const key_type key = static_cast<key_type>(key_base + 8);
+
+  static const char*
+  name()
+  {
+    return "shim_fence_poll";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Wait on many fences at once for all or any of them to be signaled, see
+// fence::wait(). Fence states are not moved forward. Timeout 0 means wait
+// forever. For any-semantics wait, first is the index of a signaled fence.
+struct fence_wait : xrt_core::query::request
+{
+  struct args
+  {
+    std::vector<xrt_core::fence_handle*> fences;
+    bool wait_all;
+    uint32_t timeout_ms;
+  };
+  struct result_type
+  {
+    bool signaled;
+    size_t first;
+  };
+  static const key_type key = static_cast<key_type>(key_base + 9);
+
+  static const char*
+  name()
+  {
+    return "shim_fence_wait";
+  }
+
+  std::any
+  get(const xrt_core::device*, const std::any& args) const override = 0;
+};
+
+// Syncobj pool counters of the device, see Debug.fence_pool_size
+struct fence_pool_stats : xrt_core::query::request
+{
+  using result_type = shim_xdna::syncobj_pool_stats;
+  static const key_type key = static_cast<key_type>(key_base + 10);
+
+  static const char*
+  name()
+  {
+    return "shim_fence_pool_stats";
+  }
+
+  std::any
+  get(const xrt_core::device*) const override = 0;
+};
+
+} // shim_xdna::query
+
+#endif // _SHIM_QUERY_XDNA_H_
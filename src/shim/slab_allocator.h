@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _SLAB_ALLOCATOR_XDNA_H_
+#define _SLAB_ALLOCATOR_XDNA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <vector>
+
+namespace shim_xdna {
+
+// Offset allocator carving small blocks out of one large buffer.
+// The buffer is split into chunks. A chunk serves blocks of one power of two
+// size, which are tracked by a bitmap, and goes back to the free chunks once
+// all of its blocks are freed. Blocks are aligned to their size and never
+// share a cache line. Not thread safe.
+class slab_allocator
+{
+public:
+  static constexpr size_t chunk_size = 4096;
+  static constexpr size_t min_block = 64;
+
+  explicit
+  slab_allocator(size_t size)
+    : m_chunks(size / chunk_size)
+  {
+    for (size_t i = m_chunks.size(); i > 0; i--)
+      m_free_chunks.push_back(i - 1);
+  }
+
+  static size_t
+  block_size(size_t size)
+  {
+    if (size <= min_block)
+      return min_block;
+    return size_t(1) << (64 - __builtin_clzl(size - 1));
+  }
+
+  // Returns offset of the block, or nothing if size is too big or slab is full
+  std::optional<size_t>
+  alloc(size_t size)
+  {
+    auto bs = block_size(size);
+    if (bs > chunk_size)
+      return std::nullopt;
+
+    auto& partial = m_partial[bs];
+    size_t ci;
+    if (!partial.empty()) {
+      ci = *partial.begin();
+    } else {
+      if (m_free_chunks.empty())
+        return std::nullopt;
+      ci = m_free_chunks.back();
+      m_free_chunks.pop_back();
+      m_chunks[ci] = { bs, full_mask(bs) };
+      partial.insert(ci);
+    }
+
+    auto& c = m_chunks[ci];
+    auto bit = __builtin_ctzll(c.free_mask);
+    c.free_mask &= ~(1ULL << bit);
+    if (!c.free_mask)
+      partial.erase(ci);
+    m_used += bs;
+    return ci * chunk_size + bit * bs;
+  }
+
+  void
+  free(size_t offset)
+  {
+    auto ci = offset / chunk_size;
+    auto& c = m_chunks[ci];
+    auto bit = (offset % chunk_size) / c.block;
+
+    if (!c.free_mask)
+      m_partial[c.block].insert(ci);
+    c.free_mask |= 1ULL << bit;
+    m_used -= c.block;
+    if (c.free_mask == full_mask(c.block)) {
+      m_partial[c.block].erase(ci);
+      c = {};
+      m_free_chunks.push_back(ci);
+    }
+  }
+
+  // Bytes handed out, counted in block sizes
+  size_t
+  used() const
+  {
+    return m_used;
+  }
+
+  bool
+  empty() const
+  {
+    return m_used == 0;
+  }
+
+private:
+  struct chunk
+  {
+    size_t block;       // 0 if chunk is free
+    uint64_t free_mask; // bit set for each free block
+  };
+
+  static uint64_t
+  full_mask(size_t block)
+  {
+    auto n = chunk_size / block;
+    return n == 64 ? ~0ULL : (1ULL << n) - 1;
+  }
+
+  std::vector<chunk> m_chunks;
+  std::vector<size_t> m_free_chunks;
+  // Block size -> chunks serving that size which still have free blocks
+  std::map<size_t, std::set<size_t>> m_partial;
+  size_t m_used = 0;
+};
+
+} // shim_xdna
+
+#endif // _SLAB_ALLOCATOR_XDNA_H_
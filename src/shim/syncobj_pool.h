@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _SYNCOBJ_POOL_XDNA_H_
+#define _SYNCOBJ_POOL_XDNA_H_
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace shim_xdna {
+
+struct syncobj_pool_stats
+{
+  uint64_t hits;
+  uint64_t misses;
+  size_t cached_count;
+};
+
+// Syncobj handles of destroyed fences kept for new fences, which saves the
+// create and destroy ioctls. Each entry remembers the last timeline point
+// used on the syncobj, the next fence continues from that point instead of
+// resetting the timeline. Only syncobjs with all used points signaled are
+// put back, see fence::syncobj. Most recently freed is reused first.
+// Handles belong to the device fd, pool must be cleared when fd is closed.
+class syncobj_pool
+{
+public:
+  struct entry
+  {
+    uint32_t handle;
+    uint64_t point;
+  };
+
+  explicit
+  syncobj_pool(size_t max_count)
+    : m_max_count(max_count)
+  {}
+
+  bool
+  enabled() const
+  {
+    return m_max_count != 0;
+  }
+
+  std::optional<entry>
+  get()
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+
+    if (m_free.empty()) {
+      m_misses++;
+      return std::nullopt;
+    }
+    auto e = m_free.back();
+    m_free.pop_back();
+    m_hits++;
+    return e;
+  }
+
+  // Returns false if entry is not taken, the caller should destroy it.
+  bool
+  put(const entry& e)
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+
+    if (m_free.size() >= m_max_count)
+      return false;
+    m_free.push_back(e);
+    return true;
+  }
+
+  // Forget all cached handles, they are gone with the device fd
+  void
+  clear()
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    m_free.clear();
+  }
+
+  syncobj_pool_stats
+  stats() const
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    return { m_hits, m_misses, m_free.size() };
+  }
+
+private:
+  const size_t m_max_count;
+
+  mutable std::mutex m_lock;
+  std::vector<entry> m_free;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+};
+
+} // shim_xdna
+
+#endif // _SYNCOBJ_POOL_XDNA_H_
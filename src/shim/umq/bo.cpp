@@ -55,7 +55,7 @@ bo_umq(const device& device, xrt_core::hwctx_handle::slot_id ctx_id,
   /*TODO: no need if cache coherent */
   sync(direction::host2device, size, 0);
 
-  shim_debug("Allocated UMQ BO for: userptr=0x%lx, size=%ld, flags=0x%llx",
+  shim_debug("Allocated UMQ BO for: userptr=%p, size=%ld, flags=0x%lx",
     m_aligned, m_aligned_size, m_flags);
 }
 
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _HOST_QUEUE_PRODUCER_H_
+#define _HOST_QUEUE_PRODUCER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <x86intrin.h>
+
+#include "host_queue.h"
+#include "../cache_flush.h"
+
+namespace shim_xdna {
+
+// Multi-producer side of a host queue.
+//
+// Producers reserve slots by bumping a shadow write index with CAS, so
+// several threads can fill distinct slots at the same time. The write_index
+// in the shared header is only advanced in slot order once the slot is
+// published, so the consumer never sees a hole in the middle of the queue.
+class host_queue_producer
+{
+public:
+  host_queue_producer(volatile struct host_queue_header *hdr,
+    volatile struct host_queue_packet *pkts)
+    : m_hdr(hdr)
+    , m_pkts(pkts)
+    , m_reserved(hdr->write_index)
+    , m_published(hdr->write_index)
+  {}
+
+  void
+  set_doorbell(volatile uint32_t *doorbell)
+  {
+    m_doorbell = doorbell;
+  }
+
+  // Reserve num consecutive slots starting at slot.
+  // Returns false if the queue is full or read_index is ahead of us.
+  bool
+  try_reserve(uint64_t& slot, uint32_t num = 1)
+  {
+    auto cur = m_reserved.load(std::memory_order_relaxed);
+
+    do {
+      auto rd = m_hdr->read_index;
+      if (cur < rd || cur - rd + num > m_hdr->capacity)
+        return false;
+    } while (!m_reserved.compare_exchange_weak(cur, cur + num,
+      std::memory_order_acquire, std::memory_order_relaxed));
+
+    slot = cur;
+    return true;
+  }
+
+  // Reserve as many of num consecutive slots starting at slot as are free.
+  // Returns how many, 0 if the queue is full or read_index is ahead of us.
+  uint32_t
+  try_reserve_some(uint64_t& slot, uint32_t num)
+  {
+    auto cur = m_reserved.load(std::memory_order_relaxed);
+    uint32_t n;
+
+    do {
+      auto rd = m_hdr->read_index;
+      if (cur < rd || cur - rd >= m_hdr->capacity)
+        return 0;
+      n = static_cast<uint32_t>(std::min<uint64_t>(num, m_hdr->capacity - (cur - rd)));
+    } while (!m_reserved.compare_exchange_weak(cur, cur + n,
+      std::memory_order_acquire, std::memory_order_relaxed));
+
+    slot = cur;
+    return n;
+  }
+
+  // Same as try_reserve(), but waits up to timeout for the consumer to free
+  // a slot. Spins briefly first, then sleeps with exponential backoff since
+  // the consumer does not notify host when read_index moves.
+  bool
+  reserve_wait(uint64_t& slot, std::chrono::microseconds timeout, uint32_t num = 1)
+  {
+    if (num > m_hdr->capacity)
+      return false;
+
+    for (int spin = 0; spin < spin_before_sleep; spin++) {
+      if (try_reserve(slot, num))
+        return true;
+      if (m_hdr->write_index < m_hdr->read_index)
+        return false;
+      _mm_pause();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto backoff = min_backoff;
+    while (!try_reserve(slot, num)) {
+      if (m_hdr->write_index < m_hdr->read_index ||
+        std::chrono::steady_clock::now() >= deadline)
+        return false;
+      std::this_thread::sleep_for(backoff);
+      backoff = std::min(backoff * 2, max_backoff);
+    }
+    return true;
+  }
+
+  // Must be called exactly once for each reservation, after the slots have
+  // been marked valid. Waits for all earlier slots to be published first.
+  void
+  publish(uint64_t slot, uint32_t num = 1)
+  {
+    for (int spin = 0; m_published.load(std::memory_order_acquire) != slot; spin++) {
+      if (spin < spin_before_yield)
+        _mm_pause();
+      else
+        std::this_thread::yield();
+    }
+    m_hdr->write_index = slot + num;
+    m_published.store(slot + num, std::memory_order_release);
+  }
+
+  // Hand num filled slots starting at slot over to the consumer: flush the
+  // payloads, mark all slots valid behind a single fence, publish them and
+  // ring the doorbell once for the whole batch.
+  void
+  send(uint64_t slot, uint32_t num = 1)
+  {
+    for (uint32_t i = 0; i < num; i++) {
+      auto pkt = get_pkt(slot + i);
+      flush(pkt->data, pkt->xrt_header.common_header.count);
+    }
+
+    /* Make sure all writes to the slots before is done */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (uint32_t i = 0; i < num; i++) {
+      auto pkt = get_pkt(slot + i);
+      pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
+      flush(&pkt->xrt_header.common_header, sizeof(pkt->xrt_header.common_header));
+    }
+
+    publish(slot, num);
+
+    /* Wake up CERT */
+    if (m_doorbell) {
+      *m_doorbell = 0;
+      m_doorbell_writes.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  volatile struct host_queue_packet *
+  get_pkt(uint64_t slot) const
+  {
+    return &m_pkts[slot & (m_hdr->capacity - 1)];
+  }
+
+  uint64_t
+  get_doorbell_writes() const
+  {
+    return m_doorbell_writes.load(std::memory_order_relaxed);
+  }
+
+  uint64_t
+  get_published() const
+  {
+    return m_published.load(std::memory_order_acquire);
+  }
+
+private:
+  // flush cache line for non coherence memory. Evict the line as well,
+  // CERT writes back to the same slot once consumed.
+  static void
+  flush(volatile const void *data, size_t len)
+  {
+    flush_range(data, len);
+  }
+
+  static constexpr int spin_before_yield = 64;
+  static constexpr int spin_before_sleep = 1024;
+  static constexpr std::chrono::microseconds min_backoff{1};
+  static constexpr std::chrono::microseconds max_backoff{1000};
+
+  volatile struct host_queue_header *m_hdr;
+  volatile struct host_queue_packet *m_pkts;
+  volatile uint32_t *m_doorbell = nullptr;
+  std::atomic<uint64_t> m_doorbell_writes = 0;
+  // Next slot to hand out, ahead of write_index while slots are being filled
+  alignas(64) std::atomic<uint64_t> m_reserved;
+  // Mirrors write_index, kept separately so waiters do not poll shared memory
+  alignas(64) std::atomic<uint64_t> m_published;
+};
+
+} // shim_xdna
+
+#endif // _HOST_QUEUE_PRODUCER_H_
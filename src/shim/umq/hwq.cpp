@@ -1,25 +1,12 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright (C) 2023-2024, Advanced Micro Devices, Inc. All rights reserved.
 
-#include <x86intrin.h>
 #include "bo.h"
 #include "hwq.h"
 
-namespace {
+#include "core/common/config_reader.h"
 
-// flash cache line for non coherence memory
-inline void
-clflush_data(void *data, int len)
-{
-	const int LINESIZE = 64;
-	const char *cur = (const char *)data;
-	// must be at least one cache line
-	uintptr_t lastline = (uintptr_t)(cur + len - 1) | (LINESIZE - 1);
-	do {
-		_mm_clflush(cur);
-		cur += LINESIZE;
-	} while (cur <= (const char *)lastline);
-}
+namespace {
 
 inline void
 mark_slot_invalid(volatile struct host_queue_packet *pkt)
@@ -27,22 +14,22 @@ mark_slot_invalid(volatile struct host_queue_packet *pkt)
   pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
 }
 
-inline void
-mark_slot_valid(volatile struct host_queue_packet *pkt)
-{
-  /* Issue mfence instruction to make sure all writes to the slot before is done */
-  std::atomic_thread_fence(std::memory_order::memory_order_seq_cst);
-  pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
-  /* must flush this data to make cache coherence */
-  clflush_data((void *)&pkt->xrt_header.common_header, sizeof(pkt->xrt_header.common_header));
-}
-
 inline bool
 is_slot_valid(volatile struct host_queue_packet *pkt)
 {
   return pkt->xrt_header.common_header.type == HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
 }
 
+// How long submitter waits for a free slot on a full queue, 0 means fail
+// immediately with ENOSPC.
+std::chrono::microseconds
+get_full_queue_wait()
+{
+  static const std::chrono::milliseconds wait_ms(
+    xrt_core::config::detail::get_uint_value("Debug.umq_full_queue_wait_ms", 0));
+  return wait_ms;
+}
+
 }
 
 namespace shim_xdna {
@@ -100,6 +87,7 @@ hw_q_umq(const device& dev, size_t nslots) : hw_q(dev)
   m_umq_hdr->capacity = nslots;
   // data_address starts after header
   m_umq_hdr->data_address = m_umq_bo->get_properties().paddr + header_sz;
+  m_producer = std::make_unique<host_queue_producer>(m_umq_hdr, m_umq_pkt);
 
   // indirect buf starts after queue
   m_indirect_paddr = m_umq_hdr->data_address + queue_sz;
@@ -125,6 +113,7 @@ map_doorbell(uint32_t doorbell_offset)
 {
   m_mapped_doorbell = reinterpret_cast<volatile uint32_t *>(
     m_pdev.mmap(0, sizeof(uint32_t), PROT_WRITE, MAP_SHARED, doorbell_offset));
+  m_producer->set_doorbell(m_mapped_doorbell);
 }
 
 volatile struct host_queue_header *
@@ -143,7 +132,7 @@ dump() const
   shim_debug("\tRead Index:\t0x%lx", h->read_index);
   shim_debug("\tWrite Index:\t0x%lx", h->write_index);
   shim_debug("\tCapacity:\t%d", h->capacity);
-  shim_debug("\tData Addr:\t%p", h->data_address);
+  shim_debug("\tData Addr:\t0x%lx", h->data_address);
 
   shim_debug("Dumping UMQ queue slot @%p:", m_umq_pkt);
   for (int i = 0; i < h->capacity; i++) {
@@ -157,7 +146,7 @@ dump() const
     shim_debug("\tcount:\t\t%u", pkt->xrt_header.common_header.count);
     shim_debug("\tdistribute:\t%u", pkt->xrt_header.common_header.distribute);
     shim_debug("\tindirect:\t%u", pkt->xrt_header.common_header.indirect);
-    shim_debug("\tcomplete addr:\t%p", pkt->xrt_header.completion_signal);
+    shim_debug("\tcomplete addr:\t0x%lx", pkt->xrt_header.completion_signal);
     if (pkt->xrt_header.common_header.indirect == 0) {
       volatile struct exec_buf *ebp =
         reinterpret_cast<volatile struct exec_buf *>(pkt->data);
@@ -200,29 +189,40 @@ dump_raw() const
 
 uint64_t
 hw_q_umq::
-reserve_slot()
+reserve_slot(uint32_t num)
 {
   uint64_t cur_slot = 0;
-  bool queue_full = false;
   auto h = get_header_ptr();
+  auto wait = get_full_queue_wait();
+
+  if (m_producer->try_reserve(cur_slot, num))
+    return cur_slot;
+  if (wait.count() && m_producer->reserve_wait(cur_slot, wait, num))
+    return cur_slot;
 
-  std::unique_lock<std::mutex> lock(m_mutex);
   if (h->write_index < h->read_index) {
+    dump();
     shim_err(EINVAL, "Queue read before write! read_index=0x%lx, write_index=0x%lx",
       h->read_index, h->write_index);
-    dump();
-  } else if ((h->write_index - h->read_index) < h->capacity) {
-    cur_slot = h->write_index;
-    h->write_index++;
-  } else {
-    queue_full = true;
   }
-  lock.unlock();
+  if (wait.count())
+    shim_err(ENOSPC, "Queue is still full after %ld us", wait.count());
+  shim_err(ENOSPC, "Queue is full");
+}
+
+uint64_t
+hw_q_umq::
+reserve_slots(uint32_t max, uint32_t& num)
+{
+  uint64_t cur_slot = 0;
 
-  if (queue_full)
-    shim_err(ENOSPC, "Queue is full");
+  num = m_producer->try_reserve_some(cur_slot, max);
+  if (num)
+    return cur_slot;
 
-  return cur_slot;
+  // Nothing is free, wait for a slot the same way a single command does
+  num = 1;
+  return reserve_slot(1);
 }
 
 int
@@ -237,18 +237,19 @@ hw_q_umq::
 get_pkt(uint64_t index)
 {
   auto pkt = &m_umq_pkt[get_pkt_idx(index)];
+  // Slot is reserved already and must be filled, failing here would leave
+  // an invalid packet in the queue which CERT stalls on
   if (is_slot_valid(pkt)) {
-    shim_err(EINVAL, "Slot is ready before use! index=0x%lx", index);
+    shim_info("Slot is ready before use! index=0x%lx", index);
     dump();
   }
   return pkt;
 }
 
-uint64_t
+void
 hw_q_umq::
-issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp)
+fill_exec_buf(uint64_t slot_idx, uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp)
 {
-  auto slot_idx = reserve_slot();
   auto pkt = get_pkt(slot_idx);
   size_t pkt_size;
 
@@ -259,9 +260,19 @@ issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp)
 
   auto hdr = &pkt->xrt_header;
   hdr->common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
+  hdr->common_header.count = pkt_size;
   hdr->completion_signal = comp;
+}
+
+uint64_t
+hw_q_umq::
+issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp)
+{
+  // Nothing may fail past this point, see get_exec_buf()
+  auto slot_idx = reserve_slot(1);
 
-  fill_slot_and_send(pkt, pkt_size);
+  fill_exec_buf(slot_idx, cu_idx, dpu, comp);
+  m_producer->send(slot_idx, 1);
 
   return slot_idx;
 }
@@ -271,16 +282,9 @@ hw_q_umq::
 fill_indirect_exec_buf(uint64_t slot_idx, uint16_t cu_idx,
                         volatile struct host_queue_packet *pkt,
                         ert_dpu_data *dpu) {
+  // Size is checked by get_exec_buf() before the slot is reserved
   auto pkt_size = (dpu->chained + 1) * sizeof(struct host_indirect_packet_entry);
 
-  if (dpu->chained + 1 >= HSA_INDIRECT_PKT_NUM)
-    shim_err(EINVAL, "unsupported indirect number %d, valid number <= %d",
-      dpu->chained + 1, HSA_INDIRECT_PKT_NUM);
-
-  if (pkt_size > sizeof(pkt->data))
-    shim_err(EINVAL, "dpu pkt_size=0x%lx > pkt_data max size=%x%lx",
-      pkt_size, sizeof(pkt->data));
-
   // no need to memset to zero, all buffer will be set
   volatile struct host_indirect_packet_entry *hp =
     reinterpret_cast<volatile struct host_indirect_packet_entry *>(pkt->data);
@@ -320,9 +324,8 @@ hw_q_umq::
 fill_direct_exec_buf(uint16_t cu_idx, volatile struct host_queue_packet *pkt,
                      ert_dpu_data *dpu) {
   auto pkt_size = sizeof(struct exec_buf);
-  if (pkt_size > sizeof(pkt->data))
-    shim_err(EINVAL, "dpu pkt_size=0x%lx > pkt_data max size=%x%lx",
-      pkt_size, sizeof(pkt->data));
+  static_assert(sizeof(struct exec_buf) <= sizeof(host_queue_packet::data),
+    "exec_buf does not fit in HSA packet");
   
   // zero this buffer
   auto data = const_cast<uint32_t *>(pkt->data);
@@ -340,34 +343,10 @@ fill_direct_exec_buf(uint16_t cu_idx, volatile struct host_queue_packet *pkt,
   return pkt_size;
 }
 
-void
+ert_dpu_data *
 hw_q_umq::
-fill_slot_and_send(volatile struct host_queue_packet *pkt, size_t size)
+get_exec_buf(bo *boh, uint16_t& cu_idx, uint64_t& comp)
 {
-  if (size > sizeof(pkt->data))
-    shim_err(EINVAL, "HSA packet payload too big, size=0x%lx", size);
-
-  auto hdr = &pkt->xrt_header;
-  hdr->common_header.count = size;
-
-  /* must flush data to make cache coherence */
-  clflush_data((void *)(pkt->data), size);
-
-  //comment this out, debug only
-  //dump();
-
-  /* Always done as last step. */
-  mark_slot_valid(pkt);
-
-  /* Wake up CERT */
-  *m_mapped_doorbell = 0;
-}
-
-void
-hw_q_umq::
-issue_command(xrt_core::buffer_handle *cmd_bo)
-{
-  auto boh = static_cast<bo*>(cmd_bo);
   auto cmd = reinterpret_cast<ert_start_kernel_cmd *>(boh->map(bo::map_type::write));
 
   // Sanity check
@@ -382,17 +361,106 @@ issue_command(xrt_core::buffer_handle *cmd_bo)
     shim_err(EINVAL, "No dpu data, invalid exec buf");
   }
 
-  if (get_ert_dpu_data_next(dpu_data))
+  // A reserved slot can't be given back, so nothing may fail once it is
+  // taken. Indirect packet size is checked here instead of when filling it.
+  if (get_ert_dpu_data_next(dpu_data)) {
     shim_debug("this is a multi-column dpu request.");
 
+    if (dpu_data->chained + 1 >= HSA_INDIRECT_PKT_NUM)
+      shim_err(EINVAL, "unsupported indirect number %d, valid number <= %d",
+        dpu_data->chained + 1, HSA_INDIRECT_PKT_NUM);
+
+    auto pkt_size = (dpu_data->chained + 1) * sizeof(struct host_indirect_packet_entry);
+    if (pkt_size > sizeof(host_queue_packet::data))
+      shim_err(EINVAL, "dpu pkt_size=0x%lx > pkt_data max size=0x%lx",
+        pkt_size, sizeof(host_queue_packet::data));
+  }
+
   // Completion signal area has to be a full WORD, we utilze the command_bo
-  uint64_t comp = boh->get_properties().paddr + offsetof(ert_start_kernel_cmd, header);
+  comp = boh->get_properties().paddr + offsetof(ert_start_kernel_cmd, header);
+  cu_idx = ffs(cmd->cu_mask) - 1;
 
-  auto id = issue_exec_buf(ffs(cmd->cu_mask) - 1, dpu_data, comp);
-  boh->set_cmd_id(id);
+  return dpu_data;
+}
+
+void
+hw_q_umq::
+issue_command(xrt_core::buffer_handle *cmd_bo)
+{
+  auto boh = static_cast<bo*>(cmd_bo);
+  uint16_t cu_idx;
+  uint64_t comp;
+
+  auto dpu_data = get_exec_buf(boh, cu_idx, comp);
+  auto id = issue_exec_buf(cu_idx, dpu_data, comp);
+  set_cmd_id(boh, id);
   shim_debug("Submitted command (%ld)", id);
 }
 
+void
+hw_q_umq::
+submit_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos,
+  std::vector<uint64_t>& seqs)
+{
+  struct exec_buf_info {
+    bo *boh;
+    uint16_t cu_idx;
+    uint64_t comp;
+    ert_dpu_data *dpu;
+  };
+  const uint32_t capacity = get_header_ptr()->capacity;
+  std::vector<exec_buf_info> cmds;
+  auto first = seqs.size();
+  int err = 0;
+  std::string msg;
+
+  seqs.reserve(first + cmd_bos.size());
+  cmds.reserve(cmd_bos.size());
+
+  // Validate commands before taking any slot, the ones before an invalid
+  // command are still submitted
+  for (auto cmd_bo : cmd_bos) {
+    exec_buf_info info = { static_cast<bo*>(cmd_bo) };
+    try {
+      info.dpu = get_exec_buf(info.boh, info.cu_idx, info.comp);
+    } catch (const xrt_core::system_error& ex) {
+      err = ex.get_code();
+      msg = ex.what();
+      break;
+    }
+    cmds.push_back(info);
+  }
+
+  // Send what fits in the free slots, then go on as the consumer frees more
+  for (size_t done = 0; done < cmds.size();) {
+    auto max = static_cast<uint32_t>(std::min<size_t>(cmds.size() - done, capacity));
+    uint32_t num;
+    uint64_t slot_idx;
+    try {
+      slot_idx = reserve_slots(max, num);
+    } catch (const xrt_core::system_error& ex) {
+      err = ex.get_code();
+      msg = ex.what();
+      break;
+    }
+
+    for (uint32_t i = 0; i < num; i++)
+      fill_exec_buf(slot_idx + i, cmds[done + i].cu_idx, cmds[done + i].dpu, cmds[done + i].comp);
+    // One fence and one doorbell for the whole batch
+    m_producer->send(slot_idx, num);
+
+    for (uint32_t i = 0; i < num; i++) {
+      set_cmd_id(cmds[done + i].boh, slot_idx + i);
+      seqs.push_back(slot_idx + i);
+    }
+    done += num;
+    shim_debug("Submitted %d commands (%ld - %ld)", num, slot_idx, slot_idx + num - 1);
+  }
+
+  if (err)
+    shim_err(err, "Submitted %zu of %zu commands: %s", seqs.size() - first, cmd_bos.size(), msg.c_str());
+}
+
 void
 hw_q_umq::
 bind_hwctx(const hw_ctx *ctx)
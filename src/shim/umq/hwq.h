@@ -8,9 +8,12 @@
 
 #include "ert.h"
 #include "host_queue.h"
+#include "host_queue_producer.h"
 
 namespace shim_xdna {
 
+class bo; // forward declaration
+
 class hw_q_umq : public hw_q
 {
 public:
@@ -21,6 +24,11 @@ public:
   void
   issue_command(xrt_core::buffer_handle *) override;
 
+  // Fill one slot per command and ring the doorbell once per batch
+  void
+  submit_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos,
+    std::vector<uint64_t>& seqs) override;
+
   void
   dump() const;
 
@@ -49,10 +57,14 @@ private:
 
   volatile uint32_t *m_mapped_doorbell = nullptr;
 
-  std::mutex m_mutex;
+  std::unique_ptr<host_queue_producer> m_producer;
 
   uint64_t
-  reserve_slot();
+  reserve_slot(uint32_t num);
+
+  // Reserve up to max slots, at least one, num is set to how many
+  uint64_t
+  reserve_slots(uint32_t max, uint32_t& num);
 
   int
   get_pkt_idx(uint64_t index);
@@ -72,7 +84,10 @@ private:
     volatile struct host_queue_packet *pkt, ert_dpu_data *dpu);
 
   void
-  fill_slot_and_send(volatile struct host_queue_packet *pkt, size_t size);
+  fill_exec_buf(uint64_t slot_idx, uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp);
+
+  ert_dpu_data *
+  get_exec_buf(bo *boh, uint16_t& cu_idx, uint64_t& comp);
 
   uint64_t
   issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu_data, uint64_t comp);
@@ -9,9 +9,13 @@
 #include "exec_buf.h"
 #include "io_config.h"
 
+#include "core/common/config_reader.h"
+#include "core/common/device.h"
 #include "core/common/system.h"
 #include "core/common/shim/fence_handle.h"
+#include "shim/shim_query.h"
 #include <algorithm>
+#include <regex>
 
 namespace {
 
@@ -145,6 +149,94 @@ private:
   }
 };
 
+xrt_core::cuidx_type
+open_dpu_cu_context(device* dev, hw_ctx& hwctx)
+{
+  for (auto& ip : get_xclbin_ip_name2index(dev)) {
+    if (std::regex_match(ip.first, std::regex("DPU.*")))
+      return hwctx.get()->open_cu_context(ip.first);
+  }
+  throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+}
+
+class test_2proc_cmd_fence_deferred : public test_2proc
+{
+public:
+  test_2proc_cmd_fence_deferred(device::id_type id) : test_2proc(id)
+  {}
+
+private:
+  struct ipc_data {
+    pid_t pid;
+    shared_handle::export_handle hdl;
+  };
+
+  void
+  run_test_parent() override
+  {
+    msg("deferred dependency test started...");
+
+    ipc_data idata = {};
+    if (!recv_ipc_data(&idata, sizeof(idata)))
+      return;
+    msg("Received cmd fence fd %d from pid %d", idata.hdl, idata.pid);
+
+    auto dev = get_userpf_device(get_dev_id());
+    auto fence = dev->import_fence(idata.pid, idata.hdl);
+    hw_ctx hwctx{dev.get()};
+    auto hwq = hwctx.get()->get_hw_queue();
+
+    auto wrk = get_xclbin_workspace(dev.get());
+    io_test_bo_set boset{dev.get(), wrk + "/data/"};
+    boset.init_cmd(open_dpu_cu_context(dev.get(), hwctx), false);
+    boset.sync_before_run();
+    auto cbo = boset.get_bos()[IO_TEST_BO_CMD].tbo.get();
+
+    // Child has not submitted its signal yet, driver holds the command back
+    hwq->submit_wait(fence.get());
+    hwq->submit_command(cbo->get());
+    bool held = !hwq->poll_command(cbo->get());
+    send_ipc_data(&held, sizeof(held));
+    if (!held)
+      throw std::runtime_error("Command ran before its dependency was submitted");
+
+    hwq->wait_command(cbo->get(), 5000);
+    auto cpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+    if (cpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("Command error");
+    boset.sync_after_run();
+    boset.verify_result();
+
+    bool success = true;
+    send_ipc_data(&success, sizeof(success));
+  }
+
+  void
+  run_test_child() override
+  {
+    msg("deferred dependency test started...");
+
+    auto dev = get_userpf_device(get_dev_id());
+    auto fence = dev->create_fence(fence_handle::access_mode::process);
+    auto share = fence->share();
+    ipc_data idata = { getpid(), share->get_export_handle() };
+    send_ipc_data(&idata, sizeof(idata));
+
+    // Signal only after parent has submitted the wait and the command
+    bool held;
+    recv_ipc_data(&held, sizeof(held));
+    if (!held)
+      return;
+
+    hw_ctx hwctx{dev.get()};
+    auto hwq = hwctx.get()->get_hw_queue();
+    hwq->submit_signal(fence.get());
+
+    bool success;
+    recv_ipc_data(&success, sizeof(success));
+  }
+};
+
 }
 
 void
@@ -166,3 +258,125 @@ TEST_cmd_fence_device(device::id_type id, std::shared_ptr<device> sdev, arg_type
   test_2proc_cmd_fence_device t2p(id);
   t2p.run_test();
 }
+
+void
+TEST_cmd_fence_timeout(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto fence = dev->create_fence(fence_handle::access_mode::process);
+  auto signaler = fence->clone();
+
+  // Nobody has signaled yet
+  try {
+    fence->wait(100);
+    throw std::runtime_error("Fence wait did not time out");
+  } catch (const xrt_core::system_error& e) {
+    if (e.get_code() != ETIME)
+      throw;
+  }
+
+  // Timed out wait does not move the fence forward
+  signaler->signal();
+  fence->wait(100);
+}
+
+void
+TEST_cmd_fence_deferred(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  // Without it, submit_wait() blocks until the signal is submitted
+  if (!xrt_core::config::detail::get_bool_value("Debug.fence_deferred_dependency", false)) {
+    std::cout << "\tDebug.fence_deferred_dependency is off, skipped" << std::endl;
+    return;
+  }
+
+  // Can't fork with opened device.
+  sdev.reset();
+
+  test_2proc_cmd_fence_deferred t2p(id);
+  t2p.run_test();
+}
+
+void
+TEST_cmd_fence_poll_wait(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  using fence_poll = shim_xdna::query::fence_poll;
+  using fence_wait = shim_xdna::query::fence_wait;
+  auto dev = sdev.get();
+  std::vector<std::unique_ptr<fence_handle>> fences;
+  std::vector<std::unique_ptr<fence_handle>> signalers;
+  std::vector<fence_handle*> fhs;
+
+  for (int i = 0; i < 3; i++) {
+    fences.push_back(dev->create_fence(fence_handle::access_mode::process));
+    signalers.push_back(fences.back()->clone());
+    fhs.push_back(fences.back().get());
+  }
+
+  if (device_query<fence_poll>(dev, fence_poll::args{ fhs[0] }))
+    throw std::runtime_error("Unsignaled fence polled as signaled");
+  auto res = device_query<fence_wait>(dev, fence_wait::args{ fhs, false, 100 });
+  if (res.signaled)
+    throw std::runtime_error("Wait any on unsignaled fences did not time out");
+
+  signalers[1]->signal();
+  res = device_query<fence_wait>(dev, fence_wait::args{ fhs, false, 100 });
+  if (!res.signaled || res.first != 1)
+    throw std::runtime_error("Wait any did not return the signaled fence");
+  res = device_query<fence_wait>(dev, fence_wait::args{ fhs, true, 100 });
+  if (res.signaled)
+    throw std::runtime_error("Wait all returned with unsignaled fences");
+
+  signalers[0]->signal();
+  signalers[2]->signal();
+  res = device_query<fence_wait>(dev, fence_wait::args{ fhs, true, 100 });
+  if (!res.signaled)
+    throw std::runtime_error("Wait all on signaled fences timed out");
+
+  // Polling and multi-wait leave fence state alone, the fence polls as
+  // signaled until it is waited on
+  for (int i = 0; i < 2; i++) {
+    if (!device_query<fence_poll>(dev, fence_poll::args{ fhs[0] }))
+      throw std::runtime_error("Signaled fence polled as unsignaled");
+  }
+  for (auto f : fhs)
+    f->wait(0);
+}
+
+void
+TEST_cmd_fence_recycle(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  using fence_pool_stats = shim_xdna::query::fence_pool_stats;
+  auto dev = sdev.get();
+
+  if (!xrt_core::config::detail::get_uint_value("Debug.fence_pool_size", 0)) {
+    std::cout << "\tDebug.fence_pool_size is 0, skipped" << std::endl;
+    return;
+  }
+
+  // Fully signaled syncobj is recycled
+  {
+    auto fence = dev->create_fence(fence_handle::access_mode::process);
+    fence->clone()->signal();
+    fence->wait(0);
+  }
+  auto before = device_query<fence_pool_stats>(dev);
+  auto fence = dev->create_fence(fence_handle::access_mode::process);
+  auto after = device_query<fence_pool_stats>(dev);
+  if (after.hits != before.hits + 1)
+    throw std::runtime_error("Signaled syncobj not recycled");
+
+  // Points of the previous owner do not satisfy the new fence
+  try {
+    fence->wait(100);
+    throw std::runtime_error("Recycled fence signaled without being signaled");
+  } catch (const xrt_core::system_error& e) {
+    if (e.get_code() != ETIME)
+      throw;
+  }
+  before = device_query<fence_pool_stats>(dev);
+  // Timed out wait leaves its point unsignaled, the syncobj is not recycled
+  fence.reset();
+  after = device_query<fence_pool_stats>(dev);
+  if (after.cached_count != before.cached_count)
+    throw std::runtime_error("Syncobj with unsignaled point recycled");
+}
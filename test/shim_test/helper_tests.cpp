@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2024, Advanced Micro Devices, Inc. All rights reserved.
+
+// Test cases of shim helpers which run on plain host memory, no device needed
+
+#include "core/common/device.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "speed.h"
+#include "shim/cache_flush.h"
+#include "shim/flush_pool.h"
+#include "shim/dirty_range.h"
+#include "shim/bo_pool.h"
+#include "shim/slab_allocator.h"
+#include "shim/cmd_latency.h"
+#include "shim/syncobj_pool.h"
+#include "shim/ioctl_stats.h"
+#include "shim/shim_log.h"
+#include "shim/arg_bo_list.h"
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+
+void
+TEST_cache_flush_speed(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  const std::vector<std::pair<shim_xdna::flush_insn, const char *>> insns = {
+    { shim_xdna::flush_insn::clflush, "clflush" },
+    { shim_xdna::get_flush_insn(), "flush (best)" },
+    { shim_xdna::get_writeback_insn(), "writeback (best)" },
+  };
+  auto min_size = static_cast<size_t>(arg[0]);
+  auto max_size = static_cast<size_t>(arg[1]);
+
+  for (auto size = min_size; size <= max_size; size *= 16) {
+    std::vector<char> buf(size);
+    std::cout << "\tBuffer size 0x" << std::hex << size << std::dec << " bytes" << std::endl;
+    for (auto& insn : insns) {
+      // Dirty all lines so that each flush has real work to do
+      std::memset(buf.data(), 0x5a, size);
+      auto start = clk::now();
+      shim_xdna::flush_range(insn.first, buf.data(), size);
+      auto end = clk::now();
+      get_speed_and_print(insn.second, size, start, end);
+    }
+  }
+}
+
+void
+TEST_parallel_flush_speed(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto nworkers = static_cast<size_t>(arg[0]);
+  arg_type sizes(arg.begin() + 1, arg.end());
+
+  for (auto size : sizes) {
+    std::vector<char> buf(size);
+    std::cout << "\tBuffer size 0x" << std::hex << size << std::dec << " bytes" << std::endl;
+    for (size_t n = 0; n <= nworkers; n = n ? n * 2 : 1) {
+      shim_xdna::flush_pool pool(n, 0);
+      std::memset(buf.data(), 0x5a, size);
+      auto start = clk::now();
+      pool.flush(shim_xdna::get_flush_insn(), buf.data(), size);
+      auto end = clk::now();
+      get_speed_and_print(std::to_string(n + 1) + " thread(s) sync", size, start, end);
+    }
+  }
+
+  // Forked child has none of the workers, it starts its own
+  if (!nworkers || sizes.empty())
+    return;
+  shim_xdna::flush_pool pool(nworkers, 0);
+  std::vector<char> buf(sizes[0]);
+  pool.flush(shim_xdna::get_flush_insn(), buf.data(), buf.size());
+  auto pid = fork();
+  if (pid < 0)
+    throw std::runtime_error("Failed to fork");
+  if (pid == 0) {
+    pool.flush(shim_xdna::get_flush_insn(), buf.data(), buf.size());
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    throw std::runtime_error("Parallel flush in forked child failed");
+}
+
+void
+TEST_dirty_range(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  using range = std::pair<size_t, size_t>;
+  shim_xdna::dirty_range dr;
+  std::vector<range> got;
+  auto collect = [&got] (size_t off, size_t len) { got.emplace_back(off, len); };
+
+  // Overlapping and adjacent writes are merged
+  dr.add(0x100, 0x100);
+  dr.add(0x180, 0x100);
+  dr.add(0x280, 0x80);
+  dr.add(0x1000, 0x10);
+  if (dr.bytes() != 0x200 + 0x10)
+    throw std::runtime_error("Dirty ranges are not merged");
+
+  // Only the part within the window is taken, the rest stays dirty
+  dr.take(0x200, 0x400, collect);
+  if (got != std::vector<range>{ { 0x200, 0x100 } } || dr.bytes() != 0x100 + 0x10)
+    throw std::runtime_error("Unexpected dirty ranges within window");
+
+  got.clear();
+  dr.take(0, 0x2000, collect);
+  if (got != std::vector<range>{ { 0x100, 0x100 }, { 0x1000, 0x10 } } || !dr.empty())
+    throw std::runtime_error("Unexpected dirty ranges after full take");
+
+  if (!shim_xdna::soft_dirty::supported()) {
+    std::cout << "\tSoft-dirty tracking not supported, skipped" << std::endl;
+    return;
+  }
+
+  const size_t pgsz = getpagesize();
+  std::vector<char> buf(pgsz * 64);
+  std::memset(buf.data(), 0, buf.size());
+  auto base = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(buf.data()) + pgsz - 1) & ~(pgsz - 1));
+  if (!shim_xdna::soft_dirty::clear())
+    throw std::runtime_error("Failed to clear soft-dirty bits");
+  base[pgsz * 3] = 1;
+  base[pgsz * 10 + 5] = 1;
+
+  std::set<size_t> pages;
+  shim_xdna::soft_dirty::for_each_dirty_page(base, pgsz * 32, [&] (size_t off) { pages.insert(off / pgsz); });
+  if (pages != std::set<size_t>{ 3, 10 })
+    throw std::runtime_error("Unexpected soft-dirty pages");
+}
+
+void
+TEST_bo_pool(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  // Entry counts how many of them are really freed
+  static int freed;
+  struct entry {
+    std::unique_ptr<int> p;
+    entry(int v) : p(std::make_unique<int>(v)) {}
+    entry(entry&&) = default;
+    ~entry() { if (p) freed++; }
+  };
+  using pool_type = shim_xdna::bo_pool<entry>;
+  const size_t max_bytes = static_cast<size_t>(arg[0]);
+  pool_type pool(max_bytes);
+
+  if (pool_type::size_class(1) != 0x1000 || pool_type::size_class(0x1001) != 0x2000 ||
+    pool_type::size_class(0x100001) != 0x140000 || pool_type::size_class(0x140000) != 0x140000)
+    throw std::runtime_error("Unexpected BO size class");
+
+  freed = 0;
+  if (pool.get(0, 0x1000))
+    throw std::runtime_error("Hit on empty BO pool");
+  // Fill the pool, last put evicts the oldest entry
+  for (size_t i = 0; i <= max_bytes / 0x1000; i++) {
+    if (!pool.put(i % 2, 0x1000, entry(static_cast<int>(i))))
+      throw std::runtime_error("BO is not taken by pool");
+  }
+  if (freed != 1 || pool.stats().cached_bytes != max_bytes)
+    throw std::runtime_error("Oldest BO is not evicted");
+
+  // Most recently freed BO of the same flags and size comes back first
+  auto e = pool.get(0, 0x1000);
+  if (!e || *e->p != static_cast<int>(max_bytes / 0x1000 / 2 * 2))
+    throw std::runtime_error("Unexpected BO from pool");
+  if (pool.get(0, 0x2000))
+    throw std::runtime_error("Hit on wrong size class");
+  if (pool.put(0, max_bytes * 2, entry(-1)))
+    throw std::runtime_error("BO larger than pool is taken");
+
+  pool.trim();
+  auto s = pool.stats();
+  if (s.cached_bytes || s.cached_count || s.hits != 1 || s.misses != 2)
+    throw std::runtime_error("Unexpected BO pool stats after trim");
+  std::cout << "\tBO pool hits " << s.hits << ", misses " << s.misses
+    << ", evictions " << s.evictions << std::endl;
+}
+
+void
+TEST_slab_allocator(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  const size_t slab_size = static_cast<size_t>(arg[0]);
+  const size_t chunk = shim_xdna::slab_allocator::chunk_size;
+  shim_xdna::slab_allocator slab(slab_size);
+  std::vector<size_t> offs;
+
+  if (slab.alloc(chunk + 1))
+    throw std::runtime_error("Block larger than a chunk is allocated");
+
+  // Blocks of one size are packed into one chunk and aligned to their size
+  for (size_t i = 0; i < chunk / 64; i++) {
+    auto off = slab.alloc(16);
+    if (!off || *off >= chunk || *off % 64)
+      throw std::runtime_error("Unexpected offset of small block");
+    offs.push_back(*off);
+  }
+  auto off = slab.alloc(1000);
+  if (!off || *off != chunk)
+    throw std::runtime_error("Unexpected offset of 1KiB block");
+  offs.push_back(*off);
+  if (std::set<size_t>(offs.begin(), offs.end()).size() != offs.size())
+    throw std::runtime_error("Overlapping blocks");
+
+  // Fill up the rest of the slab
+  while (auto o = slab.alloc(chunk))
+    offs.push_back(*o);
+  if (slab.used() != slab_size - chunk + 1024)
+    throw std::runtime_error("Unexpected slab usage");
+
+  // Freed chunk can serve another block size
+  for (size_t i = 0; i < chunk / 64; i++)
+    slab.free(offs[i]);
+  off = slab.alloc(chunk);
+  if (!off || *off != 0)
+    throw std::runtime_error("Freed chunk is not reused");
+  slab.free(*off);
+  for (size_t i = chunk / 64; i < offs.size(); i++)
+    slab.free(offs[i]);
+  if (!slab.empty())
+    throw std::runtime_error("Slab is not empty after all blocks are freed");
+}
+
+void
+TEST_cmd_latency(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  const uint64_t max_ns = 100000;
+  shim_xdna::cmd_latency lat;
+
+  if (lat.expected(0))
+    throw std::runtime_error("Latency is recorded without any command");
+
+  // Average follows the samples of its own key only
+  lat.update(0, 40000);
+  for (int i = 0; i < 64; i++)
+    lat.update(0, 20000);
+  lat.update(1, 500000);
+  auto avg = lat.expected(0);
+  if (avg < 19000 || avg > 21000)
+    throw std::runtime_error("Average does not converge to recent latency");
+  if (lat.expected(1) != 500000)
+    throw std::runtime_error("Average of another key is changed");
+
+  // Spin till a bit past expected completion, block if that is too far out
+  if (shim_xdna::cmd_latency::spin_budget(0, 0, max_ns))
+    throw std::runtime_error("Spin without latency history");
+  if (shim_xdna::cmd_latency::spin_budget(20000, 5000, max_ns) != 20000)
+    throw std::runtime_error("Unexpected spin budget");
+  if (shim_xdna::cmd_latency::spin_budget(20000, 30000, max_ns))
+    throw std::runtime_error("Spin on a command which is already late");
+  if (shim_xdna::cmd_latency::spin_budget(lat.expected(1), 0, max_ns))
+    throw std::runtime_error("Spin on a long running command");
+}
+
+void
+TEST_syncobj_pool(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  shim_xdna::syncobj_pool pool(2);
+
+  if (pool.get())
+    throw std::runtime_error("Syncobj handed out by empty pool");
+
+  // Most recently freed first, with its last used timeline point
+  if (!pool.put({ 1, 10 }) || !pool.put({ 2, 20 }))
+    throw std::runtime_error("Syncobj not taken by pool");
+  if (pool.put({ 3, 30 }))
+    throw std::runtime_error("Syncobj taken by full pool");
+  auto e = pool.get();
+  if (!e || e->handle != 2 || e->point != 20)
+    throw std::runtime_error("Unexpected syncobj from pool");
+
+  pool.clear();
+  if (pool.get())
+    throw std::runtime_error("Syncobj handed out after pool is cleared");
+  auto s = pool.stats();
+  if (s.hits != 1 || s.misses != 2 || s.cached_count)
+    throw std::runtime_error("Unexpected syncobj pool stats");
+}
+
+void
+TEST_ioctl_stats(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  const unsigned long cmd_a = _IOWR('d', 0x40, uint64_t);
+  const unsigned long cmd_b = _IOWR('d', 0x41, uint64_t);
+  shim_xdna::ioctl_stats stats;
+
+  if (!stats.snapshot().empty())
+    throw std::runtime_error("Stats recorded without any ioctl");
+  if (shim_xdna::ioctl_stats::bucket(0) != 0 || shim_xdna::ioctl_stats::bucket(1000) != 10 ||
+    shim_xdna::ioctl_stats::bucket(~0ULL) != shim_xdna::ioctl_stat::hist_buckets - 1)
+    throw std::runtime_error("Unexpected latency bucket");
+
+  // Counters of all threads are summed up, including exited ones
+  stats.record(cmd_a, 1000);
+  std::thread t([&stats, cmd_a, cmd_b] {
+    stats.record(cmd_a, 3000);
+    stats.record(cmd_b, 100);
+  });
+  t.join();
+
+  auto s = stats.snapshot();
+  if (s.size() != 2 || s[0].cmd != cmd_a || s[1].cmd != cmd_b)
+    throw std::runtime_error("Unexpected ioctl commands in stats");
+  if (s[0].count != 2 || s[0].total_ns != 4000 || s[0].hist[10] != 1 || s[0].hist[12] != 1)
+    throw std::runtime_error("Unexpected stats of ioctl command");
+  if (s[1].count != 1 || s[1].hist[7] != 1)
+    throw std::runtime_error("Unexpected stats of ioctl command from other thread");
+
+  // Counters of the exited thread are freed once another thread records,
+  // its calls stay in the sums
+  std::thread t2([&stats, cmd_b] { stats.record(cmd_b, 100); });
+  t2.join();
+  if (stats.thread_count() != 2)
+    throw std::runtime_error("Counters of exited thread not freed");
+  s = stats.snapshot();
+  if (s.size() != 2 || s[0].count != 2 || s[1].count != 2 || s[1].hist[7] != 2)
+    throw std::runtime_error("Stats of exited thread lost");
+}
+
+void
+TEST_shim_log(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  const int nmsgs = shim_xdna::log_ring::slots + 100;
+  std::vector<std::string> out;
+  int evals = 0;
+  uint64_t dropped;
+
+  {
+    // Nothing is written out by the drain thread during test
+    shim_xdna::logger lg(shim_xdna::log_level::info,
+      [&out] (const shim_xdna::log_entry& e) { out.push_back(e.msg); }, std::chrono::hours(1));
+
+    // Arguments are not evaluated if level is off
+    XDNA_LOG(lg, shim_xdna::log_level::debug, "debug %d", ++evals);
+    if (evals)
+      throw std::runtime_error("Disabled log message is formatted");
+
+    // Info is written out right away, debug is queued in ring of the thread
+    XDNA_LOG(lg, shim_xdna::log_level::info, "info %d", 0);
+    if (out.size() != 1 || out[0] != "info 0")
+      throw std::runtime_error("Info message is not written out");
+
+    lg.set_level(shim_xdna::log_level::debug);
+    std::thread t([&lg, nmsgs] {
+      for (int i = 0; i < nmsgs; i++)
+        XDNA_LOG(lg, shim_xdna::log_level::debug, "debug %d", i);
+    });
+    t.join();
+    lg.flush();
+    dropped = lg.dropped();
+  }
+
+  // Full ring drops new messages and keeps the order of queued ones
+  if (out.size() - 1 + dropped != nmsgs || dropped < nmsgs - shim_xdna::log_ring::slots)
+    throw std::runtime_error("Unexpected number of debug messages");
+  for (size_t i = 1; i < out.size(); i++) {
+    if (out[i] != "debug " + std::to_string(i - 1))
+      throw std::runtime_error("Unexpected debug message");
+  }
+
+  // Forked child gets its own drain thread and only writes out its own
+  // messages, what the parent queued is the parent's
+  {
+    std::atomic<int> nout = 0;
+    shim_xdna::logger lg(shim_xdna::log_level::debug,
+      [&nout] (const shim_xdna::log_entry&) { nout++; }, std::chrono::milliseconds(1));
+
+    XDNA_LOG(lg, shim_xdna::log_level::debug, "parent");
+    auto pid = fork();
+    if (pid < 0)
+      throw std::runtime_error("Failed to fork");
+    if (pid == 0) {
+      nout = 0;
+      XDNA_LOG(lg, shim_xdna::log_level::debug, "child");
+      for (int i = 0; i < 1000 && nout.load() != 1; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      _exit(nout.load() == 1 ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+      throw std::runtime_error("Debug message of forked child is not written out");
+  }
+}
+
+void
+TEST_arg_bo_list(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto iters = static_cast<size_t>(arg[0]);
+  auto nargs = static_cast<size_t>(arg[1]);
+  shim_xdna::arg_bo_list args;
+
+  // Out of order bind and rebind keep args sorted by position
+  args.set(3, 30);
+  args.set(1, 10);
+  args.set(2, 20);
+  args.set(1, 11);
+  if (args.size() != 3 || args.begin()[0].handle != 11 || args.begin()[2].handle != 30)
+    throw std::runtime_error("Unexpected arg BO order");
+
+  // Spill to heap beyond inline args, in reverse to insert at front
+  args.clear();
+  for (size_t i = 0; i < shim_xdna::arg_bo_list::inline_args * 2; i++)
+    args.set(shim_xdna::arg_bo_list::inline_args * 2 - i, static_cast<uint32_t>(i));
+  for (size_t i = 0; i < args.size(); i++) {
+    if (args.begin()[i].pos != i + 1)
+      throw std::runtime_error("Unexpected arg BO order after spill");
+  }
+
+  // Bind all args of a command, then copy handles out for submission,
+  // as bind_at() and get_arg_bo_handles() do
+  std::vector<uint32_t> hdls(nargs);
+  auto bench = [&] (const char *name, auto&& bind, auto&& copy) {
+    auto start = clk::now();
+    for (size_t i = 0; i < iters; i++) {
+      for (size_t pos = 0; pos < nargs; pos++)
+        bind(pos, static_cast<uint32_t>(pos + 1));
+      if (copy(hdls.data()) != nargs)
+        throw std::runtime_error("Unexpected number of arg BOs");
+    }
+    auto end = clk::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout << "\t" << name << ": " << ns / iters << " ns per command" << std::endl;
+  };
+
+  std::map<size_t, uint32_t> map;
+  std::mutex lock;
+  bench("std::map",
+    [&] (size_t pos, uint32_t h) {
+      std::lock_guard<std::mutex> lg(lock);
+      if (!pos)
+        map.clear();
+      map[pos] = h;
+    },
+    [&] (uint32_t *out) {
+      std::lock_guard<std::mutex> lg(lock);
+      size_t cnt = 0;
+      for (auto& m : map) {
+        if (std::find(out, out + cnt, m.second) == out + cnt)
+          out[cnt++] = m.second;
+      }
+      return cnt;
+    });
+  bench("arg_bo_list",
+    [&] (size_t pos, uint32_t h) {
+      if (!pos)
+        args.clear();
+      args.set(pos, h);
+    },
+    [&] (uint32_t *out) {
+      size_t cnt = 0;
+      for (auto& a : args) {
+        if (std::find(out, out + cnt, a.handle) == out + cnt)
+          out[cnt++] = a.handle;
+      }
+      return cnt;
+    });
+}
@@ -7,9 +7,18 @@
 #include "dev_info.h"
 #include "io_param.h"
 
+#include "core/common/config_reader.h"
 #include "core/common/device.h"
+#include "core/common/shim/fence_handle.h"
+#include "shim/shim_query.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <string>
+#include <thread>
 #include <regex>
+#include <poll.h>
+#include <unistd.h>
 
 using namespace xrt_core;
 using arg_type = const std::vector<uint64_t>;
@@ -214,12 +223,14 @@ io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist,
   }
 
   // Submit commands and wait for results
+  auto cpu_start = std::clock();
   auto start = clk::now();
   if (io_test_parameters.perf == IO_TEST_THRUPUT_PERF)
     io_test_cmd_submit_and_wait_thruput(hwq, total_hwq_submit, cmdlist_bos);
   else
     io_test_cmd_submit_and_wait_latency(hwq, total_hwq_submit, cmdlist_bos);
   auto end = clk::now();
+  auto cpu_end = std::clock();
 
   // Verify result
   if (io_test_parameters.type != IO_TEST_NOOP_RUN) {
@@ -234,10 +245,13 @@ io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist,
     auto duration_us = std::chrono::duration_cast<us_t>(end - start).count();
     auto cps = (total_hwq_submit * cmds_per_list * 1000000.0) / duration_us;
     auto latency_us = 1000000.0 / cps;
+    // CPU time of the whole process, shows the cost of the wait strategy
+    auto cpu_us = (cpu_end - cpu_start) * 1000000.0 / CLOCKS_PER_SEC;
     std::cout << total_hwq_submit * cmds_per_list << " commands finished in "
               << duration_us << " us, " << cmds_per_list << " commands per list, "
               << cps << " Command/sec,"
-              << " Average latency " << latency_us << " us" << std::endl;
+              << " Average latency " << latency_us << " us,"
+              << " CPU usage " << cpu_us * 100 / duration_us << "%" << std::endl;
   }
 }
 
@@ -324,3 +338,365 @@ TEST_noop_io_with_dup_bo(device::id_type id, std::shared_ptr<device> sdev, arg_t
   boset.run(true);
 }
 
+
+void
+TEST_io_batch(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto total = static_cast<size_t>(arg[0]);
+  // Index of the command failing to submit, none if out of range
+  auto bad = static_cast<size_t>(arg[1]);
+  auto dev = sdev.get();
+  auto local_data_path = get_xclbin_workspace(dev) + "/data/";
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  std::vector<io_test_bo_set> bo_set;
+  for (size_t i = 0; i < total; i++)
+    bo_set.push_back(alloc_and_init_bo_set(dev, local_data_path));
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = find_first_match_ip_name(dev, "DPU.*");
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+
+  std::vector<buffer_handle *> cmds;
+  for (auto& boset : bo_set) {
+    boset.init_cmd(cu_idx, false);
+    boset.sync_before_run();
+    cmds.push_back(boset.get_bos()[IO_TEST_BO_CMD].tbo->get());
+  }
+  // Driver fails to look up the freed arg BO when it gets to this command,
+  // after the ones before it in the same ioctl are submitted. Needs BO pool
+  // and slabs off, as they are by default, for the handle to really go away.
+  if (bad < total)
+    bo_set[bad].get_bos()[IO_TEST_BO_INPUT].tbo.reset();
+
+  // More commands than one ioctl takes, and than the context holds in flight.
+  // Set Debug.hwctx_max_cmds=256 in xrt.ini to cross the per ioctl limit too.
+  auto start = clk::now();
+  auto res = device_query<shim_xdna::query::submit_commands>(dev,
+    shim_xdna::query::submit_commands::args{ hwq, cmds });
+  auto end = clk::now();
+  auto& seqs = res.seqs;
+  auto submitted = seqs.size();
+
+  if ((bad < total) != (res.error != 0))
+    throw std::runtime_error("Unexpected submission error: " + std::to_string(res.error));
+  if (res.error)
+    std::cout << "\tExpected failure: " << strerror(res.error) << std::endl;
+  if (submitted != std::min(bad, total))
+    throw std::runtime_error("Unexpected number of submitted commands: " + std::to_string(submitted));
+  for (size_t i = 1; i < seqs.size(); i++) {
+    if (seqs[i] != seqs[i - 1] + 1)
+      throw std::runtime_error("Commands are not submitted in order");
+  }
+  for (size_t i = 0; i < submitted; i++) {
+    hwq->wait_command(cmds[i], 0);
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cmds[i]->map(buffer_handle::map_type::write));
+    if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("Command error");
+  }
+  std::cout << "\t" << submitted << " commands submitted in "
+    << std::chrono::duration_cast<us_t>(end - start).count() << " us" << std::endl;
+}
+
+void
+TEST_io_completion_fd(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto local_data_path = get_xclbin_workspace(dev) + "/data/";
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  auto boset = alloc_and_init_bo_set(dev, local_data_path);
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = find_first_match_ip_name(dev, "DPU.*");
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+
+  auto fd = device_query<shim_xdna::query::completion_fd>(dev,
+    shim_xdna::query::completion_fd::args{ hwq });
+  pollfd pfd = { .fd = fd, .events = POLLIN };
+  if (poll(&pfd, 1, 0) != 0)
+    throw std::runtime_error("Completion fd is readable before any command is submitted");
+
+  boset.init_cmd(cu_idx, false);
+  boset.sync_before_run();
+  auto cmd = boset.get_bos()[IO_TEST_BO_CMD].tbo->get();
+  hwq->submit_command(cmd);
+
+  auto start = clk::now();
+  if (poll(&pfd, 1, 5000) != 1 || !(pfd.revents & POLLIN))
+    throw std::runtime_error("Completion fd is not readable after command is done");
+  auto end = clk::now();
+
+  uint64_t cnt = 0;
+  if (read(fd, &cnt, sizeof(cnt)) != static_cast<ssize_t>(sizeof(cnt)) || cnt != 1)
+    throw std::runtime_error("Unexpected completion count: " + std::to_string(cnt));
+  if (!hwq->poll_command(cmd))
+    throw std::runtime_error("Command is not done when completion fd is readable");
+  auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cmd->map(buffer_handle::map_type::write));
+  if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+    throw std::runtime_error("Command error");
+  std::cout << "\tCompletion fd readable " << std::chrono::duration_cast<us_t>(end - start).count()
+    << " us after submission" << std::endl;
+}
+
+void
+TEST_io_wait_commands(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto local_data_path = get_xclbin_workspace(dev) + "/data/";
+  using wait_commands = shim_xdna::query::wait_commands;
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  std::vector<io_test_bo_set> bo_set;
+  for (int i = 0; i < 3; i++)
+    bo_set.push_back(alloc_and_init_bo_set(dev, local_data_path));
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = find_first_match_ip_name(dev, "DPU.*");
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+
+  std::vector<buffer_handle *> cmds;
+  for (auto& boset : bo_set) {
+    boset.init_cmd(cu_idx, false);
+    boset.sync_before_run();
+    cmds.push_back(boset.get_bos()[IO_TEST_BO_CMD].tbo->get());
+  }
+
+  // More commands than one wait takes, none of them needs to be submitted
+  const size_t max_wait_cmds = 1024; // AMDXDNA_MAX_WAIT_CMDS
+  try {
+    std::vector<buffer_handle *> too_many(max_wait_cmds + 1, cmds[2]);
+    device_query<wait_commands>(dev, wait_commands::args{ hwq, too_many, true, 0 });
+    throw std::runtime_error("Waiting on too many commands did not fail");
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != EINVAL)
+      throw;
+  }
+
+  std::vector<buffer_handle *> waited{ cmds[0], cmds[1] };
+  std::vector<bool> done;
+  hwq->submit_command(cmds[0]);
+  // Second command is held back by a fence nobody has signaled yet.
+  // Without deferred dependency, submit_wait() would block till it is.
+  if (xrt_core::config::detail::get_bool_value("Debug.fence_deferred_dependency", false)) {
+    auto fence = dev->create_fence(fence_handle::access_mode::process);
+    auto signaler = fence->clone();
+    hwq->submit_wait(fence.get());
+    hwq->submit_command(cmds[1]);
+
+    done = device_query<wait_commands>(dev, wait_commands::args{ hwq, waited, false, 5000 });
+    if (done != std::vector<bool>{ true, false })
+      throw std::runtime_error("Wait for any command did not return with first one done");
+
+    done = device_query<wait_commands>(dev, wait_commands::args{ hwq, waited, true, 100 });
+    if (done != std::vector<bool>{ true, false })
+      throw std::runtime_error("Timed out wait for all commands did not return first one done");
+
+    signaler->signal();
+  } else {
+    std::cout << "\tDebug.fence_deferred_dependency is off, partial wait skipped" << std::endl;
+    hwq->submit_command(cmds[1]);
+  }
+  done = device_query<wait_commands>(dev, wait_commands::args{ hwq, waited, true, 5000 });
+  if (done != std::vector<bool>{ true, true })
+    throw std::runtime_error("Wait for all commands did not return all done");
+
+  for (auto cmd : waited) {
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cmd->map(buffer_handle::map_type::write));
+    if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("Command error");
+  }
+}
+
+void
+TEST_io_cmd_template(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto iters = static_cast<size_t>(arg[0]);
+  auto dev = sdev.get();
+  auto local_data_path = get_xclbin_workspace(dev) + "/data/";
+  using submit_template = shim_xdna::query::submit_template;
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  auto boset = alloc_and_init_bo_set(dev, local_data_path);
+  auto other = alloc_and_init_bo_set(dev, local_data_path);
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = find_first_match_ip_name(dev, "DPU.*");
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+
+  boset.init_cmd(cu_idx, false);
+  boset.sync_before_run();
+  auto cbo = boset.get_bos()[IO_TEST_BO_CMD].tbo;
+  auto cmd = cbo->get();
+  auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+
+  auto wait = [&] () {
+    hwq->wait_command(cmd, 5000);
+    if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("Command error");
+    cmdpkt->state = ERT_CMD_STATE_NEW;
+  };
+  auto submit = [&] () {
+    auto res = device_query<submit_template>(dev, submit_template::args{ hwq, cmd });
+    wait();
+    return res.created;
+  };
+
+  // First submission creates the template, later ones reuse it
+  if (!submit())
+    throw std::runtime_error("Cmd template is not created on first submission");
+  if (submit())
+    throw std::runtime_error("Cmd template is not reused");
+
+  // Closing BOs which are no args of the template keeps it. Needs BO pool
+  // and slabs off, as they are by default, for the handles to really close.
+  {
+    auto unrelated = alloc_and_init_bo_set(dev, local_data_path);
+  }
+  if (submit())
+    throw std::runtime_error("Cmd template is created again after unrelated BOs are closed");
+
+  // Binding another arg BO creates it again, dropping the old one
+  std::swap(boset.get_bos()[IO_TEST_BO_INPUT].tbo, other.get_bos()[IO_TEST_BO_INPUT].tbo);
+  other.get_bos()[IO_TEST_BO_INPUT].tbo.reset();
+  boset.init_cmd(cu_idx, false);
+  if (!submit())
+    throw std::runtime_error("Cmd template is not created again for new arg BO");
+
+  // Same command replayed through the template and through plain
+  // submission, which also goes through the template with Debug.cmd_template
+  auto start = clk::now();
+  for (size_t i = 0; i < iters; i++)
+    submit();
+  auto mid = clk::now();
+  for (size_t i = 0; i < iters; i++) {
+    hwq->submit_command(cmd);
+    wait();
+  }
+  auto end = clk::now();
+
+  std::cout << "\tCmd template: " << std::chrono::duration_cast<us_t>(mid - start).count() / iters
+    << " us per command, exec buf: " << std::chrono::duration_cast<us_t>(end - mid).count() / iters
+    << " us per command" << std::endl;
+}
+
+void
+TEST_io_dev_heap_grow(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto size = static_cast<size_t>(arg[0]);
+  auto count = static_cast<size_t>(arg[1]);
+  auto dev = sdev.get();
+  auto local_data_path = get_xclbin_workspace(dev) + "/data/";
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  auto boset = alloc_and_init_bo_set(dev, local_data_path);
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = find_first_match_ip_name(dev, "DPU.*");
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+
+  auto run = [&] (io_test_bo_set& s) {
+    s.init_cmd(cu_idx, false);
+    s.sync_before_run();
+    auto cbo = s.get_bos()[IO_TEST_BO_CMD].tbo;
+    hwq->submit_command(cbo->get());
+    hwq->wait_command(cbo->get(), 5000);
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+    if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("Command error");
+  };
+  run(boset);
+
+  // Grow dev heap by several segments while the context is alive, the
+  // instruction BO of the next command lands in the last one. Submission
+  // has to map all new segments to firmware at once.
+  std::vector<std::unique_ptr<bo>> fillers;
+  for (size_t i = 0; i < count; i++)
+    fillers.push_back(std::make_unique<bo>(dev, size, XCL_BO_FLAGS_CACHEABLE));
+  auto grown = alloc_and_init_bo_set(dev, local_data_path);
+  run(grown);
+  run(boset);
+}
+
+void
+TEST_io_many_fence_deps(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto n = static_cast<size_t>(arg[0]);
+  auto dev = sdev.get();
+  auto local_data_path = get_xclbin_workspace(dev) + "/data/";
+  bool deferred = xrt_core::config::detail::get_bool_value("Debug.fence_deferred_dependency", false);
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  auto boset = alloc_and_init_bo_set(dev, local_data_path);
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = find_first_match_ip_name(dev, "DPU.*");
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+  boset.init_cmd(cu_idx, false);
+  boset.sync_before_run();
+  auto cmd = boset.get_bos()[IO_TEST_BO_CMD].tbo->get();
+
+  std::vector<std::unique_ptr<fence_handle>> fences;
+  std::vector<std::unique_ptr<fence_handle>> signalers;
+  std::vector<std::unique_ptr<fence_handle>> dups;
+  std::vector<fence_handle*> deps;
+  for (size_t i = 0; i < n; i++) {
+    fences.push_back(dev->create_fence(fence_handle::access_mode::process));
+    signalers.push_back(fences.back()->clone());
+    deps.push_back(fences.back().get());
+    // A clone waits on the same point of the same syncobj
+    if (!(i % 8)) {
+      dups.push_back(fences.back()->clone());
+      deps.push_back(dups.back().get());
+    }
+  }
+  // Waiting on a fence again is for its next point, which must win over
+  // the first one when duplicates are merged
+  deps.push_back(fences.back().get());
+
+  // Some points are signaled before the wait is submitted
+  for (size_t i = 0; i < n / 4; i++)
+    signalers[i]->signal();
+
+  // Without deferred dependency, submit_wait() blocks till all points are
+  // signaled. With it, the second point of the last fence is held back to
+  // check the command waits for it.
+  std::thread t([&signalers, n, deferred] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (size_t i = n / 4; i < n; i++)
+      signalers[i]->signal();
+    if (!deferred)
+      signalers[n - 1]->signal();
+  });
+  hwq->submit_wait(deps);
+  hwq->submit_command(cmd);
+  t.join();
+
+  if (deferred) {
+    if (hwq->wait_command(cmd, 100))
+      throw std::runtime_error("Command ran before the last fence point is signaled");
+    signalers[n - 1]->signal();
+  }
+  if (!hwq->wait_command(cmd, 5000))
+    throw std::runtime_error("Command waiting on many fences timed out");
+  auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cmd->map(buffer_handle::map_type::write));
+  if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+    throw std::runtime_error("Command error");
+}
@@ -11,12 +11,14 @@
 #include "hwctx.h"
 #include "speed.h"
 #include "bo.h"
+#include "shim/shim_query.h"
 
 #include "core/common/query_requests.h"
 #include "core/common/sysinfo.h"
 #include "core/common/system.h"
 #include "core/common/device.h"
 
+#include <cstring>
 #include <filesystem>
 #include <libgen.h>
 #include <fstream>
@@ -33,13 +35,36 @@ void TEST_io_throughput(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_io_runlist_latency(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_io_runlist_throughput(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_noop_io_with_dup_bo(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_batch(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_completion_fd(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_wait_commands(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_cmd_template(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_dev_heap_grow(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_many_fence_deps(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_vadd(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_shim_umq_mp_reserve(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_shim_umq_full_queue_wait(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_shim_umq_doorbell_coalesce(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_memtiles(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_ddr_memtile(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_remote_barrier(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_txn_elf_flow(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_cmd_fence_host(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_cmd_fence_device(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cmd_fence_timeout(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cmd_fence_deferred(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cmd_fence_poll_wait(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cmd_fence_recycle(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cache_flush_speed(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_parallel_flush_speed(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_dirty_range(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_bo_pool(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_slab_allocator(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cmd_latency(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_syncobj_pool(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_ioctl_stats(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_shim_log(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_arg_bo_list(device::id_type, std::shared_ptr<device>, arg_type&);
 
 namespace {
 
@@ -227,6 +252,50 @@ TEST_query_userpf(device::id_type id, std::shared_ptr<device> sdev, arg_type& ar
     << QueryRequestType::to_string(query_result) << std::endl;
 }
 
+void
+TEST_open_query_latency(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  // Close existing device
+  sdev.reset();
+
+  auto start = clk::now();
+  auto dev = get_userpf_device(id);
+  auto vendor = device_query<query::pcie_vendor>(dev);
+  auto end = clk::now();
+
+  std::cout << "\tOpen device and query vendor 0x" << std::hex << vendor << std::dec << " in "
+    << std::chrono::duration_cast<us_t>(end - start).count() << " us" << std::endl;
+}
+
+void
+TEST_ioctl_stats_query(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+
+  // Each query goes down to the driver with an ioctl
+  for (int i = 0; i < 10; i++)
+    device_query<query::firmware_version>(dev);
+
+  auto stats = device_query<shim_xdna::query::ioctl_stats>(dev);
+  if (stats.empty()) {
+    std::cout << "\tIoctl stats are disabled (Debug.ioctl_stats), skipped" << std::endl;
+    return;
+  }
+
+  uint64_t total = 0;
+  for (auto& s : stats) {
+    uint64_t in_hist = 0;
+    for (auto n : s.hist)
+      in_hist += n;
+    if (in_hist != s.count)
+      throw std::runtime_error("Histogram does not add up to call count of ioctl " + std::to_string(s.cmd));
+    total += s.count;
+  }
+  if (total < 10)
+    throw std::runtime_error("Ioctl calls are not counted: " + std::to_string(total));
+  std::cout << "\t" << stats.size() << " ioctl commands, " << total << " calls" << std::endl;
+}
+
 void
 TEST_create_destroy_hw_context(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
 {
@@ -303,6 +372,126 @@ TEST_create_free_bo(device::id_type id, std::shared_ptr<device> sdev, arg_type&
     get_and_show_bo_properties(dev, bo->get());
 }
 
+void
+TEST_dev_bo_fragmentation(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto small_size = static_cast<size_t>(arg[0]);
+  auto large_size = static_cast<size_t>(arg[1]);
+  auto count = static_cast<size_t>(arg[2]);
+  std::vector<std::unique_ptr<bo>> small_bos;
+  std::vector<std::unique_ptr<bo>> large_bos;
+
+  // Interleaved small and large BOs, small ones stay alive
+  for (size_t i = 0; i < count; i++) {
+    small_bos.push_back(std::make_unique<bo>(dev, small_size, XCL_BO_FLAGS_CACHEABLE, 0));
+    large_bos.push_back(std::make_unique<bo>(dev, large_size, XCL_BO_FLAGS_CACHEABLE, 0));
+  }
+  large_bos.clear();
+
+  // Space of the large BOs should be contiguous again
+  bo big{dev, large_size * count, XCL_BO_FLAGS_CACHEABLE, 0};
+  get_and_show_bo_properties(dev, big.get());
+}
+
+void
+TEST_dev_heap_grow(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto size = static_cast<size_t>(arg[0]);
+  auto count = static_cast<size_t>(arg[1]);
+  std::vector<std::unique_ptr<bo>> bos;
+
+  // Total is beyond one heap segment, later BOs land in new segments
+  for (size_t i = 0; i < count; i++) {
+    bos.push_back(std::make_unique<bo>(dev, size, XCL_BO_FLAGS_CACHEABLE, 0));
+    get_and_show_bo_properties(dev, bos.back()->get());
+  }
+}
+
+void
+TEST_bo_pool_reuse(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto size = static_cast<size_t>(arg[0]);
+  auto before = device_query<shim_xdna::query::bo_pool_stats>(dev);
+
+  {
+    bo old_bo{dev, size, XCL_BO_FLAGS_NONE, 0};
+    std::memset(old_bo.map(), 0xff, size);
+  }
+  bo new_bo{dev, size, XCL_BO_FLAGS_NONE, 0};
+
+  auto after = device_query<shim_xdna::query::bo_pool_stats>(dev);
+  if (after.hits == before.hits && after.misses == before.misses) {
+    std::cout << "\tBO pool is disabled (Debug.bo_pool_max_bytes), skipped" << std::endl;
+    return;
+  }
+  if (after.hits != before.hits + 1)
+    throw std::runtime_error("Freed BO is not recycled from BO pool");
+  if (new_bo.size() != size)
+    throw std::runtime_error("Recycled BO size is not what was asked for: " + std::to_string(new_bo.size()));
+
+  auto p = reinterpret_cast<char *>(new_bo.map());
+  for (size_t i = 0; i < size; i++) {
+    if (p[i])
+      throw std::runtime_error("Recycled BO is not cleared at offset " + std::to_string(i));
+  }
+
+  // Dev BOs hold dev heap space, they are never pooled
+  before = device_query<shim_xdna::query::bo_pool_stats>(dev);
+  {
+    bo dev_bo{dev, size, XCL_BO_FLAGS_CACHEABLE, 0};
+  }
+  bo dev_bo{dev, size, XCL_BO_FLAGS_CACHEABLE, 0};
+  after = device_query<shim_xdna::query::bo_pool_stats>(dev);
+  if (after.hits != before.hits || after.misses != before.misses)
+    throw std::runtime_error("Dev BO goes through BO pool");
+}
+
+void
+TEST_bo_write_tracking(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  using write_tracking = shim_xdna::query::bo_write_tracking;
+  using mark_dirty = shim_xdna::query::bo_mark_dirty;
+  const uint32_t manual = 1; // bo_kmq::write_tracking::manual
+  auto dev = sdev.get();
+  auto size = static_cast<size_t>(arg[0]);
+  bo bo{dev, size, XCL_BO_FLAGS_NONE, 0};
+  auto bh = bo.get();
+
+  if (device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0 }))
+    throw std::runtime_error("BO without write tracking has dirty bytes");
+
+  // Whole BO is dirty when tracking starts, pages may have been written
+  if (device_query<write_tracking>(dev, write_tracking::args{ bh, manual }) != manual)
+    throw std::runtime_error("Manual write tracking is not set");
+  if (device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0 }) < size)
+    throw std::runtime_error("BO is not all dirty when write tracking starts");
+
+  // Needs Debug.force_driver_sync off, as it is by default
+  bh->sync(buffer_handle::direction::host2device, size, 0);
+  if (device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0 }))
+    throw std::runtime_error("Dirty bytes are left after sync of whole BO");
+
+  // Sync only flushes and clears dirty ranges within its window
+  device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0x100 });
+  auto dirty = device_query<mark_dirty>(dev, mark_dirty::args{ bh, size / 2, 0x100 });
+  if (dirty != 0x200)
+    throw std::runtime_error("Unexpected dirty bytes: " + std::to_string(dirty));
+  bh->sync(buffer_handle::direction::host2device, size / 2, 0);
+  if (device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0 }) != 0x100)
+    throw std::runtime_error("Dirty range outside of sync window is flushed");
+  bh->sync(buffer_handle::direction::host2device, size / 2, size / 2);
+  if (device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0 }))
+    throw std::runtime_error("Dirty range inside of sync window is not flushed");
+
+  // Back to flushing whole ranges
+  device_query<write_tracking>(dev, write_tracking::args{ bh, 0 });
+  if (device_query<mark_dirty>(dev, mark_dirty::args{ bh, 0, 0x100 }))
+    throw std::runtime_error("Writes are tracked with write tracking off");
+}
+
 void
 TEST_sync_bo(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
 {
@@ -481,6 +670,9 @@ std::vector<test_case> test_list {
   //test_case{ "non_xdna_userpf: query(pcie_vendor)",
   //  TEST_POSITIVE, dev_filter_not_xdna, TEST_query_userpf<query::pcie_vendor>, {}
   //},
+  test_case{ "open device to first query latency",
+    TEST_POSITIVE, dev_filter_xdna, TEST_open_query_latency, {}
+  },
   test_case{ "query(rom_vbnv)",
     TEST_POSITIVE, dev_filter_xdna, TEST_query_userpf<query::rom_vbnv>, {}
   },
@@ -506,6 +698,12 @@ std::vector<test_case> test_list {
     TEST_POSITIVE, dev_filter_xdna, TEST_create_free_bo,
     {XCL_BO_FLAGS_CACHEABLE, 0, 0x2000, 0x400, 0x3000, 0x100}
   },
+  test_case{ "create_and_free_dpu_sequence_bo without fragmenting dev heap",
+    TEST_POSITIVE, dev_filter_xdna, TEST_dev_bo_fragmentation, {0x1000, 0x400000, 8}
+  },
+  test_case{ "create_and_free_dev_bo beyond one heap segment",
+    TEST_POSITIVE, dev_filter_xdna, TEST_dev_heap_grow, {0x3000000, 3}
+  },
   test_case{ "create_and_free_input_output_bo 1 pages",
     TEST_POSITIVE, dev_filter_xdna, TEST_create_free_bo, {XCL_BO_FLAGS_NONE, 0, 128}
   },
@@ -611,12 +809,94 @@ std::vector<test_case> test_list {
   test_case{ "Cmd fencing (driver side)",
     TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_device, {}
   },
+  test_case{ "Cmd fence wait with timeout",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_timeout, {}
+  },
   test_case{ "sync_bo for input_output 1MiB BO",
     TEST_POSITIVE, dev_filter_xdna, TEST_sync_bo, {XCL_BO_FLAGS_NONE, 0, 0x100000}
   },
   test_case{ "sync_bo for input_output 1MiB BO w/ offset and size",
     TEST_POSITIVE, dev_filter_xdna, TEST_sync_bo_off_size, {XCL_BO_FLAGS_NONE, 0, 0x100000, 0x1004, 0x3c}
   },
+  test_case{ "cache flush speed on host memory 4KiB - 256MiB (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_cache_flush_speed, { 0x1000, 0x10000000 }
+  },
+  test_case{ "parallel cache flush speed on host memory (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_parallel_flush_speed, { 8, 0x1000000, 0x8000000 }
+  },
+  test_case{ "BO dirty range tracking (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_dirty_range, {}
+  },
+  test_case{ "BO pool recycling and eviction (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_bo_pool, { 0x10000 }
+  },
+  test_case{ "small BO sub-allocation from slab (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_slab_allocator, { 0x100000 }
+  },
+  test_case{ "command latency history for adaptive wait (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_cmd_latency, {}
+  },
+  test_case{ "syncobj recycling for fences (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_syncobj_pool, {}
+  },
+  test_case{ "per-thread ioctl stats (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_ioctl_stats, {}
+  },
+  test_case{ "allocation-free leveled logging (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_shim_log, {}
+  },
+  test_case{ "cmd BO arg binding speed (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_arg_bo_list, { 1000000, 8 }
+  },
+  test_case{ "UMQ multi-producer slot reservation (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_shim_umq_mp_reserve, { 8, 100000 }
+  },
+  test_case{ "UMQ wait on full queue (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_shim_umq_full_queue_wait, { 64 }
+  },
+  test_case{ "UMQ doorbell writes of batched submission (no device)",
+    TEST_POSITIVE, no_dev_filter, TEST_shim_umq_doorbell_coalesce, { 100000, 16 }
+  },
+  test_case{ "io test batched submission of no-op commands",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_batch, { 300, 300 }
+  },
+  test_case{ "io test batched submission failing in the middle",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_batch, { 300, 150 }
+  },
+  test_case{ "recycle freed input_output bo from BO pool",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_bo_pool_reuse, { 0x100100 }
+  },
+  test_case{ "BO write tracking flushes only dirty ranges",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_bo_write_tracking, { 0x10000 }
+  },
+  test_case{ "query ioctl stats",
+    TEST_POSITIVE, dev_filter_xdna, TEST_ioctl_stats_query, {}
+  },
+  test_case{ "io test completion eventfd of a single no-op command",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_completion_fd, {}
+  },
+  test_case{ "io test waiting on any or all of a set of commands",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_wait_commands, {}
+  },
+  test_case{ "io test replaying a command through its cmd template",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_cmd_template, { 1000 }
+  },
+  test_case{ "io test running commands after dev heap grows by several segments",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_dev_heap_grow, { 0x3000000, 3 }
+  },
+  // More fences than one dependency submission takes (4095)
+  test_case{ "io test running command after many fences, some duplicated or signaled",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_many_fence_deps, { 5000 }
+  },
+  test_case{ "Cmd fencing (wait submitted before signal)",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_deferred, {}
+  },
+  test_case{ "Cmd fencing (poll and wait on many fences)",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_poll_wait, {}
+  },
+  test_case{ "Cmd fencing (recycled syncobjs, Debug.fence_pool_size)",
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_recycle, {}
+  },
 };
 
 } // namespace
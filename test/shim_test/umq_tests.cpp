@@ -5,8 +5,14 @@
 #include "hwctx.h"
 #include "dev_info.h"
 #include "exec_buf.h"
+#include "speed.h"
 
 #include "core/common/device.h"
+#include "shim/umq/host_queue_producer.h"
+
+#include <atomic>
+#include <sys/mman.h>
+#include <thread>
 
 namespace {
 
@@ -106,8 +112,236 @@ void check_umq_vadd_result(int *ifm, int *wts, int *ofm)
     std::cout << "result matched" << std::endl;
 }
 
+// In-memory stand-in for the host queue shared with CERT
+template <size_t NSLOTS>
+struct fake_host_queue
+{
+  struct host_queue_header hdr;
+  struct host_queue_packet pkts[NSLOTS];
+};
+
+// Plays CERT: drain valid slots in order until total packets are consumed
+template <size_t NSLOTS>
+void
+fake_host_queue_drain(fake_host_queue<NSLOTS> *q, uint64_t total)
+{
+  volatile struct host_queue_header *hdr = &q->hdr;
+  volatile struct host_queue_packet *pkts = q->pkts;
+
+  while (hdr->read_index < total) {
+    auto rd = hdr->read_index;
+    if (rd >= hdr->write_index) {
+      std::this_thread::yield();
+      continue;
+    }
+    pkts[rd & (NSLOTS - 1)].xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    hdr->read_index = rd + 1;
+  }
+}
+
 } // namespace
 
+void
+TEST_shim_umq_mp_reserve(device::id_type id, std::shared_ptr<device> sdev, const std::vector<uint64_t>& arg)
+{
+  const size_t nslots = 8;
+  const int nthreads = static_cast<int>(arg[0]);
+  const int cmds_per_thread = static_cast<int>(arg[1]);
+  const uint64_t total = static_cast<uint64_t>(nthreads) * cmds_per_thread;
+  auto q = std::make_unique<fake_host_queue<nslots>>();
+  volatile struct host_queue_header *hdr = &q->hdr;
+  volatile struct host_queue_packet *pkts = q->pkts;
+
+  std::memset(q.get(), 0, sizeof(*q));
+  hdr->capacity = nslots;
+  for (size_t i = 0; i < nslots; i++)
+    pkts[i].xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
+
+  shim_xdna::host_queue_producer producer(hdr, q->pkts);
+  std::atomic<int> errors = 0;
+
+  auto produce = [&] (int tid) {
+    for (int i = 0; i < cmds_per_thread; i++) {
+      uint64_t slot;
+      while (!producer.try_reserve(slot))
+        std::this_thread::yield();
+
+      auto pkt = &pkts[slot & (nslots - 1)];
+      if (pkt->xrt_header.common_header.type != HOST_QUEUE_PACKET_TYPE_INVALID)
+        errors++;
+      pkt->data[0] = tid;
+      pkt->data[1] = i;
+      pkt->data[2] = static_cast<uint32_t>(slot);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
+      producer.publish(slot);
+    }
+  };
+
+  // Plays CERT: consume slots strictly in order
+  auto consume = [&] () {
+    std::vector<int> last(nthreads, -1);
+    while (hdr->read_index < total) {
+      auto rd = hdr->read_index;
+      if (rd >= hdr->write_index) {
+        std::this_thread::yield();
+        continue;
+      }
+      auto pkt = &pkts[rd & (nslots - 1)];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (pkt->xrt_header.common_header.type != HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC ||
+        pkt->data[2] != static_cast<uint32_t>(rd))
+        errors++;
+      auto tid = static_cast<int>(pkt->data[0]);
+      auto seq = static_cast<int>(pkt->data[1]);
+      if (tid < 0 || tid >= nthreads || seq <= last[tid])
+        errors++;
+      else
+        last[tid] = seq;
+      pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      hdr->read_index = rd + 1;
+    }
+  };
+
+  auto start = clk::now();
+  std::thread consumer(consume);
+  std::vector<std::thread> producers;
+  for (int t = 0; t < nthreads; t++)
+    producers.emplace_back(produce, t);
+  for (auto& t : producers)
+    t.join();
+  consumer.join();
+  auto end = clk::now();
+
+  auto dur = std::chrono::duration_cast<us_t>(end - start).count();
+  std::cout << "\t" << nthreads << " producers pushed " << total << " packets through "
+    << nslots << " slots in " << dur << " us" << std::endl;
+
+  if (hdr->write_index != total || producer.get_published() != total)
+    throw std::runtime_error("write_index " + std::to_string(hdr->write_index) +
+      " mismatch, expecting " + std::to_string(total));
+  if (errors)
+    throw std::runtime_error(std::to_string(errors) + " corrupted packets detected");
+}
+
+void
+TEST_shim_umq_full_queue_wait(device::id_type id, std::shared_ptr<device> sdev, const std::vector<uint64_t>& arg)
+{
+  const size_t nslots = 8;
+  const uint64_t total = arg[0];
+  auto q = std::make_unique<fake_host_queue<nslots>>();
+  volatile struct host_queue_header *hdr = &q->hdr;
+
+  std::memset(q.get(), 0, sizeof(*q));
+  hdr->capacity = nslots;
+  shim_xdna::host_queue_producer producer(hdr, q->pkts);
+
+  // Slow consumer, producer has to wait for it on a full queue
+  std::atomic<bool> stop = false;
+  std::thread consumer([&] () {
+    while (hdr->read_index < total && !stop.load()) {
+      if (hdr->read_index < hdr->write_index) {
+        std::this_thread::sleep_for(us_t(200));
+        hdr->read_index = hdr->read_index + 1;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  for (uint64_t i = 0; i < total; i++) {
+    uint64_t slot;
+    if (!producer.reserve_wait(slot, ms_t(1000))) {
+      stop = true;
+      consumer.join();
+      throw std::runtime_error("Timed out waiting for slot " + std::to_string(i));
+    }
+    producer.publish(slot);
+  }
+  consumer.join();
+
+  // Nobody is consuming now, must give up after timeout
+  for (size_t i = 0; i < nslots; i++) {
+    uint64_t slot;
+    if (!producer.try_reserve(slot))
+      throw std::runtime_error("Failed to reserve slot on empty queue");
+    producer.publish(slot);
+  }
+  uint64_t slot;
+  auto start = clk::now();
+  if (producer.reserve_wait(slot, ms_t(10)))
+    throw std::runtime_error("Reserved slot on full queue");
+  auto waited = std::chrono::duration_cast<ms_t>(clk::now() - start).count();
+  std::cout << "\tGave up on full queue after " << waited << " ms" << std::endl;
+  if (waited < 10)
+    throw std::runtime_error("Did not wait for timeout on full queue");
+
+  // Batch takes only the slots consumer has freed so far
+  hdr->read_index = hdr->read_index + 3;
+  if (producer.try_reserve_some(slot, 5) != 3)
+    throw std::runtime_error("Did not reserve all free slots for batch");
+  producer.publish(slot, 3);
+  if (producer.try_reserve_some(slot, 5))
+    throw std::runtime_error("Reserved slots for batch on full queue");
+}
+
+void
+TEST_shim_umq_doorbell_coalesce(device::id_type id, std::shared_ptr<device> sdev, const std::vector<uint64_t>& arg)
+{
+  const size_t nslots = 64;
+  const uint64_t total = arg[0];
+  const uint32_t batch = static_cast<uint32_t>(arg[1]);
+
+  // Mock of the mapped doorbell page
+  auto db_page = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (db_page == MAP_FAILED)
+    throw std::runtime_error("Failed to map mock doorbell page");
+
+  auto run = [&] (uint32_t per_send) {
+    auto q = std::make_unique<fake_host_queue<nslots>>();
+    std::memset(q.get(), 0, sizeof(*q));
+    q->hdr.capacity = nslots;
+    for (size_t i = 0; i < nslots; i++)
+      q->pkts[i].xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
+
+    shim_xdna::host_queue_producer producer(&q->hdr, q->pkts);
+    producer.set_doorbell(reinterpret_cast<volatile uint32_t *>(db_page));
+    std::thread consumer(fake_host_queue_drain<nslots>, q.get(), total);
+
+    auto start = clk::now();
+    for (uint64_t done = 0; done < total; done += per_send) {
+      auto num = static_cast<uint32_t>(std::min<uint64_t>(per_send, total - done));
+      uint64_t slot;
+      while (!producer.try_reserve(slot, num))
+        std::this_thread::yield();
+      for (uint32_t i = 0; i < num; i++) {
+        auto pkt = producer.get_pkt(slot + i);
+        pkt->xrt_header.common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
+        pkt->xrt_header.common_header.count = sizeof(struct exec_buf);
+        pkt->data[0] = static_cast<uint32_t>(slot + i);
+      }
+      producer.send(slot, num);
+    }
+    consumer.join();
+    auto end = clk::now();
+
+    auto dur = std::chrono::duration_cast<ns_t>(end - start).count();
+    auto writes = producer.get_doorbell_writes();
+    std::cout << "\t" << total << " submissions, " << per_send << " per send: "
+      << writes << " doorbell writes, " << dur / total << " ns per submission" << std::endl;
+    return writes;
+  };
+
+  auto single = run(1);
+  auto batched = run(batch);
+  munmap(db_page, 4096);
+
+  if (single != total || batched != (total + batch - 1) / batch)
+    throw std::runtime_error("Unexpected number of doorbell writes");
+}
+
 void
 TEST_shim_umq_remote_barrier(device::id_type id, std::shared_ptr<device> sdev, const std::vector<uint64_t>& arg)
 {